@@ -27,7 +27,6 @@
 **
 ****************************************************************************/
 #include <QtCore/QObject>
-#include <QtCore/QTimer>
 #include <QtCore/QString>
 #include <QtCore/QCommandLineParser>
 #include <QtCore/QCoreApplication>
@@ -44,17 +43,20 @@ public:
         m_device(&QOtaClient::instance()),
         m_guiUpdaterPath(guiUpdater)
     {
-        connect(m_device, &QOtaClient::fetchRemoteMetadataFinished, this, &UpdateChecker::fetchFinished);
+        connect(&m_scheduler, &QOtaUpdateScheduler::checkFinished, this, &UpdateChecker::checkFinished);
         connect(m_device, &QOtaClient::statusStringChanged, this, &UpdateChecker::log);
         connect(m_device, &QOtaClient::errorOccurred, this, &UpdateChecker::logError);
-        connect(&m_fetchTimer, &QTimer::timeout, this, &UpdateChecker::startFetch);
 
         m_repoConfig.setUrl(QStringLiteral("http://www.b2qtupdate.com/ostree-repo"));
         if (!m_device->isRepositoryConfigSet(&m_repoConfig))
             m_device->setRepositoryConfig(&m_repoConfig);
 
-        m_fetchTimer.setSingleShot(true);
-        m_fetchTimer.start();
+        // Check right away, then every 10 minutes on average. The scheduler spreads the checks
+        // of many devices over time and backs off when the server is not reachable.
+        log(QStringLiteral("verifying remote server for system updates..."));
+        m_scheduler.setInterval(10 * 60);
+        m_scheduler.setActive(true);
+        m_scheduler.checkNow();
     }
 
     void log(const QString &message) const { qCInfo(daemon) << message; }
@@ -62,13 +64,7 @@ public:
         qCInfo(daemon) << QString(error).prepend(QStringLiteral("error: "));
     }
 
-    void startFetch()
-    {
-        log(QStringLiteral("verifying remote server for system updates..."));
-        m_device->fetchRemoteMetadata();
-    }
-
-    void fetchFinished(bool success)
+    void checkFinished(bool success)
     {
         if (success && m_device->updateAvailable()) {
             log(QStringLiteral("update available"));
@@ -86,16 +82,14 @@ public:
             // GUI could use IPC to give further instructions to the daemon (based on users actions).
             qApp->quit();
         } else {
-            log(QStringLiteral("no updates"));
-            // Check again 2 seconds later.
-            m_fetchTimer.start(2000);
+            log(QStringLiteral("no updates, next check at ") + m_scheduler.nextCheck().toString());
         }
     }
 
 private:
     QOtaClient *m_device;
     QOtaRepositoryConfig m_repoConfig;
-    QTimer m_fetchTimer;
+    QOtaUpdateScheduler m_scheduler;
     QString m_guiUpdaterPath;
 };
 
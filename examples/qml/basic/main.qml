@@ -87,29 +87,25 @@ Window {
         repoConfigLabel.text += "<br><b>TLS CA:</b> " + (config ? config.tlsCaPath : "not set")
     }
 
-    function updateMetadataLabel(label, metadata, rev) {
-        if (metadata.length === 0) {
-            label.text = "<b>No metadata available</b>"
-            return
-        }
+    function metadataText(metadata, rev) {
+        if (metadata.length === 0)
+            return "<b>No metadata available</b>"
         var metadataObj = JSON.parse(metadata)
-        label.text = ""
+        var text = ""
         for (var property in metadataObj)
-            label.text += "<b>" + property.charAt(0).toUpperCase()
-                        + property.slice(1) + ": </b>" + metadataObj[property] + "<br>"
-        label.text += "<b>Revision: </b>" + rev
-    }
-    function updateBootedMetadataLabel() {
-        updateMetadataLabel(bootedMetadataLabel, OtaClient.bootedMetadata, OtaClient.bootedRevision)
-    }
-    function updateRemoteMetadataLabel() {
-        updateMetadataLabel(remoteMetadataLabel, OtaClient.remoteMetadata, OtaClient.remoteRevision)
+            text += "<b>" + property.charAt(0).toUpperCase()
+                    + property.slice(1) + ": </b>" + metadataObj[property] + "<br>"
+        return text + "<b>Revision: </b>" + rev
     }
-    function updateRollbackMetadataLabel() {
-        updateMetadataLabel(rollbackMetadataLabel, OtaClient.rollbackMetadata, OtaClient.rollbackRevision)
-    }
-    function updateDefaultMetadataLabel() {
-        updateMetadataLabel(defaultMetadataLabel, OtaClient.defaultMetadata, OtaClient.defaultRevision)
+    function deploymentTitle(booted, isDefault, rollback) {
+        var states = []
+        if (booted)
+            states.push("BOOTED")
+        if (isDefault)
+            states.push("DEFAULT")
+        if (rollback)
+            states.push("ROLLBACK")
+        return states.length > 0 ? states.join(", ") : "DEPLOYMENT"
     }
 
     Flickable {
@@ -123,17 +119,21 @@ Window {
             anchors.fill: parent
             anchors.margins: 10
 
-            Label { text: "BOOTED"; Layout.bottomMargin: 14; font.underline: true; }
-            Label { id: bootedMetadataLabel; lineHeight : 1.3 }
+            Repeater {
+                model: OtaClient.deployments
+                ColumnLayout {
+                    Layout.topMargin: index > 0 ? 14 : 0
+                    Label {
+                        text: deploymentTitle(isBooted, isDefault, isRollback)
+                        Layout.bottomMargin: 14
+                        font.underline: true
+                    }
+                    Label { text: metadataText(metadata, revision); lineHeight : 1.3 }
+                }
+            }
 
             Label { text: "REMOTE"; Layout.bottomMargin: 14; Layout.topMargin: 14; font.underline: true }
-            Label { id: remoteMetadataLabel; lineHeight : 1.3 }
-
-            Label { text: "ROLLBACK"; Layout.bottomMargin: 14; Layout.topMargin: 14; font.underline: true }
-            Label { id: rollbackMetadataLabel; lineHeight : 1.3 }
-
-            Label { text: "DEFAULT"; Layout.bottomMargin: 14; Layout.topMargin: 14; font.underline: true }
-            Label { id: defaultMetadataLabel; lineHeight : 1.3 }
+            Label { id: remoteMetadataLabel; lineHeight : 1.3; text: metadataText(OtaClient.remoteMetadata, OtaClient.remoteRevision) }
 
             Label { text: "REPOSITORY CONFIGURATION"; Layout.bottomMargin: 14; Layout.topMargin: 14; font.underline: true }
             Label { id: repoConfigLabel; lineHeight : 1.3 }
@@ -209,7 +209,7 @@ Window {
             }
 
             Frame {
-                Layout.preferredHeight: bootedMetadataLabel.font.pixelSize * 12
+                Layout.preferredHeight: remoteMetadataLabel.font.pixelSize * 12
                 Layout.preferredWidth: {
                     Screen.width < 800 ? Screen.width - topLayout.anchors.leftMargin * 2
                                        : Screen.width * 0.5 > 800 ? 800 : Screen.width * 0.5
@@ -259,9 +259,6 @@ Window {
         onRollbackFinished: logWithCondition("Rollback", success)
         onUpdateFinished: logWithCondition("Update", success)
         onRepositoryConfigChanged: updateConfigView(config)
-        onRemoteMetadataChanged: updateRemoteMetadataLabel()
-        onRollbackMetadataChanged: updateRollbackMetadataLabel()
-        onDefaultMetadataChanged: updateDefaultMetadataLabel()
     }
 
     Component.onCompleted: {
@@ -275,10 +272,5 @@ Window {
             // Already configured, so won't be handled by onRepositoryConfigChanged.
             // But config view still needs to be updated.
             updateConfigView(OtaClient.repositoryConfig())
-
-        updateBootedMetadataLabel()
-        updateRemoteMetadataLabel()
-        updateRollbackMetadataLabel()
-        updateDefaultMetadataLabel()
     }
 }
@@ -1,4 +1,7 @@
 TEMPLATE = subdirs
 SUBDIRS = \
     doc \
-    src
+    src \
+    tests
+
+tests.depends = src
@@ -27,7 +27,9 @@
 **
 ****************************************************************************/
 #include <QtOtaUpdate/QOtaClient>
+#include <QtOtaUpdate/QOtaDeploymentModel>
 #include <QtOtaUpdate/QOtaRepositoryConfig>
+#include <QtOtaUpdate/QOtaUpdateScheduler>
 #include <QtQml>
 
 QT_BEGIN_NAMESPACE
@@ -51,6 +53,9 @@ public:
 
         qmlRegisterSingletonType<QOtaClient>(uri, 1, 0, "OtaClient", otaClientSingleton);
         qmlRegisterType<QOtaRepositoryConfig>(uri, 1, 0, "OtaRepositoryConfig");
+        qmlRegisterType<QOtaUpdateScheduler>(uri, 1, 0, "OtaUpdateScheduler");
+        qmlRegisterUncreatableType<QOtaDeploymentModel>(uri, 1, 0, "OtaDeploymentModel",
+                                                        QStringLiteral("Use OtaClient.deployments"));
     }
 };
 
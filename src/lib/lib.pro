@@ -1,5 +1,6 @@
 TARGET = QtOtaUpdate
 QT = core
+QT_PRIVATE += network
 
 MODULE = qtotaupdate
 load(qt_module)
@@ -11,18 +12,30 @@ INCLUDEPATH += \
     $$[QT_SYSROOT]/usr/include/glib-2.0/ \
     $$[QT_SYSROOT]/usr/lib/glib-2.0/include
 
-LIBS += -lostree-1 -lgio-2.0 -lglib-2.0 -lgobject-2.0
+LIBS += -lostree-1 -lgio-2.0 -lglib-2.0 -lgobject-2.0 -llzma
 
 HEADERS += \
+    qotabootcounter_p.h \
     qotaclient.h \
     qotaclientasync_p.h \
     qotaclient_p.h \
+    qotadeploymentmodel.h \
+    qotadeploymentmodel_p.h \
+    qotafetchproxy_p.h \
+    qotapeerserver_p.h \
     qotarepositoryconfig.h \
-    qotarepositoryconfig_p.h
+    qotarepositoryconfig_p.h \
+    qotaupdatescheduler.h \
+    qotaupdatescheduler_p.h
 
 SOURCES += \
+    qotabootcounter.cpp \
     qotaclient.cpp \
+    qotadeploymentmodel.cpp \
+    qotafetchproxy.cpp \
     qotarepositoryconfig.cpp
 
 NO_PCH_SOURCES += \
-    qotaclientasync.cpp
+    qotaclientasync.cpp \
+    qotapeerserver.cpp \
+    qotaupdatescheduler.cpp
@@ -0,0 +1,237 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the Qt OTA Update module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:GPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 or (at your option) any later version
+** approved by the KDE Free Qt Foundation. The licenses are as published by
+** the Free Software Foundation and appearing in the file LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+#include "qotabootcounter_p.h"
+#include "qotaclient_p.h"
+
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QPair>
+#include <QtCore/QProcess>
+#include <QtCore/QSaveFile>
+#include <QtCore/QTemporaryFile>
+
+QT_BEGIN_NAMESPACE
+
+static const QByteArray grubEnvHeader("# GRUB Environment Block\n");
+static const int grubEnvSize = 1024;
+const int fwEnvTimeout = 10000;
+
+QOtaBootCounter::QOtaBootCounter(const QString &sysrootPath) :
+    m_bootLoader(UnknownBootLoader)
+{
+    QString boot = sysrootPath + QStringLiteral("/boot");
+    if (QFileInfo::exists(boot + QStringLiteral("/grub2/grub.cfg"))) {
+        m_bootLoader = GrubBootLoader;
+        m_grubEnvPath = boot + QStringLiteral("/grub2/grubenv");
+    } else if (QFileInfo::exists(boot + QStringLiteral("/uEnv.txt"))) {
+        m_bootLoader = UBootBootLoader;
+    }
+}
+
+QMap<QByteArray, QByteArray> QOtaBootCounter::parseGrubEnv(const QByteArray &data)
+{
+    QMap<QByteArray, QByteArray> env;
+    const QList<QByteArray> lines = data.split('\n');
+    for (const QByteArray &line : lines) {
+        int separator = line.indexOf('=');
+        if (line.startsWith('#') || separator <= 0)
+            continue;
+        env.insert(line.left(separator), line.mid(separator + 1));
+    }
+    return env;
+}
+
+QByteArray QOtaBootCounter::serializeGrubEnv(const QMap<QByteArray, QByteArray> &env, int size)
+{
+    QByteArray data = grubEnvHeader;
+    for (auto it = env.cbegin(); it != env.cend(); ++it)
+        data += it.key() + '=' + it.value() + '\n';
+    // GRUB writes the block in place, the size of the file must not shrink.
+    if (data.size() < size)
+        data += QByteArray(size - data.size(), '#');
+    return data;
+}
+
+bool QOtaBootCounter::readGrubEnv(QMap<QByteArray, QByteArray> *env, int *size, QString *error) const
+{
+    QFile file(m_grubEnvPath);
+    *size = grubEnvSize;
+    if (!file.exists())
+        return true;
+    if (!file.open(QFile::ReadOnly)) {
+        *error = QString(QStringLiteral("Failed to read %1: %2")).arg(m_grubEnvPath).arg(file.errorString());
+        return false;
+    }
+    QByteArray data = file.readAll();
+    if (!data.startsWith(grubEnvHeader)) {
+        *error = QString(QStringLiteral("%1 is not a GRUB environment block")).arg(m_grubEnvPath);
+        return false;
+    }
+    *size = qMax(grubEnvSize, data.size());
+    *env = parseGrubEnv(data);
+    return true;
+}
+
+bool QOtaBootCounter::writeGrubEnv(const QMap<QByteArray, QByteArray> &env, int size, QString *error) const
+{
+    QSaveFile file(m_grubEnvPath);
+    if (!file.open(QFile::WriteOnly) || file.write(serializeGrubEnv(env, size)) == -1 || !file.commit()) {
+        *error = QString(QStringLiteral("Failed to write %1: %2")).arg(m_grubEnvPath).arg(file.errorString());
+        return false;
+    }
+    return true;
+}
+
+bool QOtaBootCounter::fwSetEnv(const QList<QPair<QByteArray, QByteArray>> &variables, QString *error) const
+{
+    // All variables are written at once, so the environment is never half updated.
+    QTemporaryFile script;
+    if (!script.open()) {
+        *error = QString(QStringLiteral("Failed to create a fw_setenv script: %1")).arg(script.errorString());
+        return false;
+    }
+    for (const auto &variable : variables)
+        script.write(variable.first + ' ' + variable.second + '\n');
+    script.close();
+
+    QProcess fwSetEnv;
+    fwSetEnv.setProcessChannelMode(QProcess::MergedChannels);
+    fwSetEnv.start(QStringLiteral("fw_setenv"), QStringList() << QStringLiteral("-s") << script.fileName());
+    if (!fwSetEnv.waitForFinished(fwEnvTimeout) || fwSetEnv.exitStatus() != QProcess::NormalExit ||
+        fwSetEnv.exitCode() != 0) {
+        *error = QString(QStringLiteral("fw_setenv failed: %1"))
+                 .arg(fwSetEnv.error() == QProcess::FailedToStart ? fwSetEnv.errorString()
+                                                                  : QString::fromLocal8Bit(fwSetEnv.readAll()).trimmed());
+        return false;
+    }
+    return true;
+}
+
+bool QOtaBootCounter::fwPrintEnv(const QStringList &names, QMap<QByteArray, QByteArray> *env, QString *error) const
+{
+    // fw_printenv fails when one of the variables is not set, so query them one by one.
+    for (const QString &name : names) {
+        QProcess fwPrintEnv;
+        fwPrintEnv.start(QStringLiteral("fw_printenv"), QStringList() << name);
+        if (!fwPrintEnv.waitForFinished(fwEnvTimeout) || fwPrintEnv.exitStatus() != QProcess::NormalExit) {
+            *error = QString(QStringLiteral("fw_printenv failed: %1")).arg(fwPrintEnv.errorString());
+            return false;
+        }
+        if (fwPrintEnv.exitCode() != 0)
+            continue;
+        QByteArray line = fwPrintEnv.readAllStandardOutput().trimmed();
+        int separator = line.indexOf('=');
+        if (separator > 0)
+            env->insert(line.left(separator), line.mid(separator + 1));
+    }
+    return true;
+}
+
+bool QOtaBootCounter::arm(int limit, const QOtaBootEntry &fallback, QString *error)
+{
+    if (m_bootLoader == GrubBootLoader) {
+        QMap<QByteArray, QByteArray> env;
+        int size;
+        if (!readGrubEnv(&env, &size, error))
+            return false;
+        env.insert("ota_boot_counter", QByteArray::number(limit));
+        return writeGrubEnv(env, size, error);
+    }
+
+    if (m_bootLoader == UBootBootLoader) {
+        QByteArray kernel = fallback.kernel.toLatin1();
+        QByteArray bootdir = kernel.left(kernel.lastIndexOf('/') + 1);
+        QList<QPair<QByteArray, QByteArray>> variables;
+        variables << qMakePair(QByteArray("ota_fallback_kernel_image"), kernel)
+                  << qMakePair(QByteArray("ota_fallback_ramdisk_image"), fallback.initrd.toLatin1())
+                  << qMakePair(QByteArray("ota_fallback_bootargs"), fallback.options.toLatin1())
+                  << qMakePair(QByteArray("ota_fallback_bootdir"), bootdir)
+                  << qMakePair(QByteArray("ota_bootlimit"), QByteArray::number(limit))
+                  << qMakePair(QByteArray("ota_bootcount"), QByteArray("0"))
+                  << qMakePair(QByteArray("ota_upgrade_available"), QByteArray("1"));
+        return fwSetEnv(variables, error);
+    }
+
+    qCDebug(qota) << "boot counting is not supported for this boot loader";
+    return true;
+}
+
+bool QOtaBootCounter::disarm(QString *error)
+{
+    if (m_bootLoader == GrubBootLoader) {
+        QMap<QByteArray, QByteArray> env;
+        int size;
+        if (!readGrubEnv(&env, &size, error))
+            return false;
+        if (env.remove("ota_boot_counter") == 0)
+            return true;
+        return writeGrubEnv(env, size, error);
+    }
+
+    if (m_bootLoader == UBootBootLoader) {
+        QMap<QByteArray, QByteArray> env;
+        if (!fwPrintEnv(QStringList() << QStringLiteral("ota_upgrade_available"), &env, error))
+            return false;
+        if (env.value("ota_upgrade_available") != "1")
+            return true;
+        QList<QPair<QByteArray, QByteArray>> variables;
+        variables << qMakePair(QByteArray("ota_upgrade_available"), QByteArray("0"))
+                  << qMakePair(QByteArray("ota_bootcount"), QByteArray("0"));
+        return fwSetEnv(variables, error);
+    }
+
+    return true;
+}
+
+bool QOtaBootCounter::hasFallenBack(QString *error)
+{
+    if (m_bootLoader == GrubBootLoader) {
+        QMap<QByteArray, QByteArray> env;
+        int size;
+        // The counter is 0 also during the last boot attempt of the new system, the
+        // caller tells the two apart by the booted deployment.
+        return readGrubEnv(&env, &size, error) && env.value("ota_boot_counter") == "0";
+    }
+
+    if (m_bootLoader == UBootBootLoader) {
+        QMap<QByteArray, QByteArray> env;
+        const QStringList names = { QStringLiteral("ota_upgrade_available"), QStringLiteral("ota_bootcount"),
+                                    QStringLiteral("ota_bootlimit") };
+        if (!fwPrintEnv(names, &env, error) || env.value("ota_upgrade_available") != "1")
+            return false;
+        // setexpr stores the count as a hexadecimal number
+        bool ok = false;
+        int count = env.value("ota_bootcount").toInt(&ok, 16);
+        return ok && count > env.value("ota_bootlimit").toInt();
+    }
+
+    return false;
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,87 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the Qt OTA Update module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:GPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 or (at your option) any later version
+** approved by the KDE Free Qt Foundation. The licenses are as published by
+** the Free Software Foundation and appearing in the file LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+#ifndef QOTABOOTCOUNTER_P_H
+#define QOTABOOTCOUNTER_P_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QMap>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+
+QT_BEGIN_NAMESPACE
+
+static const int defaultBootCountLimit = 3;
+// U-Boot's setexpr produces hexadecimal numbers, while 'test -gt' compares
+// decimal numbers, and the GRUB configuration counts down explicitly.
+static const int maxBootCountLimit = 9;
+
+// The boot loader entry that is booted when the boot limit is exceeded.
+struct QOtaBootEntry
+{
+    QString kernel;
+    QString initrd;
+    QString options;
+};
+
+// Arms and reads the boot counter of the boot loader. After an update the counter
+// is armed with the boot limit, the boot loader counts the boots of the new
+// system and boots the previous system (the second boot loader entry) when the
+// limit is exceeded. A successful boot disarms the counter.
+//
+// GRUB keeps the counter in the environment block next to grub.cfg, see
+// ostree-grub-generator. U-Boot keeps it in the U-Boot environment, which is
+// accessed with fw_setenv and fw_printenv, see the uEnv.txt examples.
+class Q_DECL_EXPORT QOtaBootCounter
+{
+public:
+    enum BootLoader { UnknownBootLoader, GrubBootLoader, UBootBootLoader };
+
+    explicit QOtaBootCounter(const QString &sysrootPath);
+
+    BootLoader bootLoader() const { return m_bootLoader; }
+    bool arm(int limit, const QOtaBootEntry &fallback, QString *error);
+    bool disarm(QString *error);
+    bool hasFallenBack(QString *error);
+
+    static QMap<QByteArray, QByteArray> parseGrubEnv(const QByteArray &data);
+    static QByteArray serializeGrubEnv(const QMap<QByteArray, QByteArray> &env, int size);
+
+private:
+    bool readGrubEnv(QMap<QByteArray, QByteArray> *env, int *size, QString *error) const;
+    bool writeGrubEnv(const QMap<QByteArray, QByteArray> &env, int size, QString *error) const;
+    bool fwSetEnv(const QList<QPair<QByteArray, QByteArray>> &variables, QString *error) const;
+    bool fwPrintEnv(const QStringList &names, QMap<QByteArray, QByteArray> *env, QString *error) const;
+
+    QString m_grubEnvPath;
+    BootLoader m_bootLoader;
+};
+
+QT_END_NAMESPACE
+
+#endif // QOTABOOTCOUNTER_P_H
@@ -27,7 +27,10 @@
 **
 ****************************************************************************/
 #include "qotaclientasync_p.h"
+#include "qotabootcounter_p.h"
 #include "qotaclient_p.h"
+#include "qotadeploymentmodel_p.h"
+#include "qotadeploymentmodel.h"
 #include "qotarepositoryconfig_p.h"
 #include "qotarepositoryconfig.h"
 #include "qotaclient.h"
@@ -35,27 +38,59 @@
 #include <QtCore/QFile>
 #include <QtCore/QJsonObject>
 #include <QtCore/QDir>
+#include <QtCore/QMetaEnum>
 #include <QtCore/QThread>
 
+#include <algorithm>
+
 QT_BEGIN_NAMESPACE
 
 Q_LOGGING_CATEGORY(qota, "b2qt.ota", QtWarningMsg)
+Q_LOGGING_CATEGORY(qotaLatency, "b2qt.ota.latency", QtInfoMsg)
+
+// One frame at 60 fps.
+const int latencyProbeInterval = 16;
 
 const QString repoConfigPath(QStringLiteral("/etc/ostree/remotes.d/qt-os.conf"));
 
+// Returns the path of the system root without a trailing slash, an empty string
+// for "/". As for the ostree tools, the OSTREE_SYSROOT environment variable
+// overrides it, for example to run against a scratch sysroot.
+QString otaSysroot()
+{
+    QString sysroot = QFile::decodeName(qgetenv("OSTREE_SYSROOT"));
+    while (sysroot.endsWith(QLatin1Char('/')))
+        sysroot.chop(1);
+    return sysroot;
+}
+
 QOtaClientPrivate::QOtaClientPrivate(QOtaClient *client) :
     q_ptr(client),
     m_updateAvailable(false),
     m_rollbackAvailable(false),
-    m_restartRequired(false)
+    m_restartRequired(false),
+    m_repositoryDiskBudget(0),
+    m_retainedDeployments(2),
+    m_bootCountLimit(defaultBootCountLimit),
+    m_niceLevel(0),
+    m_ioPriorityClass(QOtaClient::NormalIoPriority),
+    m_latencyMeasurementEnabled(false),
+    m_deploymentModel(new QOtaDeploymentModel(client))
 {
+    m_latencyProbe.setTimerType(Qt::PreciseTimer);
+    m_latencyProbe.setInterval(latencyProbeInterval);
+    connect(&m_latencyProbe, &QTimer::timeout, this, &QOtaClientPrivate::probeLatency);
+    m_downloadWindowTimer.setSingleShot(true);
+    connect(&m_downloadWindowTimer, &QTimer::timeout, client, &QOtaClient::update);
+
     // https://github.com/ostreedev/ostree/issues/480
-    m_otaEnabled = QFile().exists(QStringLiteral("/ostree/deploy"));
+    m_otaEnabled = QFile().exists(otaSysroot() + QStringLiteral("/ostree/deploy"));
     if (m_otaEnabled) {
         m_otaAsyncThread = new QThread();
         m_otaAsyncThread->start();
         m_otaAsync.reset(new QOtaClientAsync());
         m_otaAsync->moveToThread(m_otaAsyncThread);
+        m_deploymentModel->d_func()->m_otaAsync = m_otaAsync.data();
     }
 }
 
@@ -76,14 +111,15 @@ void QOtaClientPrivate::handleStateChanges()
     Q_Q(QOtaClient);
 
     // The default system is used as the configuration merge source
-    // when performing a system update.
-    bool updateAvailable = m_defaultRev != m_remoteRev;
+    // when performing a system update. A staged system becomes the
+    // default system on the next restart.
+    bool updateAvailable = m_defaultRev != m_remoteRev && m_stagedRev != m_remoteRev;
     if (m_updateAvailable != updateAvailable) {
         m_updateAvailable = updateAvailable;
         emit q->updateAvailableChanged(m_updateAvailable);
     }
 
-    bool restartRequired = m_bootedRev != m_defaultRev;
+    bool restartRequired = m_bootedRev != m_defaultRev || !m_stagedRev.isEmpty();
     if (m_restartRequired != restartRequired) {
         m_restartRequired = restartRequired;
         emit q->restartRequiredChanged(m_restartRequired);
@@ -94,6 +130,7 @@ void QOtaClientPrivate::setBootedMetadata(const QString &bootedRev, const QStrin
 {
     m_bootedRev = bootedRev;
     m_bootedMetadata = bootedMetadata;
+    m_deploymentModel->d_func()->cacheMetadata(bootedRev, bootedMetadata);
 }
 
 void QOtaClientPrivate::statusStringChanged(const QString &status)
@@ -119,6 +156,89 @@ bool QOtaClientPrivate::verifyPathExist(const QString &path)
     return true;
 }
 
+QString QOtaClientPrivate::packageFilePath(const QString &packagePath) const
+{
+    // A split package can be referred to by its directory or by its manifest.
+    QFileInfo package(packagePath);
+    if (package.isDir())
+        return QDir(package.absoluteFilePath()).filePath(QStringLiteral("superblock"));
+    if (package.fileName() == QLatin1String("manifest"))
+        return package.absoluteDir().filePath(QStringLiteral("superblock"));
+    return package.absoluteFilePath();
+}
+
+void QOtaClientPrivate::applyPriorityPolicy()
+{
+    Q_Q(QOtaClient);
+    if (m_otaEnabled)
+        m_otaAsync->setPriorityPolicy(m_niceLevel, m_ioPriorityClass, m_cgroupPath);
+    emit q->priorityPolicyChanged();
+}
+
+void QOtaClientPrivate::applyFetchSettings()
+{
+    if (m_otaEnabled)
+        m_otaAsync->setFetchSettings(m_fetchSettings);
+}
+
+void QOtaClientPrivate::applyDeployOptions()
+{
+    if (m_otaEnabled)
+        m_otaAsync->setDeployOptions(m_deployOptions);
+}
+
+void QOtaClientPrivate::applyPeerSettings()
+{
+    if (m_otaEnabled)
+        m_otaAsync->setPeerSettings(m_peerSettings);
+}
+
+void QOtaClientPrivate::startLatencyMeasurement()
+{
+    if (!m_latencyMeasurementEnabled)
+        return;
+
+    m_latencySamples.clear();
+    m_latencyClock.start();
+    m_latencyProbe.start();
+}
+
+void QOtaClientPrivate::probeLatency()
+{
+    // How late (in microseconds) the timer fired, a stand-in for
+    // the delay a frame rendered on this thread would see.
+    qint64 elapsed = m_latencyClock.nsecsElapsed() / 1000;
+    m_latencyClock.start();
+    m_latencySamples.append(qMax(Q_INT64_C(0), elapsed - latencyProbeInterval * 1000));
+}
+
+void QOtaClientPrivate::reportLatency(const char *operation)
+{
+    if (!m_latencyProbe.isActive())
+        return;
+
+    m_latencyProbe.stop();
+    if (m_latencySamples.isEmpty())
+        return;
+
+    std::sort(m_latencySamples.begin(), m_latencySamples.end());
+    qint64 total = 0;
+    int missedFrames = 0;
+    for (qint64 sample : qAsConst(m_latencySamples)) {
+        total += sample;
+        if (sample >= latencyProbeInterval * 1000)
+            missedFrames++;
+    }
+    int count = m_latencySamples.size();
+    const char *ioClass = QMetaEnum::fromType<QOtaClient::IoPriorityClass>().valueToKey(m_ioPriorityClass);
+    qCInfo(qotaLatency).nospace() << "UI thread latency during " << operation
+        << " (nice " << m_niceLevel << ", " << ioClass << ", cgroup "
+        << (m_cgroupPath.isEmpty() ? QStringLiteral("none") : m_cgroupPath) << "): "
+        << count << " samples, mean " << total / count / 1000.0 << " ms, 99th percentile "
+        << m_latencySamples.at(count * 99 / 100) / 1000.0 << " ms, max "
+        << m_latencySamples.last() / 1000.0 << " ms, " << missedFrames << " missed frames";
+}
+
 void QOtaClientPrivate::rollbackMetadataChanged(const QString &rollbackRev, const QString &rollbackMetadata, int treeCount)
 {
     Q_Q(QOtaClient);
@@ -132,6 +252,7 @@ void QOtaClientPrivate::rollbackMetadataChanged(const QString &rollbackRev, cons
 
     m_rollbackRev = rollbackRev;
     m_rollbackMetadata = rollbackMetadata;
+    m_deploymentModel->d_func()->cacheMetadata(rollbackRev, rollbackMetadata);
 
     q->rollbackMetadataChanged();
 }
@@ -144,6 +265,7 @@ void QOtaClientPrivate::remoteMetadataChanged(const QString &remoteRev, const QS
 
     m_remoteRev = remoteRev;
     m_remoteMetadata = remoteMetadata;
+    m_deploymentModel->d_func()->cacheMetadata(remoteRev, remoteMetadata);
     handleStateChanges();
 
     emit q->remoteMetadataChanged();
@@ -157,11 +279,24 @@ void QOtaClientPrivate::defaultRevisionChanged(const QString &defaultRevision, c
 
     m_defaultRev = defaultRevision;
     m_defaultMetadata = defaultMetadata;
+    m_deploymentModel->d_func()->cacheMetadata(defaultRevision, defaultMetadata);
     handleStateChanges();
 
     emit q->defaultMetadataChanged();
 }
 
+void QOtaClientPrivate::stagedRevisionChanged(const QString &stagedRevision)
+{
+    Q_Q(QOtaClient);
+    if (m_stagedRev == stagedRevision)
+        return;
+
+    m_stagedRev = stagedRevision;
+    handleStateChanges();
+
+    emit q->stagedRevisionChanged();
+}
+
 /*!
     \inqmlmodule QtOtaUpdate
     \qmltype OtaClient
@@ -246,6 +381,26 @@ void QOtaClientPrivate::defaultRevisionChanged(const QString &defaultRevision, c
     indicates whether the operation was successful.
 */
 
+/*!
+    \qmlsignal OtaClient::bootFallbackOccurred(string failedRevision, string bootedRevision)
+
+    This signal is emitted when the system \a failedRevision failed to boot
+    \l bootCountLimit times, the boot loader booted \a bootedRevision instead,
+    and \a bootedRevision has been made the default system again. Unlike
+    rollback(), this happens without a request from the application, and
+    rollbackFinished() is not emitted.
+*/
+
+/*!
+    \fn void QOtaClient::bootFallbackOccurred(const QString &failedRevision, const QString &bootedRevision)
+
+    This signal is emitted when the system \a failedRevision failed to boot
+    \l bootCountLimit times, the boot loader booted \a bootedRevision instead,
+    and \a bootedRevision has been made the default system again. Unlike
+    rollback(), this happens without a request from the application, and
+    rollbackFinished() is not emitted.
+*/
+
 /*!
     \qmlsignal OtaClient::updateOfflineFinished(bool success)
 
@@ -260,6 +415,108 @@ void QOtaClientPrivate::defaultRevisionChanged(const QString &defaultRevision, c
     indicates whether the operation was successful.
 */
 
+/*!
+    \qmlsignal OtaClient::updateFromRepositoryFinished(bool success)
+
+    A notifier signal for updateFromRepository(). The \a success argument
+    indicates whether the operation was successful.
+*/
+
+/*!
+    \fn void QOtaClient::updateFromRepositoryFinished(bool success)
+
+    A notifier signal for updateFromRepository(). The \a success argument
+    indicates whether the operation was successful.
+*/
+
+/*!
+    \qmlsignal OtaClient::measureDiskUsageFinished(bool success)
+
+    A notifier signal for measureDiskUsage(). The \a success argument
+    indicates whether the operation was successful.
+*/
+
+/*!
+    \fn void QOtaClient::measureDiskUsageFinished(bool success)
+
+    A notifier signal for measureDiskUsage(). The \a success argument
+    indicates whether the operation was successful.
+*/
+
+/*!
+    \qmlsignal OtaClient::markBootSuccessfulFinished(bool success)
+
+    A notifier signal for markBootSuccessful(). The \a success argument
+    indicates whether the operation was successful.
+*/
+
+/*!
+    \fn void QOtaClient::markBootSuccessfulFinished(bool success)
+
+    A notifier signal for markBootSuccessful(). The \a success argument
+    indicates whether the operation was successful.
+*/
+
+/*!
+    \qmlsignal OtaClient::bootCountLimitChanged()
+
+    This signal is emitted when the value of \l bootCountLimit changes.
+*/
+
+/*!
+    \fn void QOtaClient::bootCountLimitChanged()
+
+    This signal is emitted when the value of \l bootCountLimit changes.
+*/
+
+/*!
+    \qmlsignal OtaClient::stagedDeploymentChanged()
+
+    This signal is emitted when the value of \l stagedDeployment changes.
+*/
+
+/*!
+    \fn void QOtaClient::stagedDeploymentChanged()
+
+    This signal is emitted when the value of \l stagedDeployment changes.
+*/
+
+/*!
+    \qmlsignal OtaClient::stagedRevisionChanged()
+
+    This signal is emitted when the value of \l stagedRevision changes.
+*/
+
+/*!
+    \fn void QOtaClient::stagedRevisionChanged()
+
+    This signal is emitted when the value of \l stagedRevision changes.
+*/
+
+/*!
+    \qmlsignal OtaClient::syncPolicyChanged()
+
+    This signal is emitted when the value of \l syncPolicy changes.
+*/
+
+/*!
+    \fn void QOtaClient::syncPolicyChanged()
+
+    This signal is emitted when the value of \l syncPolicy changes.
+*/
+
+/*!
+    \qmlsignal OtaClient::retainedDeploymentsChanged()
+
+    This signal is emitted when the value of \l retainedDeployments changes.
+*/
+
+/*!
+    \fn void QOtaClient::retainedDeploymentsChanged()
+
+    This signal is emitted when the value of \l retainedDeployments changes.
+*/
+
 /*!
     \qmlsignal OtaClient::updateRemoteMetadataOfflineFinished(bool success)
 
@@ -391,6 +648,41 @@ void QOtaClientPrivate::defaultRevisionChanged(const QString &defaultRevision, c
     the error message.
 */
 
+/*!
+    \qmlsignal OtaClient::packageVerificationFailed(enumeration error, list<string> parts)
+
+    This signal is emitted when updateOffline() or updateRemoteMetadataOffline()
+    rejects a self-contained update package, before errorOccurred() is emitted.
+    The \a error argument holds the reason and \a parts the affected files or delta
+    parts, see QOtaClient::PackageError.
+*/
+
+/*!
+    \fn void QOtaClient::packageVerificationFailed(QOtaClient::PackageError error, const QStringList &parts)
+
+    This signal is emitted when updateOffline() or updateRemoteMetadataOffline()
+    rejects a self-contained update package, before errorOccurred() is emitted.
+    The \a error argument holds the reason and \a parts the affected files or delta
+    parts. A part is named by its file path in a split package and by its key in
+    the superblock otherwise. No objects are written when a package is rejected.
+*/
+
+/*!
+    \enum QOtaClient::PackageError
+
+    This enum describes why a self-contained update package was rejected.
+
+    \value PackageReadError A file of the package exists, but could not be read.
+    \value InvalidSuperblock The superblock is damaged or does not match the
+           manifest of a split package.
+    \value IncompletePackage Delta parts of a split package are missing or truncated,
+           all of them are reported at once.
+    \value ChecksumMismatch The content of a delta part does not match its checksum
+           in the superblock. Only the first damaged part is reported.
+
+    \sa packageVerificationFailed()
+*/
+
 /*!
     \qmlsignal OtaClient::repositoryConfigChanged(OtaRepositoryConfig config)
 
@@ -407,23 +699,105 @@ void QOtaClientPrivate::defaultRevisionChanged(const QString &defaultRevision, c
     holds the \c nullptr value).
 */
 
+/*!
+    \qmlsignal OtaClient::repositoryDiskBudgetChanged()
+
+    This signal is emitted when the value of \l repositoryDiskBudget changes.
+*/
+
+/*!
+    \fn void QOtaClient::repositoryDiskBudgetChanged()
+
+    This signal is emitted when the value of \l repositoryDiskBudget changes.
+*/
+
+/*!
+    \qmlsignal OtaClient::priorityPolicyChanged()
+
+    This signal is emitted when the value of \l niceLevel, \l ioPriorityClass
+    or \l cgroupPath changes.
+*/
+
+/*!
+    \fn void QOtaClient::priorityPolicyChanged()
+
+    This signal is emitted when the value of \l niceLevel, \l ioPriorityClass
+    or \l cgroupPath changes.
+*/
+
+/*!
+    \qmlsignal OtaClient::latencyMeasurementEnabledChanged()
+
+    This signal is emitted when the value of \l latencyMeasurementEnabled changes.
+*/
+
+/*!
+    \fn void QOtaClient::latencyMeasurementEnabledChanged()
+
+    This signal is emitted when the value of \l latencyMeasurementEnabled changes.
+*/
+
+/*!
+    \qmlsignal OtaClient::bandwidthLimitChanged()
+
+    This signal is emitted when the value of \l bandwidthLimit changes.
+*/
+
+/*!
+    \fn void QOtaClient::bandwidthLimitChanged()
+
+    This signal is emitted when the value of \l bandwidthLimit changes.
+*/
+
+/*!
+    \qmlsignal OtaClient::downloadWindowsChanged()
+
+    This signal is emitted when the value of \l downloadWindows changes.
+*/
+
+/*!
+    \fn void QOtaClient::downloadWindowsChanged()
+
+    This signal is emitted when the value of \l downloadWindows changes.
+*/
+
 QOtaClient::QOtaClient() :
     d_ptr(new QOtaClientPrivate(this))
 {
     Q_D(QOtaClient);
     if (d->m_otaEnabled) {
         QOtaClientAsync *async = d->m_otaAsync.data();
+        QOtaDeploymentModelPrivate *model = d->m_deploymentModel->d_func();
+        qRegisterMetaType<QVector<QOtaDeployment>>();
+        qRegisterMetaType<QOtaFetchSettings>();
         connect(async, &QOtaClientAsync::fetchRemoteMetadataFinished, this, &QOtaClient::fetchRemoteMetadataFinished);
         connect(async, &QOtaClientAsync::updateFinished, this, &QOtaClient::updateFinished);
         connect(async, &QOtaClientAsync::rollbackFinished, this, &QOtaClient::rollbackFinished);
+        connect(async, &QOtaClientAsync::bootFallbackOccurred, this, &QOtaClient::bootFallbackOccurred);
         connect(async, &QOtaClientAsync::updateOfflineFinished, this, &QOtaClient::updateOfflineFinished);
         connect(async, &QOtaClientAsync::updateRemoteMetadataOfflineFinished, this, &QOtaClient::updateRemoteMetadataOfflineFinished);
+        connect(async, &QOtaClientAsync::updateFromRepositoryFinished, this, &QOtaClient::updateFromRepositoryFinished);
+        connect(async, &QOtaClientAsync::measureDiskUsageFinished, this, &QOtaClient::measureDiskUsageFinished);
+        connect(async, &QOtaClientAsync::markBootSuccessfulFinished, this, &QOtaClient::markBootSuccessfulFinished);
         connect(async, &QOtaClientAsync::errorOccurred, d, &QOtaClientPrivate::errorOccurred);
         connect(async, &QOtaClientAsync::statusStringChanged, d, &QOtaClientPrivate::statusStringChanged);
+        connect(async, &QOtaClientAsync::packageVerificationFailed, this, [this](int error, const QStringList &parts) {
+            emit packageVerificationFailed(PackageError(error), parts);
+        });
         connect(async, &QOtaClientAsync::rollbackMetadataChanged, d, &QOtaClientPrivate::rollbackMetadataChanged);
         connect(async, &QOtaClientAsync::remoteMetadataChanged, d, &QOtaClientPrivate::remoteMetadataChanged);
         connect(async, &QOtaClientAsync::defaultRevisionChanged, d, &QOtaClientPrivate::defaultRevisionChanged);
+        connect(async, &QOtaClientAsync::stagedRevisionChanged, d, &QOtaClientPrivate::stagedRevisionChanged);
+        connect(async, &QOtaClientAsync::deploymentsChanged, model, &QOtaDeploymentModelPrivate::setDeployments);
+        connect(async, &QOtaClientAsync::metadataLoaded, model, &QOtaDeploymentModelPrivate::metadataLoaded);
+        connect(async, &QOtaClientAsync::fetchRemoteMetadataFinished, d, [d]() { d->reportLatency("fetchRemoteMetadata"); });
+        connect(async, &QOtaClientAsync::updateFinished, d, [d]() { d->reportLatency("update"); });
+        connect(async, &QOtaClientAsync::rollbackFinished, d, [d]() { d->reportLatency("rollback"); });
+        connect(async, &QOtaClientAsync::updateOfflineFinished, d, [d]() { d->reportLatency("updateOffline"); });
+        connect(async, &QOtaClientAsync::updateRemoteMetadataOfflineFinished, d, [d]() { d->reportLatency("updateRemoteMetadataOffline"); });
+        connect(async, &QOtaClientAsync::updateFromRepositoryFinished, d, [d]() { d->reportLatency("updateFromRepository"); });
         d->m_otaAsync->refreshMetadata(d);
+        d->m_otaAsync->checkBootState();
     }
 }
 
@@ -468,6 +842,7 @@ bool QOtaClient::fetchRemoteMetadata()
     if (!d->m_otaEnabled)
         return false;
 
+    d->startLatencyMeasurement();
     d->m_otaAsync->fetchRemoteMetadata();
     return true;
 }
@@ -482,6 +857,8 @@ bool QOtaClient::fetchRemoteMetadata()
 /*!
 //! [update-description]
     Fetches an OTA update from a remote server and performs the system update.
+    When downloadWindows is set and the current time is outside of all windows, the
+    update is scheduled for the start of the next window.
 
     \include qotaclient.cpp is-async-and-mutating
 //! [update-description]
@@ -490,10 +867,21 @@ bool QOtaClient::fetchRemoteMetadata()
 */
 bool QOtaClient::update()
 {
-    Q_D(const QOtaClient);
+    Q_D(QOtaClient);
     if (!d->m_otaEnabled || !updateAvailable())
         return false;
 
+    QDateTime now = QDateTime::currentDateTime();
+    QDateTime windowStart = d->m_fetchSettings.nextDownloadWindow(now);
+    if (windowStart > now) {
+        d->m_downloadWindowTimer.start(now.msecsTo(windowStart));
+        d->statusStringChanged(QString(QStringLiteral("Update scheduled for %1"))
+                               .arg(windowStart.toString(Qt::ISODate)));
+        return true;
+    }
+
+    d->m_downloadWindowTimer.stop();
+    d->startLatencyMeasurement();
     d->m_otaAsync->update(d->m_remoteRev);
     return true;
 }
@@ -508,7 +896,8 @@ bool QOtaClient::update()
 /*!
 //! [rollback-description]
     Rollback to the previous snapshot of the system. The currently booted system
-    becomes the new rollback system.
+    becomes the new rollback system. Objects that are no longer reachable are
+    pruned from the repository afterwards, see repositoryDiskBudget.
 
     \include qotaclient.cpp is-async-and-mutating
 //! [rollback-description]
@@ -521,114 +910,261 @@ bool QOtaClient::rollback()
     if (!d->m_otaEnabled)
         return false;
 
-    d->m_otaAsync->rollback();
+    d->startLatencyMeasurement();
+    d->m_otaAsync->rollback(QString());
     return true;
 }
 
 /*!
-    \qmlmethod bool OtaClient::updateOffline(string packagePath)
-    \include qotaclient.cpp update-offline
+    \qmlmethod bool OtaClient::rollbackTo(string revision)
+    \include qotaclient.cpp rollback-to
+
+    \sa rollbackFinished(), restartRequired, deployments
 */
 
 /*!
-//! [update-offline]
-    Uses the provided self-contained update package to update the system.
-    This method is an offline counterpart for update(). The \a packagePath
-    argument holds a path to the update package.
+//! [rollback-to]
+    Makes the deployed system with the checksum \a revision the default system,
+    which is started on the next boot. The order of the other deployments is
+    preserved. No data is downloaded, \a revision must be one of the systems
+    in deployments, see retainedDeployments.
 
     \include qotaclient.cpp is-async-and-mutating
+//! [rollback-to]
 
-    \sa updateOfflineFinished(), updateRemoteMetadataOffline()
-//! [update-offline]
+    \sa rollbackFinished(), restartRequired(), deployments()
 */
-bool QOtaClient::updateOffline(const QString &packagePath)
+bool QOtaClient::rollbackTo(const QString &revision)
 {
     Q_D(QOtaClient);
-    if (!d->m_otaEnabled)
-        return false;
-
-    QString package = QFileInfo(packagePath).absoluteFilePath();
-    if (!d->verifyPathExist(package))
+    if (!d->m_otaEnabled || revision.isEmpty())
         return false;
 
-    d->m_otaAsync->updateOffline(package);
+    d->startLatencyMeasurement();
+    d->m_otaAsync->rollback(revision);
     return true;
 }
 
 /*!
-    \qmlmethod bool OtaClient::updateRemoteMetadataOffline(string packagePath)
-    Uses the provided self-contained update package to update remoteMetadata.
-    \include qotaclient.cpp update-remote-offline
+    \qmlmethod bool OtaClient::markBootSuccessful()
+    \include qotaclient.cpp mark-boot-successful
+
+    \sa bootCountLimit, markBootSuccessfulFinished()
 */
 
 /*!
-    Uses the provided self-contained update package to update remoteMetadata().
-//! [update-remote-offline]
-    This method is an offline counterpart for fetchRemoteMetadata(). The \a packagePath
-    argument holds a path to the update package.
+//! [mark-boot-successful]
+    Confirms that the booted system works, which stops the boot counting that
+    started with the last update. Call this method once the device has reached
+    a state that proves the health of the system, for example when the
+    application has started and connected to its services. If this method is
+    not called within bootCountLimit boots, the boot loader boots the previous
+    system.
 
-    \include qotaclient.cpp is-async-and-mutating
-    \sa remoteMetadataChanged(), updateRemoteMetadataOfflineFinished(), updateOffline()
-//! [update-remote-offline]
+    This method is asynchronous and returns immediately. The return value
+    holds whether the operation was started successfully.
+//! [mark-boot-successful]
+
+    \sa bootCountLimit(), markBootSuccessfulFinished()
 */
-bool QOtaClient::updateRemoteMetadataOffline(const QString &packagePath)
+bool QOtaClient::markBootSuccessful()
 {
     Q_D(QOtaClient);
     if (!d->m_otaEnabled)
         return false;
 
-    QFileInfo package(packagePath);
-    if (!package.exists()) {
-        d->errorOccurred(QString(QStringLiteral("The package %1 does not exist"))
-                         .arg(package.absoluteFilePath()));
-        return false;
-    }
-
-    d->m_otaAsync->updateRemoteMetadataOffline(package.absoluteFilePath());
+    d->m_otaAsync->markBootSuccessful();
     return true;
 }
 
 /*!
-    \qmlmethod bool OtaClient::refreshMetadata()
-    \include qotaclient.cpp refresh-metadata
+    \qmlmethod bool OtaClient::measureDiskUsage()
+    \include qotaclient.cpp measure-disk-usage
+
+    \sa measureDiskUsageFinished()
 */
 
 /*!
-//! [refresh-metadata]
-    In a multi-process scenario, refreshMetadata() updates the instances' view of the system.
-    Notifier signals are emitted for properties that depend on changed metadata.
-    Returns \c true if metadata is refreshed successfully; otherwise returns \c false.
+//! [measure-disk-usage]
+    Measures the disk space used by each deployment that is not shared with
+    another deployment, that is the space that becomes available when the
+    deployment is removed. The result is available in the \c diskUsage role
+    of deployments. Files are usually shared between the deployments, so the
+    values are small compared to the size of a system. The measurement walks
+    all deployed files at an idle I/O priority, and the values are invalidated
+    when the deployments change.
 
-    Using this method is not required when only one process is responsible for all OTA tasks.
-//! [refresh-metadata]
+    This method is asynchronous and returns immediately. The return value
+    holds whether the operation was started successfully.
+//! [measure-disk-usage]
+
+    \sa measureDiskUsageFinished()
 */
-bool QOtaClient::refreshMetadata()
+bool QOtaClient::measureDiskUsage()
 {
     Q_D(QOtaClient);
     if (!d->m_otaEnabled)
         return false;
 
-    return d->m_otaAsync->refreshMetadata();
+    d->m_otaAsync->measureDiskUsage();
+    return true;
 }
 
 /*!
-    \qmlmethod bool OtaClient::removeRepositoryConfig()
-    \include qotaclient.cpp remove-repository-config
+    \qmlmethod bool OtaClient::updateOffline(string packagePath)
+    \include qotaclient.cpp update-offline
 */
 
 /*!
-//! [remove-repository-config]
-    Remove a configuration file for the repository.
+//! [update-offline]
+    Uses the provided self-contained update package to update the system.
+    This method is an offline counterpart for update(). The \a packagePath
+    argument holds a path to the update package. For a package that is split
+    into several files, \a packagePath can point to the package directory or
+    to its \c manifest file.
 
-    The repository configuration is stored on a file system in
-    \c {/etc/ostree/remotes.d/}\unicode {0x002A}\c{.conf}
+    The package is verified against the checksums stored in its superblock before
+    any data is written to the system. If the package is truncated or corrupt, the
+    update is aborted and errorOccurred() names the first damaged part. For a split
+    package, all missing or partially transferred parts are listed at once, so that
+    only those need to be transferred again.
 
-    If the configuration file does not exist, this function returns \c true.
-    If the configuration file exists, this function returns \c true if the file
-    is removed successfully; otherwise returns \c false.
+    \include qotaclient.cpp is-async-and-mutating
 
-    \sa setRepositoryConfig(), repositoryConfigChanged()
-//! [remove-repository-config]
+    \sa updateOfflineFinished(), updateRemoteMetadataOffline()
+//! [update-offline]
+*/
+bool QOtaClient::updateOffline(const QString &packagePath)
+{
+    Q_D(QOtaClient);
+    if (!d->m_otaEnabled)
+        return false;
+
+    QString package = d->packageFilePath(packagePath);
+    if (!d->verifyPathExist(package))
+        return false;
+
+    d->startLatencyMeasurement();
+    d->m_otaAsync->updateOffline(package);
+    return true;
+}
+
+/*!
+    \qmlmethod bool OtaClient::updateFromRepository(string repositoryPath)
+    \include qotaclient.cpp update-from-repository
+*/
+
+/*!
+//! [update-from-repository]
+    Updates the system from an OSTree repository on local storage, for example on
+    a USB stick. This method is an offline counterpart for update(). The
+    \a repositoryPath argument holds a path to a repository that contains the
+    \c linux/qt reference, such as the repository generated by \c qt-ostree
+    (see the \c --ostree-repo argument).
+
+    Only the objects that are missing on the device are copied, so one repository
+    can update devices that run any earlier revision. The checksums of the copied
+    objects are verified. Downgrades are rejected, as with updateOffline().
+    remoteMetadata is updated to the metadata of the imported revision.
+
+    \include qotaclient.cpp is-async-and-mutating
+
+    \sa updateFromRepositoryFinished(), updateOffline()
+//! [update-from-repository]
+*/
+bool QOtaClient::updateFromRepository(const QString &repositoryPath)
+{
+    Q_D(QOtaClient);
+    if (!d->m_otaEnabled)
+        return false;
+
+    QFileInfo repository(repositoryPath);
+    if (!repository.isDir() || !QDir(repository.absoluteFilePath()).exists(QStringLiteral("objects"))) {
+        d->errorOccurred(QString(QStringLiteral("%1 is not an OSTree repository"))
+                         .arg(repository.absoluteFilePath()));
+        return false;
+    }
+
+    d->startLatencyMeasurement();
+    d->m_otaAsync->updateFromRepository(repository.absoluteFilePath());
+    return true;
+}
+
+/*!
+    \qmlmethod bool OtaClient::updateRemoteMetadataOffline(string packagePath)
+    Uses the provided self-contained update package to update remoteMetadata.
+    \include qotaclient.cpp update-remote-offline
+*/
+
+/*!
+    Uses the provided self-contained update package to update remoteMetadata().
+//! [update-remote-offline]
+    This method is an offline counterpart for fetchRemoteMetadata(). The \a packagePath
+    argument holds a path to the update package.
+
+    \include qotaclient.cpp is-async-and-mutating
+    \sa remoteMetadataChanged(), updateRemoteMetadataOfflineFinished(), updateOffline()
+//! [update-remote-offline]
+*/
+bool QOtaClient::updateRemoteMetadataOffline(const QString &packagePath)
+{
+    Q_D(QOtaClient);
+    if (!d->m_otaEnabled)
+        return false;
+
+    QFileInfo package(d->packageFilePath(packagePath));
+    if (!package.exists()) {
+        d->errorOccurred(QString(QStringLiteral("The package %1 does not exist"))
+                         .arg(package.absoluteFilePath()));
+        return false;
+    }
+
+    d->startLatencyMeasurement();
+    d->m_otaAsync->updateRemoteMetadataOffline(package.absoluteFilePath());
+    return true;
+}
+
+/*!
+    \qmlmethod bool OtaClient::refreshMetadata()
+    \include qotaclient.cpp refresh-metadata
+*/
+
+/*!
+//! [refresh-metadata]
+    In a multi-process scenario, refreshMetadata() updates the instances' view of the system.
+    Notifier signals are emitted for properties that depend on changed metadata.
+    Returns \c true if metadata is refreshed successfully; otherwise returns \c false.
+
+    Using this method is not required when only one process is responsible for all OTA tasks.
+//! [refresh-metadata]
+*/
+bool QOtaClient::refreshMetadata()
+{
+    Q_D(QOtaClient);
+    if (!d->m_otaEnabled)
+        return false;
+
+    return d->m_otaAsync->refreshMetadata();
+}
+
+/*!
+    \qmlmethod bool OtaClient::removeRepositoryConfig()
+    \include qotaclient.cpp remove-repository-config
+*/
+
+/*!
+//! [remove-repository-config]
+    Remove a configuration file for the repository.
+
+    The repository configuration is stored on a file system in
+    \c {/etc/ostree/remotes.d/}\unicode {0x002A}\c{.conf}
+
+    If the configuration file does not exist, this function returns \c true.
+    If the configuration file exists, this function returns \c true if the file
+    is removed successfully; otherwise returns \c false.
+
+    \sa setRepositoryConfig(), repositoryConfigChanged()
+//! [remove-repository-config]
 */
 bool QOtaClient::removeRepositoryConfig()
 {
@@ -665,7 +1201,11 @@ bool QOtaClient::isRepositoryConfigSet(QOtaRepositoryConfig *config) const
                  currentConfig->tlsPermissive() == config->tlsPermissive() &&
                  currentConfig->tlsClientCertPath() == config->tlsClientCertPath() &&
                  currentConfig->tlsClientKeyPath() == config->tlsClientKeyPath() &&
-                 currentConfig->tlsCaPath() == config->tlsCaPath();
+                 currentConfig->tlsCaPath() == config->tlsCaPath() &&
+                 currentConfig->maxConcurrentRequests() == config->maxConcurrentRequests() &&
+                 currentConfig->connectionTimeout() == config->connectionTimeout() &&
+                 currentConfig->retryCount() == config->retryCount() &&
+                 currentConfig->mirrors() == config->mirrors();
 
     return isSet;
 }
@@ -748,6 +1288,15 @@ bool QOtaClient::setRepositoryConfig(QOtaRepositoryConfig *config)
         cmd.append(QStringLiteral(" --set=tls-ca-path="));
         cmd.append(config->tlsCaPath());
     }
+    // Fetch tuning
+    if (config->maxConcurrentRequests() > 0)
+        cmd.append(QString(QStringLiteral(" --set=qt-max-concurrent-requests=%1")).arg(config->maxConcurrentRequests()));
+    if (config->connectionTimeout() > 0)
+        cmd.append(QString(QStringLiteral(" --set=qt-connection-timeout=%1")).arg(config->connectionTimeout()));
+    if (config->retryCount() > 0)
+        cmd.append(QString(QStringLiteral(" --set=qt-retry-count=%1")).arg(config->retryCount()));
+    if (!config->mirrors().isEmpty())
+        cmd.append(QStringLiteral(" --set=qt-mirrors=") + config->mirrors().join(QLatin1Char(';')));
     // NAME URL [BRANCH...]
     cmd.append(QString(QStringLiteral(" qt-os %1 linux/qt")).arg(config->url()));
 
@@ -779,7 +1328,56 @@ QOtaRepositoryConfig *QOtaClient::repositoryConfig() const
 {
     if (!otaEnabled())
         return nullptr;
-    return QOtaRepositoryConfig().d_func()->repositoryConfigFromFile(repoConfigPath);
+    return QOtaRepositoryConfigPrivate::repositoryConfigFromFile(repoConfigPath);
+}
+
+/*!
+    \qmlmethod list<object> OtaClient::mirrorStatistics()
+
+    \include qotaclient.cpp mirror-statistics
+*/
+
+/*!
+//! [mirror-statistics]
+    Returns diagnostic information about the repository and its mirrors, in the
+    order of preference that was determined for the last pull. Each entry is a map
+    with the following keys:
+
+    \list
+        \li \c url - the URL of the repository or of the mirror.
+        \li \c latency - the latency in milliseconds measured before the last pull,
+            or \c -1 if the mirror did not respond.
+        \li \c throughput - the average throughput in bytes per second.
+        \li \c bytes - the number of bytes fetched from the mirror.
+        \li \c requests - the number of requests sent to the mirror.
+        \li \c failures - the number of failed requests.
+    \endlist
+
+    The statistics are collected for the lifetime of the process. The list is empty
+    until the first pull that uses the mirrors.
+//! [mirror-statistics]
+
+    \sa QOtaRepositoryConfig::mirrors
+*/
+QVariantList QOtaClient::mirrorStatistics() const
+{
+    Q_D(const QOtaClient);
+    QVariantList statistics;
+    if (!otaEnabled())
+        return statistics;
+
+    const QVector<QOtaMirrorStats> mirrors = d->m_otaAsync->fetchProxy()->mirrorStatistics();
+    for (const QOtaMirrorStats &mirror : mirrors) {
+        QVariantMap entry;
+        entry.insert(QStringLiteral("url"), mirror.url.toString());
+        entry.insert(QStringLiteral("latency"), mirror.rtt);
+        entry.insert(QStringLiteral("throughput"), mirror.throughput());
+        entry.insert(QStringLiteral("bytes"), mirror.bytes);
+        entry.insert(QStringLiteral("requests"), mirror.requests);
+        entry.insert(QStringLiteral("failures"), mirror.failures);
+        statistics.append(entry);
+    }
+    return statistics;
 }
 
 /*!
@@ -902,7 +1500,7 @@ bool QOtaClient::rollbackAvailable() const
 
 //! [restart-required-description]
     Holds whether a reboot is required. Reboot is required when the default system
-    differ from the booted system.
+    differ from the booted system, or when a system update is staged (see stagedDeployment).
 
     \sa restartRequiredChanged()
 //! [restart-required-description]
@@ -1084,4 +1682,696 @@ QString QOtaClient::defaultMetadata() const
     return d_func()->m_defaultMetadata;
 }
 
+/*!
+    \qmlproperty OtaDeploymentModel OtaClient::deployments
+    \readonly
+
+    \include qotaclient.cpp deployments
+*/
+
+/*!
+    \property QOtaClient::deployments
+//! [deployments]
+    Holds a model of all system versions that are deployed on the device, including
+    the booted, default and rollback systems. The metadata of a deployment is
+    loaded only when it is requested from the model.
+//! [deployments]
+*/
+QOtaDeploymentModel *QOtaClient::deployments() const
+{
+    return d_func()->m_deploymentModel;
+}
+
+/*!
+    \qmlproperty int OtaClient::retainedDeployments
+    \include qotaclient.cpp retained-deployments
+*/
+
+/*!
+    \property QOtaClient::retainedDeployments
+//! [retained-deployments]
+    Holds the number of system versions that are kept on the device after an
+    update. The new system and the booted system are always kept, and the
+    remaining slots go to the most recently deployed systems. Pinned
+    deployments (see \c {ostree admin pin}) are never removed, but count towards
+    the limit. Any retained system can be restored without network access with
+    rollbackTo(). The minimum and default value is \c 2.
+
+    Each retained system keeps its files on the disk, see measureDiskUsage().
+//! [retained-deployments]
+*/
+int QOtaClient::retainedDeployments() const
+{
+    return d_func()->m_retainedDeployments;
+}
+
+void QOtaClient::setRetainedDeployments(int count)
+{
+    Q_D(QOtaClient);
+    count = qMax(2, count);
+    if (d->m_retainedDeployments == count)
+        return;
+
+    d->m_retainedDeployments = count;
+    if (d->m_otaEnabled)
+        d->m_otaAsync->setRetainedDeployments(count);
+    emit retainedDeploymentsChanged();
+}
+
+/*!
+    \qmlproperty int OtaClient::bootCountLimit
+    \include qotaclient.cpp boot-count-limit
+*/
+
+/*!
+    \property QOtaClient::bootCountLimit
+//! [boot-count-limit]
+    Holds the number of times a new system may fail to boot, before the boot
+    loader boots the previous system instead. The counting starts after a
+    system update and stops when markBootSuccessful() is called. When the
+    previous system has been booted this way, it is made the default system
+    again, and bootFallbackOccurred() and errorOccurred() are emitted.
+
+    The value is in the range from \c 1 to \c 9, the value \c 0 disables boot
+    counting. The default value is \c 3. The boot loader integration is
+    required:
+
+    \list
+        \li GRUB - the configuration generated by \c ostree-grub-generator counts
+            the boots in the \c {/boot/grub2/grubenv} environment block.
+        \li U-Boot - the counter is kept in the U-Boot environment, which the
+            library accesses with the \c fw_setenv and \c fw_printenv tools. The
+            boot script must run \c ota_checkboot after importing \c uEnv.txt,
+            see the examples in \c {examples/device-integration/}.
+    \endlist
+//! [boot-count-limit]
+*/
+int QOtaClient::bootCountLimit() const
+{
+    return d_func()->m_bootCountLimit;
+}
+
+void QOtaClient::setBootCountLimit(int limit)
+{
+    Q_D(QOtaClient);
+    limit = qBound(0, limit, maxBootCountLimit);
+    if (d->m_bootCountLimit == limit)
+        return;
+
+    d->m_bootCountLimit = limit;
+    if (d->m_otaEnabled)
+        d->m_otaAsync->setBootCountLimit(limit);
+    emit bootCountLimitChanged();
+}
+
+/*!
+    \qmlproperty bool OtaClient::stagedDeployment
+    \include qotaclient.cpp staged-deployment
+*/
+
+/*!
+    \property QOtaClient::stagedDeployment
+//! [staged-deployment]
+    Holds whether system updates are staged. The default value is \c false.
+
+    A system update is deployed by checking out the new system, merging the
+    configuration in \c {/etc} and writing the boot loader configuration. When
+    this property is set, the update methods only do the checkout and the
+    configuration merge, at the priority set by niceLevel and ioPriorityClass,
+    and set stagedRevision. The boot loader configuration, the only part that
+    has to be written at once, is written by the \c qota-finalize tool when the
+    system shuts down. The \c qota-finalize.path systemd unit has to be enabled
+    on the device, \c qt-ostree enables it when the tool is found in the image.
+
+    Changes made to \c {/etc} after an update has been staged are not carried
+    over to the new system. Staging another update replaces the staged update,
+    and a rollback discards it. When \c qota-finalize fails, the previous
+    system stays the default one, and errorOccurred() is emitted after the
+    restart.
+//! [staged-deployment]
+*/
+bool QOtaClient::stagedDeployment() const
+{
+    return d_func()->m_deployOptions.staged;
+}
+
+void QOtaClient::setStagedDeployment(bool staged)
+{
+    Q_D(QOtaClient);
+    if (d->m_deployOptions.staged == staged)
+        return;
+
+    d->m_deployOptions.staged = staged;
+    d->applyDeployOptions();
+    emit stagedDeploymentChanged();
+}
+
+/*!
+    \qmlproperty string OtaClient::stagedRevision
+    \readonly
+
+    Holds the revision of the staged system, or an empty string when no system
+    update is staged. The staged system becomes the default system when the
+    system shuts down.
+
+    \sa stagedDeployment
+*/
+
+/*!
+    \property QOtaClient::stagedRevision
+
+    Holds the revision of the staged system, or an empty string when no system
+    update is staged. The staged system becomes the default system when the
+    system shuts down.
+
+    \sa stagedDeployment
+*/
+QString QOtaClient::stagedRevision() const
+{
+    return d_func()->m_stagedRev;
+}
+
+/*!
+    \enum QOtaClient::SyncPolicy
+
+    This enum describes how a system update is flushed to the disk when it is deployed.
+
+    \value FullSync Every file of the new system is synced as it is written (the default).
+    \value BatchedSync The files are written without syncing them, followed by one
+           sync of the file system.
+    \value NoSync The files are written without syncing them. The file systems are
+           synced before the boot loader configuration is switched to the new system.
+
+    \sa syncPolicy
+*/
+
+/*!
+    \qmlproperty enumeration OtaClient::syncPolicy
+    \include qotaclient.cpp sync-policy
+*/
+
+/*!
+    \property QOtaClient::syncPolicy
+//! [sync-policy]
+    Holds how a system update is flushed to the disk when it is deployed. The
+    default value is \c FullSync.
+
+    \list
+    \li \c FullSync - Every file of the new system is synced as it is written.
+    \li \c BatchedSync - The files are written without syncing them, followed by
+        one sync of the file system.
+    \li \c NoSync - The files are written without syncing them. The file systems
+        are synced before the boot loader configuration is switched to the new system,
+        which makes the update durable before it can be booted.
+    \endlist
+
+    All policies are safe against power loss, as the boot loader configuration is
+    switched atomically only after the data is on the disk. A staged deployment (see
+    stagedDeployment) is synced with \c BatchedSync at least, as the boot loader
+    configuration is not written until the system shuts down. The policy applies
+    to the deployment only, the repository keeps its \c core.fsync setting for
+    all other operations.
+
+    The \c qt-ostree/deploy-benchmark script measures the deployment time of each
+    policy on loopback file system images of the target's file systems.
+//! [sync-policy]
+*/
+QOtaClient::SyncPolicy QOtaClient::syncPolicy() const
+{
+    return SyncPolicy(d_func()->m_deployOptions.syncPolicy);
+}
+
+void QOtaClient::setSyncPolicy(SyncPolicy policy)
+{
+    Q_D(QOtaClient);
+    if (d->m_deployOptions.syncPolicy == policy)
+        return;
+
+    d->m_deployOptions.syncPolicy = policy;
+    d->applyDeployOptions();
+    emit syncPolicyChanged();
+}
+
+/*!
+    \qmlproperty real OtaClient::repositoryDiskBudget
+    \include qotaclient.cpp repository-disk-budget
+*/
+
+/*!
+    \property QOtaClient::repositoryDiskBudget
+//! [repository-disk-budget]
+    Holds the maximum disk space in bytes that the repository may use on top of
+    the deployed systems. The default value \c 0 means no limit.
+
+    After each system update or rollback, objects that are not reachable from the
+    deployed systems or the repository's refs are pruned from the repository. This
+    is done at an idle I/O priority, and the reclaimed space and the time it took
+    are reported via the status property. When the repository still exceeds the
+    budget, data of interrupted downloads is removed as well, except for downloads
+    that are still running. If that is not sufficient, errorOccurred() is emitted.
+
+    Objects that are shared with the deployed systems do not count towards the budget.
+//! [repository-disk-budget]
+*/
+qint64 QOtaClient::repositoryDiskBudget() const
+{
+    return d_func()->m_repositoryDiskBudget;
+}
+
+void QOtaClient::setRepositoryDiskBudget(qint64 budget)
+{
+    Q_D(QOtaClient);
+    if (d->m_repositoryDiskBudget == budget)
+        return;
+
+    d->m_repositoryDiskBudget = budget;
+    if (d->m_otaEnabled)
+        d->m_otaAsync->setRepositoryDiskBudget(budget);
+    emit repositoryDiskBudgetChanged();
+}
+
+/*!
+    \enum QOtaClient::IoPriorityClass
+
+    This enum describes the I/O scheduling class of the background OTA work.
+
+    \value NormalIoPriority The I/O priority is derived from the nice level (the default).
+    \value BestEffortIoPriority The lowest priority of the best-effort class.
+    \value IdleIoPriority The idle class. Disk access is granted only when no other
+           process needs the disk.
+
+    \sa ioPriorityClass
+*/
+
+/*!
+    \qmlproperty int OtaClient::niceLevel
+    \include qotaclient.cpp nice-level
+*/
+
+/*!
+    \property QOtaClient::niceLevel
+//! [nice-level]
+    Holds the CPU scheduling priority (from \c -20 to \c 19) of the background OTA
+    work. It applies to the worker thread, to the threads that verify offline update
+    packages and to the \c ostree processes started by the worker thread. The default value is \c 0. Raising the priority above the default requires the
+    \c CAP_SYS_NICE capability.
+
+    Setting a higher value keeps system updates from competing with the UI for CPU
+    time, at the cost of longer update times.
+
+    \sa ioPriorityClass, cgroupPath, latencyMeasurementEnabled
+//! [nice-level]
+*/
+int QOtaClient::niceLevel() const
+{
+    return d_func()->m_niceLevel;
+}
+
+void QOtaClient::setNiceLevel(int niceLevel)
+{
+    Q_D(QOtaClient);
+    niceLevel = qBound(-20, niceLevel, 19);
+    if (d->m_niceLevel == niceLevel)
+        return;
+
+    d->m_niceLevel = niceLevel;
+    d->applyPriorityPolicy();
+}
+
+/*!
+    \qmlproperty enumeration OtaClient::ioPriorityClass
+    \include qotaclient.cpp io-priority-class
+*/
+
+/*!
+    \property QOtaClient::ioPriorityClass
+//! [io-priority-class]
+    Holds the I/O scheduling class of the background OTA work. It applies to the worker
+    thread and to the \c ostree processes started by it. The default value is
+    \c NormalIoPriority. I/O scheduling classes are honored only by I/O schedulers that
+    support them, such as CFQ and BFQ.
+
+    \list
+    \li \c NormalIoPriority - The I/O priority is derived from niceLevel.
+    \li \c BestEffortIoPriority - The lowest priority of the best-effort class.
+    \li \c IdleIoPriority - Disk access is granted only when no other process needs the disk.
+    \endlist
+
+    Regardless of this value, pruning the repository always runs with the idle class.
+
+    \sa niceLevel, cgroupPath
+//! [io-priority-class]
+*/
+QOtaClient::IoPriorityClass QOtaClient::ioPriorityClass() const
+{
+    return IoPriorityClass(d_func()->m_ioPriorityClass);
+}
+
+void QOtaClient::setIoPriorityClass(IoPriorityClass ioPriorityClass)
+{
+    Q_D(QOtaClient);
+    if (d->m_ioPriorityClass == ioPriorityClass)
+        return;
+
+    d->m_ioPriorityClass = ioPriorityClass;
+    d->applyPriorityPolicy();
+}
+
+/*!
+    \qmlproperty string OtaClient::cgroupPath
+    \include qotaclient.cpp cgroup-path
+*/
+
+/*!
+    \property QOtaClient::cgroupPath
+//! [cgroup-path]
+    Holds a path to a cgroup v2 directory, for example \c {/sys/fs/cgroup/ota}. When set,
+    the \c ostree processes started by the worker thread are moved into this cgroup, so
+    that its controllers (such as \c cpu.weight, \c io.weight or \c io.max) limit the
+    update's resource usage. The cgroup must exist and its \c cgroup.procs file must be
+    writable. The threads that verify offline update packages are moved as well, when the
+    cgroup is threaded (its \c cgroup.threads file is writable). The worker thread itself
+    stays in the cgroup of the application.
+
+    By default this property is empty and child processes stay in the cgroup of the application.
+
+    \sa niceLevel, ioPriorityClass
+//! [cgroup-path]
+*/
+QString QOtaClient::cgroupPath() const
+{
+    return d_func()->m_cgroupPath;
+}
+
+void QOtaClient::setCgroupPath(const QString &cgroupPath)
+{
+    Q_D(QOtaClient);
+    if (d->m_cgroupPath == cgroupPath)
+        return;
+
+    d->m_cgroupPath = cgroupPath;
+    d->applyPriorityPolicy();
+}
+
+/*!
+    \qmlproperty bool OtaClient::latencyMeasurementEnabled
+    \include qotaclient.cpp latency-measurement
+*/
+
+/*!
+    \property QOtaClient::latencyMeasurementEnabled
+//! [latency-measurement]
+    Holds whether the latency of the thread that QOtaClient lives in (usually the UI
+    thread) is measured during asynchronous operations. The thread is probed with a
+    timer at 60 Hz. When an operation finishes, the mean, the 99th percentile and the
+    maximum timer delay, and the number of missed frames, are logged together with
+    the current niceLevel, ioPriorityClass and cgroupPath. The \c b2qt.ota.latency
+    logging category is used.
+
+    Run the same operation with and without a priority policy to compare its effect
+    on the UI. The default value is \c false.
+//! [latency-measurement]
+*/
+bool QOtaClient::latencyMeasurementEnabled() const
+{
+    return d_func()->m_latencyMeasurementEnabled;
+}
+
+void QOtaClient::setLatencyMeasurementEnabled(bool enabled)
+{
+    Q_D(QOtaClient);
+    if (d->m_latencyMeasurementEnabled == enabled)
+        return;
+
+    d->m_latencyMeasurementEnabled = enabled;
+    if (!enabled)
+        d->m_latencyProbe.stop();
+    emit latencyMeasurementEnabledChanged();
+}
+
+/*!
+    \qmlproperty real OtaClient::bandwidthLimit
+    \include qotaclient.cpp bandwidth-limit
+*/
+
+/*!
+    \property QOtaClient::bandwidthLimit
+//! [bandwidth-limit]
+    Holds the maximum download rate of update() in bytes per second. The default
+    value \c 0 means no limit.
+
+    When a limit is set, the downloads are routed through a proxy on the loopback
+    interface, which shapes the transfers with a token bucket. When update() finishes
+    downloading, the effective throughput is reported via the status property.
+//! [bandwidth-limit]
+*/
+qint64 QOtaClient::bandwidthLimit() const
+{
+    return d_func()->m_fetchSettings.bandwidthLimit;
+}
+
+void QOtaClient::setBandwidthLimit(qint64 bytesPerSecond)
+{
+    Q_D(QOtaClient);
+    bytesPerSecond = qMax(Q_INT64_C(0), bytesPerSecond);
+    if (d->m_fetchSettings.bandwidthLimit == bytesPerSecond)
+        return;
+
+    d->m_fetchSettings.bandwidthLimit = bytesPerSecond;
+    d->applyFetchSettings();
+    emit bandwidthLimitChanged();
+}
+
+/*!
+    \qmlproperty list<string> OtaClient::downloadWindows
+    \include qotaclient.cpp download-windows
+*/
+
+/*!
+    \property QOtaClient::downloadWindows
+//! [download-windows]
+    Holds the time windows in which update() is allowed to download data. Each window
+    is a string in the \c {HH:mm-HH:mm} format, in local time. A window can cross
+    midnight, for example \c {22:00-06:00}. The default value is an empty list, which
+    means no restrictions.
+
+    When update() is called outside of all windows, the update is scheduled for the
+    start of the next window. When a window closes during a download, requests for
+    the remaining objects are rejected and update() fails. The objects that were
+    already downloaded are kept, so calling update() in the next window continues
+    from where the download stopped.
+
+    Setting a list that contains an invalid window emits errorOccurred() and leaves
+    the property unchanged.
+//! [download-windows]
+*/
+QStringList QOtaClient::downloadWindows() const
+{
+    return d_func()->m_downloadWindows;
+}
+
+void QOtaClient::setDownloadWindows(const QStringList &windows)
+{
+    Q_D(QOtaClient);
+    if (d->m_downloadWindows == windows)
+        return;
+
+    QVector<QPair<QTime, QTime> > parsed;
+    if (!QOtaFetchSettings::parseDownloadWindows(windows, &parsed)) {
+        d->errorOccurred(QStringLiteral("Invalid download windows, expected HH:mm-HH:mm: ")
+                         + windows.join(QLatin1String(", ")));
+        return;
+    }
+
+    d->m_downloadWindows = windows;
+    d->m_fetchSettings.downloadWindows = parsed;
+    d->applyFetchSettings();
+    emit downloadWindowsChanged();
+}
+
+/*!
+    \qmlproperty bool OtaClient::peerSharingEnabled
+    \include qotaclient.cpp peer-sharing
+*/
+
+/*!
+    \property QOtaClient::peerSharingEnabled
+//! [peer-sharing]
+    Holds whether objects are shared with other devices on the local network.
+    The default value is \c false. Sharing requires a \l peerSecret.
+
+    Before update() pulls from the remote repository, it fetches as many objects
+    as possible from the \l peers and from the peers that answer a discovery
+    broadcast on \l peerPort. The remaining objects are pulled from the remote
+    repository. All objects are verified by their checksums, the signature of
+    the commit is verified as for the remote repository (see
+    OtaRepositoryConfig::gpgVerify), and the commit to deploy is always fetched
+    from the remote repository.
+
+    When \l peerInterface is also set, the device serves the objects of its
+    repository read-only over HTTP on that interface, and answers the discovery
+    broadcasts of devices in its subnet. Only the objects are served, not the
+    references or the configuration of the repository, and only to devices that
+    know the peer secret. Files that hold credentials of the device, such as
+    \c /etc/shadow, the SSH host keys and the TLS client certificates of
+    \c /usr/share/ostree/certs, are never served.
+
+    In a factory or in a store, where many devices update to the same commit,
+    this reduces the traffic to the update server. Static deltas are not
+    available from peers.
+//! [peer-sharing]
+*/
+bool QOtaClient::peerSharingEnabled() const
+{
+    return d_func()->m_peerSettings.enabled;
+}
+
+void QOtaClient::setPeerSharingEnabled(bool enabled)
+{
+    Q_D(QOtaClient);
+    if (d->m_peerSettings.enabled == enabled)
+        return;
+
+    d->m_peerSettings.enabled = enabled;
+    d->applyPeerSettings();
+    emit peerSharingChanged();
+}
+
+/*!
+    \qmlproperty int OtaClient::peerPort
+    \include qotaclient.cpp peer-port
+*/
+
+/*!
+    \property QOtaClient::peerPort
+//! [peer-port]
+    Holds the TCP port on which objects are shared with other devices, and the UDP
+    port of the peer discovery. The default value is \c 8091.
+//! [peer-port]
+    \sa peerSharingEnabled
+*/
+int QOtaClient::peerPort() const
+{
+    return d_func()->m_peerSettings.port;
+}
+
+void QOtaClient::setPeerPort(int port)
+{
+    Q_D(QOtaClient);
+    if (port <= 0 || port > 65535) {
+        d->errorOccurred(QString(QStringLiteral("Invalid peer port: %1")).arg(port));
+        return;
+    }
+    if (d->m_peerSettings.port == port)
+        return;
+
+    d->m_peerSettings.port = quint16(port);
+    d->applyPeerSettings();
+    emit peerSharingChanged();
+}
+
+/*!
+    \qmlproperty list<string> OtaClient::peers
+    \include qotaclient.cpp peers
+*/
+
+/*!
+    \property QOtaClient::peers
+//! [peers]
+    Holds a list of peers to fetch objects from, in addition to the peers found by
+    discovery. Each entry is a host name or an address, optionally followed by a
+    port (\c {host:port}). When the port is omitted, \l peerPort is used.
+    Configured peers are asked directly instead of by broadcast, and are tried
+    first. This is useful in networks where broadcasts are filtered. A peer answers
+    only devices in the subnet of its \l peerInterface.
+//! [peers]
+    \sa peerSharingEnabled
+*/
+QStringList QOtaClient::peers() const
+{
+    return d_func()->m_peerSettings.peers;
+}
+
+void QOtaClient::setPeers(const QStringList &peers)
+{
+    Q_D(QOtaClient);
+    if (d->m_peerSettings.peers == peers)
+        return;
+
+    d->m_peerSettings.peers = peers;
+    d->applyPeerSettings();
+    emit peerSharingChanged();
+}
+
+/*!
+    \qmlproperty string OtaClient::peerInterface
+    \include qotaclient.cpp peer-interface
+*/
+
+/*!
+    \property QOtaClient::peerInterface
+//! [peer-interface]
+    Holds the name of the network interface, such as \c eth0, on which objects are
+    served to other devices. The default value is an empty string, objects are then
+    only fetched from peers and not served.
+
+    Objects are served on the first IPv4 address of the interface. Choose an
+    interface of the local network, not one that faces the internet.
+//! [peer-interface]
+    \sa peerSharingEnabled
+*/
+QString QOtaClient::peerInterface() const
+{
+    return d_func()->m_peerSettings.interfaceName;
+}
+
+void QOtaClient::setPeerInterface(const QString &interfaceName)
+{
+    Q_D(QOtaClient);
+    if (d->m_peerSettings.interfaceName == interfaceName)
+        return;
+
+    d->m_peerSettings.interfaceName = interfaceName;
+    d->applyPeerSettings();
+    emit peerSharingChanged();
+}
+
+/*!
+    \qmlproperty string OtaClient::peerSecret
+    \include qotaclient.cpp peer-secret
+*/
+
+/*!
+    \property QOtaClient::peerSecret
+//! [peer-secret]
+    Holds the secret that the devices which exchange objects share. A device serves
+    objects only to devices that know its secret, and fetches objects only from
+    them. The default value is an empty string, which disables peer sharing.
+
+    Neither the secret nor anything that grants access is sent over the network.
+    A discovery request carries a random value, and a peer answers with a fresh
+    challenge and a proof that it knows the secret. Each request for an object then
+    carries a proof that covers the challenge, the request and a counter, which is
+    accepted only once. A device that does not know the secret can neither fetch
+    objects nor pose as a peer, and captured requests can not be replayed. The
+    objects themselves are not encrypted, use peer sharing only in trusted networks.
+//! [peer-secret]
+    \sa peerSharingEnabled
+*/
+QString QOtaClient::peerSecret() const
+{
+    return d_func()->m_peerSettings.secret;
+}
+
+void QOtaClient::setPeerSecret(const QString &secret)
+{
+    Q_D(QOtaClient);
+    if (d->m_peerSettings.secret == secret)
+        return;
+
+    d->m_peerSettings.secret = secret;
+    d->applyPeerSettings();
+    emit peerSharingChanged();
+}
+
 QT_END_NAMESPACE
@@ -31,11 +31,14 @@
 
 #include <QtCore/QObject>
 #include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QVariant>
 
 QT_BEGIN_NAMESPACE
 
 class QOtaClientPrivate;
 class QOtaRepositoryConfig;
+class QOtaDeploymentModel;
 
 class Q_DECL_EXPORT QOtaClient : public QObject
 {
@@ -54,7 +57,47 @@ class Q_DECL_EXPORT QOtaClient : public QObject
     Q_PROPERTY(QString rollbackMetadata READ rollbackMetadata NOTIFY rollbackMetadataChanged)
     Q_PROPERTY(QString defaultRevision READ defaultRevision NOTIFY defaultMetadataChanged)
     Q_PROPERTY(QString defaultMetadata READ defaultMetadata NOTIFY defaultMetadataChanged)
+    Q_PROPERTY(QOtaDeploymentModel *deployments READ deployments CONSTANT)
+    Q_PROPERTY(int retainedDeployments READ retainedDeployments WRITE setRetainedDeployments NOTIFY retainedDeploymentsChanged)
+    Q_PROPERTY(int bootCountLimit READ bootCountLimit WRITE setBootCountLimit NOTIFY bootCountLimitChanged)
+    Q_PROPERTY(bool stagedDeployment READ stagedDeployment WRITE setStagedDeployment NOTIFY stagedDeploymentChanged)
+    Q_PROPERTY(QString stagedRevision READ stagedRevision NOTIFY stagedRevisionChanged)
+    Q_PROPERTY(SyncPolicy syncPolicy READ syncPolicy WRITE setSyncPolicy NOTIFY syncPolicyChanged)
+    Q_PROPERTY(qint64 repositoryDiskBudget READ repositoryDiskBudget WRITE setRepositoryDiskBudget NOTIFY repositoryDiskBudgetChanged)
+    Q_PROPERTY(int niceLevel READ niceLevel WRITE setNiceLevel NOTIFY priorityPolicyChanged)
+    Q_PROPERTY(IoPriorityClass ioPriorityClass READ ioPriorityClass WRITE setIoPriorityClass NOTIFY priorityPolicyChanged)
+    Q_PROPERTY(QString cgroupPath READ cgroupPath WRITE setCgroupPath NOTIFY priorityPolicyChanged)
+    Q_PROPERTY(bool latencyMeasurementEnabled READ latencyMeasurementEnabled WRITE setLatencyMeasurementEnabled NOTIFY latencyMeasurementEnabledChanged)
+    Q_PROPERTY(qint64 bandwidthLimit READ bandwidthLimit WRITE setBandwidthLimit NOTIFY bandwidthLimitChanged)
+    Q_PROPERTY(QStringList downloadWindows READ downloadWindows WRITE setDownloadWindows NOTIFY downloadWindowsChanged)
+    Q_PROPERTY(bool peerSharingEnabled READ peerSharingEnabled WRITE setPeerSharingEnabled NOTIFY peerSharingChanged)
+    Q_PROPERTY(int peerPort READ peerPort WRITE setPeerPort NOTIFY peerSharingChanged)
+    Q_PROPERTY(QStringList peers READ peers WRITE setPeers NOTIFY peerSharingChanged)
+    Q_PROPERTY(QString peerInterface READ peerInterface WRITE setPeerInterface NOTIFY peerSharingChanged)
+    Q_PROPERTY(QString peerSecret READ peerSecret WRITE setPeerSecret NOTIFY peerSharingChanged)
 public:
+    enum IoPriorityClass {
+        NormalIoPriority,
+        BestEffortIoPriority,
+        IdleIoPriority
+    };
+    Q_ENUM(IoPriorityClass)
+
+    enum SyncPolicy {
+        FullSync,
+        BatchedSync,
+        NoSync
+    };
+    Q_ENUM(SyncPolicy)
+
+    enum PackageError {
+        PackageReadError,
+        InvalidSuperblock,
+        IncompletePackage,
+        ChecksumMismatch
+    };
+    Q_ENUM(PackageError)
+
     static QOtaClient& instance();
     virtual ~QOtaClient();
 
@@ -68,13 +111,18 @@ public:
     Q_INVOKABLE bool fetchRemoteMetadata();
     Q_INVOKABLE bool update();
     Q_INVOKABLE bool rollback();
+    Q_INVOKABLE bool rollbackTo(const QString &revision);
     Q_INVOKABLE bool updateOffline(const QString &packagePath);
     Q_INVOKABLE bool updateRemoteMetadataOffline(const QString &packagePath);
+    Q_INVOKABLE bool updateFromRepository(const QString &repositoryPath);
     Q_INVOKABLE bool refreshMetadata();
+    Q_INVOKABLE bool measureDiskUsage();
+    Q_INVOKABLE bool markBootSuccessful();
     Q_INVOKABLE bool setRepositoryConfig(QOtaRepositoryConfig *config);
     Q_INVOKABLE bool removeRepositoryConfig();
     Q_INVOKABLE bool isRepositoryConfigSet(QOtaRepositoryConfig *config) const;
     Q_INVOKABLE QOtaRepositoryConfig *repositoryConfig() const;
+    Q_INVOKABLE QVariantList mirrorStatistics() const;
 
     QString bootedRevision() const;
     QString bootedMetadata() const;
@@ -84,6 +132,41 @@ public:
     QString rollbackMetadata() const;
     QString defaultRevision() const;
     QString defaultMetadata() const;
+    QOtaDeploymentModel *deployments() const;
+
+    qint64 repositoryDiskBudget() const;
+    void setRepositoryDiskBudget(qint64 budget);
+    int retainedDeployments() const;
+    void setRetainedDeployments(int count);
+    int bootCountLimit() const;
+    void setBootCountLimit(int limit);
+    bool stagedDeployment() const;
+    void setStagedDeployment(bool staged);
+    QString stagedRevision() const;
+    SyncPolicy syncPolicy() const;
+    void setSyncPolicy(SyncPolicy policy);
+    int niceLevel() const;
+    void setNiceLevel(int niceLevel);
+    IoPriorityClass ioPriorityClass() const;
+    void setIoPriorityClass(IoPriorityClass ioPriorityClass);
+    QString cgroupPath() const;
+    void setCgroupPath(const QString &cgroupPath);
+    bool latencyMeasurementEnabled() const;
+    void setLatencyMeasurementEnabled(bool enabled);
+    qint64 bandwidthLimit() const;
+    void setBandwidthLimit(qint64 bytesPerSecond);
+    QStringList downloadWindows() const;
+    void setDownloadWindows(const QStringList &windows);
+    bool peerSharingEnabled() const;
+    void setPeerSharingEnabled(bool enabled);
+    int peerPort() const;
+    void setPeerPort(int port);
+    QStringList peers() const;
+    void setPeers(const QStringList &peers);
+    QString peerInterface() const;
+    void setPeerInterface(const QString &interfaceName);
+    QString peerSecret() const;
+    void setPeerSecret(const QString &secret);
 
 Q_SIGNALS:
     void remoteMetadataChanged();
@@ -94,13 +177,29 @@ Q_SIGNALS:
     void restartRequiredChanged(bool required);
     void statusStringChanged(const QString &status);
     void errorOccurred(const QString &error);
+    void packageVerificationFailed(QOtaClient::PackageError error, const QStringList &parts);
+    void bootFallbackOccurred(const QString &failedRevision, const QString &bootedRevision);
     void repositoryConfigChanged(QOtaRepositoryConfig *config);
+    void repositoryDiskBudgetChanged();
+    void retainedDeploymentsChanged();
+    void bootCountLimitChanged();
+    void stagedDeploymentChanged();
+    void stagedRevisionChanged();
+    void syncPolicyChanged();
+    void priorityPolicyChanged();
+    void latencyMeasurementEnabledChanged();
+    void bandwidthLimitChanged();
+    void downloadWindowsChanged();
+    void peerSharingChanged();
 
     void fetchRemoteMetadataFinished(bool success);
     void updateFinished(bool success);
     void rollbackFinished(bool success);
     void updateOfflineFinished(bool success);
     void updateRemoteMetadataOfflineFinished(bool success);
+    void updateFromRepositoryFinished(bool success);
+    void measureDiskUsageFinished(bool success);
+    void markBootSuccessfulFinished(bool success);
 
 private:
     QOtaClient();
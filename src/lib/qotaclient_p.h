@@ -30,17 +30,40 @@
 #define QOTACLIENT_P_H
 
 #include <QtCore/QObject>
+#include <QtCore/QElapsedTimer>
 #include <QtCore/QLoggingCategory>
 #include <QtCore/QScopedPointer>
+#include <QtCore/QTimer>
+#include <QtCore/QVector>
+
+#include "qotafetchproxy_p.h"
+#include "qotapeerserver_p.h"
 
 QT_BEGIN_NAMESPACE
 
 Q_DECLARE_LOGGING_CATEGORY(qota)
+Q_DECLARE_LOGGING_CATEGORY(qotaLatency)
+
+extern const QString repoConfigPath;
+extern const QString repoPath;
+
+QString otaSysroot();
 
 class QThread;
 class QOtaClientAsync;
 class QOtaRepositoryConfig;
 class QOtaClient;
+class QOtaDeploymentModel;
+
+// The settings of QOtaClient that control how a system update is deployed,
+// see QOtaClient::stagedDeployment and QOtaClient::syncPolicy.
+struct QOtaDeployOptions
+{
+    QOtaDeployOptions() : staged(false), syncPolicy(0) {}
+
+    bool staged;
+    int syncPolicy; // QOtaClient::SyncPolicy, FullSync by default
+};
 
 class QOtaClientPrivate : public QObject
 {
@@ -54,10 +77,19 @@ public:
     void statusStringChanged(const QString &status);
     void errorOccurred(const QString &error);
     bool verifyPathExist(const QString &path);
+    QString packageFilePath(const QString &packagePath) const;
+    void applyPriorityPolicy();
+    void startLatencyMeasurement();
+    void probeLatency();
+    void reportLatency(const char *operation);
+    void applyFetchSettings();
+    void applyDeployOptions();
+    void applyPeerSettings();
     void setBootedMetadata(const QString &bootedRev, const QString &bootedMetadata);
     void rollbackMetadataChanged(const QString &rollbackRev, const QString &rollbackMetadata, int treeCount);
     void remoteMetadataChanged(const QString &remoteRev, const QString &remoteMetadata);
     void defaultRevisionChanged(const QString &defaultRevision, const QString &defaultMetadata);
+    void stagedRevisionChanged(const QString &stagedRevision);
 
     // members
     QOtaClient *const q_ptr;
@@ -78,6 +110,27 @@ public:
     QString m_rollbackMetadata;
     QString m_defaultRev;
     QString m_defaultMetadata;
+    QString m_stagedRev;
+    qint64 m_repositoryDiskBudget;
+    int m_retainedDeployments;
+    int m_bootCountLimit;
+    QOtaDeployOptions m_deployOptions;
+    int m_niceLevel;
+    int m_ioPriorityClass;
+    QString m_cgroupPath;
+
+    bool m_latencyMeasurementEnabled;
+    QTimer m_latencyProbe;
+    QElapsedTimer m_latencyClock;
+    QVector<qint64> m_latencySamples;
+
+    QOtaFetchSettings m_fetchSettings;
+    QStringList m_downloadWindows;
+    QTimer m_downloadWindowTimer;
+
+    QOtaPeerSettings m_peerSettings;
+
+    QOtaDeploymentModel *m_deploymentModel;
 };
 
 QT_END_NAMESPACE
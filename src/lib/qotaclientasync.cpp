@@ -30,9 +30,39 @@
 #include "glib-2.0/glib.h"
 
 #include "qotaclientasync_p.h"
+#include "qotabootcounter_p.h"
 #include "qotaclient_p.h"
+#include "qotafetchproxy_p.h"
+#include "qotapeerserver_p.h"
+#include "qotarepositoryconfig.h"
+#include "qotarepositoryconfig_p.h"
 
 #include <QtCore/QJsonDocument>
+#include <QtCore/QAtomicInt>
+#include <QtCore/QByteArrayList>
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDateTime>
+#include <QtCore/QDir>
+#include <QtCore/QDirIterator>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QHash>
+#include <QtCore/QStorageInfo>
+#include <QtCore/QProcessEnvironment>
+#include <QtCore/QStringList>
+#include <QtCore/QTemporaryDir>
+#include <QtCore/QUrl>
+#include <QtCore/QVector>
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <lzma.h>
+#include <sys/file.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 QT_BEGIN_NAMESPACE
 
@@ -50,7 +80,27 @@ QT_BEGIN_NAMESPACE
 #define glnx_unref_object __attribute__ ((cleanup(glnx_local_obj_unref)))
 GLNX_DEFINE_CLEANUP_FUNCTION0(GObject*, glnx_local_obj_unref, g_object_unref)
 
-QOtaClientAsync::QOtaClientAsync()
+// from linux/ioprio.h
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+
+const QString repoPath(otaSysroot() + QStringLiteral("/ostree/repo"));
+const int peerDiscoveryTimeout = 1000;
+const int defaultRetainedDeployments = 2;
+// Read by qota-finalize, relative to the sysroot.
+const QString stagedDeploymentPath(QStringLiteral("/ostree/staged-deployment"));
+// qota-finalize renames the staged deployment file to this when it fails.
+const QString failedStagedDeploymentPath(QStringLiteral("/ostree/staged-deployment.failed"));
+
+QOtaClientAsync::QOtaClientAsync() :
+    m_repositoryDiskBudget(0),
+    m_retainedDeployments(defaultRetainedDeployments),
+    m_bootCountLimit(defaultBootCountLimit),
+    m_fetchProxy(new QOtaFetchProxy()),
+    m_peerProxy(new QOtaFetchProxy()),
+    m_peerServer(new QOtaPeerServer())
 {
     // async mapper
     connect(this, &QOtaClientAsync::fetchRemoteMetadata, this, &QOtaClientAsync::_fetchRemoteMetadata);
@@ -58,6 +108,14 @@ QOtaClientAsync::QOtaClientAsync()
     connect(this, &QOtaClientAsync::rollback, this, &QOtaClientAsync::_rollback);
     connect(this, &QOtaClientAsync::updateOffline, this, &QOtaClientAsync::_updateOffline);
     connect(this, &QOtaClientAsync::updateRemoteMetadataOffline, this, &QOtaClientAsync::_updateRemoteMetadataOffline);
+    connect(this, &QOtaClientAsync::updateFromRepository, this, &QOtaClientAsync::_updateFromRepository);
+    connect(this, &QOtaClientAsync::loadMetadata, this, &QOtaClientAsync::_loadMetadata);
+    connect(this, &QOtaClientAsync::measureDiskUsage, this, &QOtaClientAsync::_measureDiskUsage);
+    connect(this, &QOtaClientAsync::markBootSuccessful, this, &QOtaClientAsync::_markBootSuccessful);
+    connect(this, &QOtaClientAsync::checkBootState, this, &QOtaClientAsync::_checkBootState);
+    connect(this, &QOtaClientAsync::setPriorityPolicy, this, &QOtaClientAsync::_setPriorityPolicy);
+    connect(this, &QOtaClientAsync::setFetchSettings, this, &QOtaClientAsync::_setFetchSettings);
+    connect(m_peerServer.data(), &QOtaPeerServer::started, this, &QOtaClientAsync::peerServerStarted);
 }
 
 QOtaClientAsync::~QOtaClientAsync()
@@ -71,11 +129,54 @@ static void parseErrorString(QString *error)
         *error = QLatin1String("Repository configuration not found");
 }
 
-QString QOtaClientAsync::ostree(const QString &command, bool *ok, bool updateStatus)
+// Moves the child process into a cgroup (if set), before the child executes the
+// command. The nice level and the I/O priority are inherited from the worker thread.
+class OstreeProcess : public QProcess
+{
+public:
+    OstreeProcess(const QByteArray &cgroupProcs) : m_cgroupProcs(cgroupProcs) {}
+
+protected:
+    void setupChildProcess() Q_DECL_OVERRIDE
+    {
+        if (m_cgroupProcs.isEmpty())
+            return;
+        // Only async-signal-safe calls are allowed here. Writing "0" to
+        // cgroup.procs moves the writing process. On failure the command
+        // still runs, in the cgroup of the parent.
+        int fd = ::open(m_cgroupProcs.constData(), O_WRONLY | O_CLOEXEC);
+        if (fd != -1) {
+            ssize_t written = ::write(fd, "0", 1);
+            Q_UNUSED(written);
+            ::close(fd);
+        }
+    }
+
+private:
+    QByteArray m_cgroupProcs;
+};
+
+QString QOtaClientAsync::ostree(const QString &command, bool *ok, bool updateStatus, bool reportErrors)
 {
     qCDebug(qota) << command;
-    QProcess ostree;
+    // Also called from the thread of QOtaClient (see QOtaClient::refreshMetadata()),
+    // while the worker thread changes the settings of the processes.
+    QMutexLocker locker(&m_settingsMutex);
+    const QByteArray cgroupProcs = m_cgroupProcs;
+    const QString httpProxy = m_httpProxy;
+    locker.unlock();
+
+    OstreeProcess ostree(cgroupProcs);
     ostree.setProcessChannelMode(QProcess::MergedChannels);
+    if (!httpProxy.isEmpty() || !otaSysroot().isEmpty()) {
+        QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
+        if (!httpProxy.isEmpty())
+            env.insert(QStringLiteral("http_proxy"), httpProxy);
+        // The ostree tools use the repository of the overridden sysroot as well.
+        if (!otaSysroot().isEmpty())
+            env.insert(QStringLiteral("OSTREE_REPO"), repoPath);
+        ostree.setProcessEnvironment(env);
+    }
     ostree.start(command);
     if (!ostree.waitForStarted()) {
         *ok = false;
@@ -104,7 +205,8 @@ QString QOtaClientAsync::ostree(const QString &command, bool *ok, bool updateSta
             if (line.startsWith(QStringLiteral("error:"))) {
                 *ok = false;
                 parseErrorString(&line);
-                emit errorOccurred(line);
+                if (reportErrors)
+                    emit errorOccurred(line);
             } else {
                 if (updateStatus)
                     emit statusStringChanged(line);
@@ -116,19 +218,145 @@ QString QOtaClientAsync::ostree(const QString &command, bool *ok, bool updateSta
     return out;
 }
 
+void QOtaClientAsync::setRepositoryDiskBudget(qint64 budget)
+{
+    QMutexLocker locker(&m_settingsMutex);
+    m_repositoryDiskBudget = budget;
+}
+
+void QOtaClientAsync::setRetainedDeployments(int count)
+{
+    QMutexLocker locker(&m_settingsMutex);
+    m_retainedDeployments = count;
+}
+
+void QOtaClientAsync::setBootCountLimit(int limit)
+{
+    QMutexLocker locker(&m_settingsMutex);
+    m_bootCountLimit = limit;
+}
+
+void QOtaClientAsync::setDeployOptions(const QOtaDeployOptions &options)
+{
+    QMutexLocker locker(&m_settingsMutex);
+    m_deployOptions = options;
+}
+
+// The peer server starts on its own thread, the result is reported by peerServerStarted().
+void QOtaClientAsync::setPeerSettings(const QOtaPeerSettings &settings)
+{
+    QMutexLocker locker(&m_settingsMutex);
+    m_peerSettings = settings;
+    locker.unlock();
+
+    if (settings.enabled && settings.secret.isEmpty())
+        qCWarning(qota) << "Peer sharing is disabled until a peer secret is set.";
+    if (!settings.enabled || settings.secret.isEmpty() || settings.interfaceName.isEmpty())
+        m_peerServer->stop();
+    else
+        m_peerServer->start(settings);
+}
+
+void QOtaClientAsync::peerServerStarted(bool success, const QString &interfaceName, quint16 port)
+{
+    if (success) {
+        emit statusStringChanged(QString(QStringLiteral("Sharing the repository on %1 port %2"))
+                                 .arg(interfaceName).arg(port));
+    } else {
+        emit errorOccurred(QString(QStringLiteral("Failed to share the repository on %1 port %2"))
+                           .arg(interfaceName).arg(port));
+    }
+}
+
+// On Linux the nice level, the I/O priority and (for threaded cgroups) the cgroup
+// are per-thread attributes, applied to the calling thread.
+static QString applyThreadPriorityPolicy(const QOtaPriorityPolicy &policy)
+{
+    pid_t tid = syscall(SYS_gettid);
+    if (setpriority(PRIO_PROCESS, tid, policy.niceLevel) == -1)
+        return QStringLiteral("Failed to set the nice level: ") + qt_error_string(errno);
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, policy.ioPriority) == -1)
+        return QStringLiteral("Failed to set the I/O priority: ") + qt_error_string(errno);
+    if (!policy.cgroupThreads.isEmpty()) {
+        int fd = ::open(policy.cgroupThreads.constData(), O_WRONLY | O_CLOEXEC);
+        QByteArray id = QByteArray::number(tid);
+        bool ok = fd != -1 && ::write(fd, id.constData(), id.size()) == id.size();
+        if (fd != -1)
+            ::close(fd);
+        if (!ok)
+            return QString(QStringLiteral("Failed to move a thread to %1: ")).arg(QFile::decodeName(policy.cgroupThreads))
+                   + qt_error_string(errno);
+    }
+    return QString();
+}
+
+void QOtaClientAsync::_setPriorityPolicy(int niceLevel, int ioPriorityClass, const QString &cgroupPath)
+{
+    m_priorityPolicy.niceLevel = niceLevel;
+    m_priorityPolicy.ioPriority = 0; // no class, the I/O priority is derived from the nice level
+    if (ioPriorityClass == QOtaClient::BestEffortIoPriority)
+        m_priorityPolicy.ioPriority = IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT | 7;
+    else if (ioPriorityClass == QOtaClient::IdleIoPriority)
+        m_priorityPolicy.ioPriority = IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT;
+    m_priorityPolicy.generation++;
+
+    // Processes started from the worker thread inherit its nice level and I/O priority,
+    // and move themselves into the cgroup, see OstreeProcess. The worker thread itself
+    // stays in the cgroup of the application.
+    QByteArray cgroupProcs;
+    m_priorityPolicy.cgroupThreads.clear();
+    if (!cgroupPath.isEmpty()) {
+        QString procs = cgroupPath + QLatin1String("/cgroup.procs");
+        if (QFileInfo(procs).isWritable())
+            cgroupProcs = QFile::encodeName(procs);
+        else
+            emit errorOccurred(procs + QLatin1String(" is not writable"));
+        // Threads of the verification pool can be moved individually, when the cgroup
+        // is threaded (cgroup v2) or with the tasks file (cgroup v1).
+        const QStringList threadFiles = { QStringLiteral("/cgroup.threads"), QStringLiteral("/tasks") };
+        for (const QString &file : threadFiles) {
+            if (QFileInfo(cgroupPath + file).isWritable()) {
+                m_priorityPolicy.cgroupThreads = QFile::encodeName(cgroupPath + file);
+                break;
+            }
+        }
+    }
+    QMutexLocker locker(&m_settingsMutex);
+    m_cgroupProcs = cgroupProcs;
+    locker.unlock();
+
+    QOtaPriorityPolicy workerPolicy = m_priorityPolicy;
+    workerPolicy.cgroupThreads.clear();
+    QString error = applyThreadPriorityPolicy(workerPolicy);
+    if (!error.isEmpty())
+        emit errorOccurred(error);
+}
+
+void QOtaClientAsync::_setFetchSettings(const QOtaFetchSettings &settings)
+{
+    m_fetchProxy->setSettings(settings);
+}
+
 OstreeSysroot* QOtaClientAsync::defaultSysroot()
 {
     GError *error = nullptr;
-    OstreeSysroot *sysroot = ostree_sysroot_new_default();
+    OstreeSysroot *sysroot = nullptr;
+    QString path = otaSysroot();
+    if (path.isEmpty()) {
+        sysroot = ostree_sysroot_new_default();
+    } else {
+        glnx_unref_object GFile *file = g_file_new_for_path (QFile::encodeName(path).constData());
+        sysroot = ostree_sysroot_new (file);
+    }
     if (!ostree_sysroot_load (sysroot, 0, &error))
         emitGError(error);
     return sysroot;
 }
 
-QString QOtaClientAsync::metadataFromRev(const QString &rev, bool *ok)
+QString QOtaClientAsync::metadataFromRev(const QString &rev, bool *ok, bool reportErrors)
 {
     QString jsonData;
-    jsonData = ostree(QString(QStringLiteral("ostree cat %1 /usr/etc/qt-ota.json")).arg(rev), ok);
+    jsonData = ostree(QString(QStringLiteral("ostree cat %1 /usr/etc/qt-ota.json")).arg(rev), ok, false, reportErrors);
     if (jsonData.isEmpty())
         return jsonData;
 
@@ -138,7 +366,10 @@ QString QOtaClientAsync::metadataFromRev(const QString &rev, bool *ok)
         *ok = false;
         QString error = QString(QStringLiteral("failed to parse JSON file, error: %1, data: %2"))
                                 .arg(parseError.errorString()).arg(jsonData);
-        emit errorOccurred(error);
+        if (reportErrors)
+            emit errorOccurred(error);
+        else
+            qCWarning(qota) << error;
     }
 
     QByteArray ba = jsonMetadata.toJson();
@@ -179,129 +410,460 @@ void QOtaClientAsync::_fetchRemoteMetadata()
 {
     QString remoteRev;
     QString remoteMetadata;
-    bool ok = true;
-    ostree(QStringLiteral("ostree pull --commit-metadata-only --disable-static-deltas qt-os linux/qt"), &ok);
+    // Metadata is small, it is fetched outside of the download windows as well.
+    bool ok = startFetchProxy(false);
+    if (ok) ostree(QStringLiteral("ostree pull --commit-metadata-only --disable-static-deltas qt-os linux/qt"), &ok);
     if (ok) remoteRev = ostree(QStringLiteral("ostree rev-parse linux/qt"), &ok);
     if (ok) ostree(QString(QStringLiteral("ostree pull --subpath=/usr/etc/qt-ota.json qt-os %1")).arg(remoteRev), &ok);
+    stopFetchProxy(false);
     if (ok) remoteMetadata = metadataFromRev(remoteRev, &ok);
     if (ok) emit remoteMetadataChanged(remoteRev, remoteMetadata);
     emit fetchRemoteMetadataFinished(ok);
 }
 
+void QOtaClientAsync::_loadMetadata(const QString &rev)
+{
+    // Errors are not reported, the commit of an old deployment may be incomplete.
+    bool ok = true;
+    QString metadata = metadataFromRev(rev, &ok, false);
+    emit metadataLoaded(rev, metadata, ok);
+}
+
+// The booted system is always kept, pinned deployments are kept as well but count
+// towards the limit. The remaining slots go to the most recent deployments.
+static QVector<bool> retainedDeploymentMask(GPtrArray *deployments, OstreeDeployment *bootedDeployment,
+                                            int retained)
+{
+    QVector<bool> keep(deployments->len, false);
+    int kept = 0;
+    for (uint i = 0; i < deployments->len; i++) {
+        OstreeDeployment *deployment = (OstreeDeployment*)deployments->pdata[i];
+        GKeyFile *origin = ostree_deployment_get_origin (deployment);
+        bool pinned = origin && g_key_file_get_boolean (origin, "libostree-transient", "pinned", nullptr);
+        if (pinned || (bootedDeployment && ostree_deployment_equal (deployment, bootedDeployment))) {
+            keep[i] = true;
+            kept++;
+        }
+    }
+    for (uint i = 0; i < deployments->len && kept < retained; i++) {
+        if (!keep[i]) {
+            keep[i] = true;
+            kept++;
+        }
+    }
+    return keep;
+}
+
+static QByteArray deploymentId(OstreeDeployment *deployment)
+{
+    return QByteArray(ostree_deployment_get_csum (deployment)) + '.' +
+           QByteArray::number(ostree_deployment_get_deployserial (deployment));
+}
+
+// Parses /usr/lib/ostree-boot/kargs, which qt-ostree writes as 'ostree admin deploy'
+// options (--karg=root=LABEL=rootfs ...). The contents are split like the kernel
+// splits its command line, at white space except within double quotes, so that
+// an argument such as --karg=foo="a b" stays intact.
+static QByteArrayList parseKernelArgs(const QByteArray &data)
+{
+    QByteArrayList tokens;
+    QByteArray token;
+    bool quoted = false;
+    for (char c : data) {
+        if (c == '"')
+            quoted = !quoted;
+        if (!quoted && isspace(c)) {
+            if (!token.isEmpty())
+                tokens.append(token);
+            token.clear();
+        } else {
+            token.append(c);
+        }
+    }
+    if (!token.isEmpty())
+        tokens.append(token);
+
+    QByteArrayList args;
+    for (const QByteArray &option : qAsConst(tokens)) {
+        if (option.startsWith("--karg="))
+            args.append(option.mid(int(sizeof("--karg=")) - 1));
+        else if (!option.startsWith("--"))
+            args.append(option);
+    }
+    return args;
+}
+
+// Reads the kernel arguments that are shipped in the commit, a commit without
+// the kargs file has none.
+static bool kernelArgsFromCommit(GFile *root, QByteArrayList *kernelArgs, GError **error)
+{
+    g_autoptr(GFile) kargsInRev = g_file_resolve_relative_path (root, "usr/lib/ostree-boot/kargs");
+    g_autofree char *contents = nullptr;
+    gsize length = 0;
+    if (!g_file_load_contents (kargsInRev, nullptr, &contents, &length, nullptr, error)) {
+        if (!g_error_matches (*error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+            return false;
+        g_clear_error (error);
+    }
+    *kernelArgs = parseKernelArgs(QByteArray(contents, length));
+    return true;
+}
+
+// Sets the fsync mode of the repository for the lifetime of the object. The
+// repository object is shared with the sysroot, so the mode must not outlive the
+// deployment. The restored mode is the one ostree_repo_open() derives from core.fsync.
+class RepoFsyncGuard
+{
+public:
+    RepoFsyncGuard(OstreeRepo *repo, bool disableFsync) : m_repo(repo)
+    {
+        gboolean fsync = TRUE;
+        GError *error = nullptr;
+        GKeyFile *config = ostree_repo_get_config (repo);
+        if (config && g_key_file_has_key (config, "core", "fsync", nullptr)) {
+            fsync = g_key_file_get_boolean (config, "core", "fsync", &error);
+            if (error) {
+                fsync = TRUE;
+                g_error_free (error);
+            }
+        }
+        m_previous = !fsync;
+        ostree_repo_set_disable_fsync (m_repo, disableFsync);
+    }
+    ~RepoFsyncGuard()
+    {
+        ostree_repo_set_disable_fsync (m_repo, m_previous);
+    }
+
+private:
+    OstreeRepo *m_repo;
+    gboolean m_previous;
+};
+
 bool QOtaClientAsync::deployCommit(const QString &commit, OstreeSysroot *sysroot)
 {
     bool ok = true;
-    QString kernelArgs;
+    QByteArrayList kernelArgs;
     GError *error = nullptr;
     g_autoptr(GFile) root = nullptr;
-    OstreeRepo *repo = nullptr;
+    glnx_unref_object OstreeRepo *repo = nullptr;
 
-    // read kernel args for rev
     if (!ostree_sysroot_get_repo (sysroot, &repo, 0, &error) ||
-        !ostree_repo_read_commit (repo, commit.toLatin1().constData(), &root, nullptr, nullptr, &error)) {
+        !ostree_repo_read_commit (repo, commit.toLatin1().constData(), &root, nullptr, nullptr, &error) ||
+        !kernelArgsFromCommit(root, &kernelArgs, &error)) {
         emitGError(error);
         return false;
     }
-    g_autoptr(GFile) kargsInRev = g_file_resolve_relative_path (root, "/usr/lib/ostree-boot/kargs");
-    g_autoptr(GInputStream) in = (GInputStream*)g_file_read (kargsInRev, 0, 0);
-    if (in)
-        kernelArgs = ostree(QString(QStringLiteral("ostree cat %1 /usr/lib/ostree-boot/kargs")).arg(commit), &ok);
+
+    QMutexLocker locker(&m_settingsMutex);
+    QOtaDeployOptions options = m_deployOptions;
+    locker.unlock();
+    int syncPolicy = options.syncPolicy;
+
+    // The checkout of the deployment honors the fsync setting of the repository.
+    RepoFsyncGuard fsyncGuard(repo, syncPolicy != QOtaClient::FullSync);
+    if (options.staged)
+        return stageCommit(commit, kernelArgs, syncPolicy, sysroot);
 
     emit statusStringChanged(QStringLiteral("Deploying..."));
-    if (ok) ostree(QString(QStringLiteral("ostree admin deploy --karg-none %1 %2"))
-                   .arg(kernelArgs).arg(commit), &ok, true);
-    return ok;
+    QElapsedTimer timer;
+    timer.start();
+    discardStagedDeployment(sysroot);
+    if (!ostree_sysroot_lock (sysroot, &error)) {
+        emitGError(error);
+        return false;
+    }
+
+    QMutexLocker settingsLocker(&m_settingsMutex);
+    int retained = m_retainedDeployments;
+    settingsLocker.unlock();
+
+    // The new deployment becomes the default system and takes one of the retained
+    // slots, the surplus deployments are removed by the same boot loader update.
+    glnx_unref_object OstreeDeployment *newDeployment = deployTree(commit, kernelArgs, sysroot, &error);
+    ok = newDeployment && syncDeployments(sysroot, syncPolicy);
+    if (ok) {
+        g_autoptr(GPtrArray) deployments = ostree_sysroot_get_deployments (sysroot);
+        OstreeDeployment *bootedDeployment = (OstreeDeployment*)ostree_sysroot_get_booted_deployment (sysroot);
+        QVector<bool> keep = retainedDeploymentMask(deployments, bootedDeployment, retained - 1);
+        g_autoptr(GPtrArray) newDeployments = g_ptr_array_new_with_free_func (g_object_unref);
+        g_ptr_array_add (newDeployments, g_object_ref (newDeployment));
+        for (uint i = 0; i < deployments->len; i++) {
+            if (keep[i])
+                g_ptr_array_add (newDeployments, g_object_ref (deployments->pdata[i]));
+        }
+        ok = ostree_sysroot_write_deployments (sysroot, newDeployments, 0, &error);
+    }
+    ostree_sysroot_unlock (sysroot);
+    if (!ok) {
+        emitGError(error);
+        return false;
+    }
+
+    qCDebug(qota) << "deployed" << commit << "in" << timer.elapsed() << "ms with sync policy" << syncPolicy;
+    armBootCounter(sysroot);
+    return true;
 }
 
-void QOtaClientAsync::_update(const QString &updateToRev)
+// Checks out the commit and merges /etc, like 'ostree admin deploy --karg-none':
+// the deployment is based on the booted system and its kernel arguments are the
+// ones shipped in the commit. The caller holds the sysroot lock.
+OstreeDeployment *QOtaClientAsync::deployTree(const QString &commit, const QByteArrayList &kernelArgs,
+                                              OstreeSysroot *sysroot, GError **error)
 {
-    glnx_unref_object OstreeSysroot *sysroot = defaultSysroot();
-    if (!sysroot) {
-        emit updateFinished(false);
-        return;
+    if (!ostree_sysroot_load (sysroot, 0, error))
+        return nullptr;
+    g_autoptr(GPtrArray) deployments = ostree_sysroot_get_deployments (sysroot);
+    if (deployments->len == 0) {
+        g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "No deployments found");
+        return nullptr;
     }
 
-    bool ok = true;
-    emit statusStringChanged(QStringLiteral("Checking for missing objects..."));
-    ostree(QString(QStringLiteral("ostree pull qt-os:%1")).arg(updateToRev), &ok, true);
-    if (!ok || !deployCommit(updateToRev, sysroot)) {
-        emit updateFinished(false);
-        return;
-    }
+    OstreeDeployment *bootedDeployment = (OstreeDeployment*)ostree_sysroot_get_booted_deployment (sysroot);
+    OstreeDeployment *current = bootedDeployment ? bootedDeployment : (OstreeDeployment*)deployments->pdata[0];
+    const char *osname = ostree_deployment_get_osname (current);
+    glnx_unref_object OstreeDeployment *mergeDeployment = ostree_sysroot_get_merge_deployment (sysroot, osname);
+    g_autoptr(GKeyFile) origin = ostree_sysroot_origin_new_from_refspec (sysroot, commit.toLatin1().constData());
+    QVector<const char*> argv;
+    for (const QByteArray &arg : kernelArgs)
+        argv.append(arg.constData());
+    argv.append(nullptr);
 
-    ok = handleRevisionChanges(sysroot, true);
-    emit updateFinished(ok);
+    OstreeDeployment *newDeployment = nullptr;
+    if (!ostree_sysroot_deploy_tree (sysroot, osname, commit.toLatin1().constData(), origin, mergeDeployment,
+                                     (char**)argv.data(), &newDeployment, nullptr, error))
+        return nullptr;
+    return newDeployment;
 }
 
-int QOtaClientAsync::rollbackIndex(OstreeSysroot *sysroot)
+// With the batched policy the checkout, which was written without fsync(), is
+// flushed by one syncfs() of the deployment file system. With no sync policy
+// nothing is flushed here, ostree_sysroot_write_deployments() syncs the file
+// systems before it swaps the boot loader configuration.
+bool QOtaClientAsync::syncDeployments(OstreeSysroot *sysroot, int syncPolicy)
 {
-    g_autoptr(GPtrArray) deployments = ostree_sysroot_get_deployments (sysroot);
-    if (deployments->len < 2)
-        return -1;
+    if (syncPolicy != QOtaClient::BatchedSync)
+        return true;
 
-    // 1) if we're not in the default boot index (0), it plans to prepend the
-    //    booted index (1, since we can't have more than two trees) so that it
-    //    becomes index 0 (default) and the current default becomes index 1.
-    // 2) if we're booted into the default boot index (0), let's roll back to the previous (1)
-    return 1;
+    QElapsedTimer timer;
+    timer.start();
+    QByteArray path = QFile::encodeName(sysrootPath(sysroot) + QStringLiteral("/ostree/deploy"));
+    int fd = open(path.constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1 || syncfs(fd) == -1) {
+        emit errorOccurred(QString(QStringLiteral("Failed to sync %1: %2"))
+                           .arg(QFile::decodeName(path)).arg(qt_error_string(errno)));
+        if (fd != -1)
+            close(fd);
+        return false;
+    }
+    close(fd);
+    qCDebug(qota) << "synced the deployment in" << timer.elapsed() << "ms";
+    return true;
 }
 
-bool QOtaClientAsync::handleRevisionChanges(OstreeSysroot *sysroot, bool reloadSysroot)
+QString QOtaClientAsync::stagedRevision(OstreeSysroot *sysroot)
 {
-    if (reloadSysroot) {
-        GError *error = nullptr;
-        if (!ostree_sysroot_load (sysroot, 0, &error)) {
-            emitGError(error);
-            return false;
-        }
+    g_autoptr(GKeyFile) staged = g_key_file_new ();
+    QByteArray path = QFile::encodeName(sysrootPath(sysroot) + stagedDeploymentPath);
+    if (!g_key_file_load_from_file (staged, path.constData(), G_KEY_FILE_NONE, nullptr))
+        return QString();
+    g_autofree char *csum = g_key_file_get_string (staged, "staged", "csum", nullptr);
+    return QLatin1String(csum);
+}
+
+void QOtaClientAsync::discardStagedDeployment(OstreeSysroot *sysroot)
+{
+    // The deployment directory is removed by the next ostree_sysroot_cleanup().
+    if (QFile::remove(sysrootPath(sysroot) + stagedDeploymentPath))
+        emit stagedRevisionChanged(QString());
+}
+
+// Does the expensive part of a deployment, the checkout of the commit and the /etc
+// merge, while the system is running, and records the result in the staged
+// deployment file. The boot loader configuration is left untouched, qota-finalize
+// writes it at shutdown, see qota-finalize.service.
+bool QOtaClientAsync::stageCommit(const QString &commit, const QByteArrayList &kernelArgs, int syncPolicy,
+                                  OstreeSysroot *sysroot)
+{
+    if (stagedRevision(sysroot) == commit)
+        return true;
+
+    QMutexLocker locker(&m_settingsMutex);
+    int retained = m_retainedDeployments;
+    int bootCountLimit = m_bootCountLimit;
+    locker.unlock();
+
+    emit statusStringChanged(QStringLiteral("Staging..."));
+    QElapsedTimer timer;
+    timer.start();
+    GError *error = nullptr;
+    if (!ostree_sysroot_lock (sysroot, &error)) {
+        emitGError(error);
+        return false;
+    }
+    qint64 lockWait = timer.elapsed();
+    glnx_unref_object OstreeDeployment *newDeployment = deployTree(commit, kernelArgs, sysroot, &error);
+    ostree_sysroot_unlock (sysroot);
+    qint64 locked = timer.elapsed() - lockWait;
+    if (!newDeployment) {
+        emitGError(error);
+        return false;
     }
+    // Without the boot loader update nothing else syncs the staged deployment.
+    if (!syncDeployments(sysroot, syncPolicy == QOtaClient::FullSync ? QOtaClient::FullSync : QOtaClient::BatchedSync))
+        return false;
 
+    // The new deployment takes one of the retained slots.
     g_autoptr(GPtrArray) deployments = ostree_sysroot_get_deployments (sysroot);
-    OstreeDeployment *firstDeployment = (OstreeDeployment*)deployments->pdata[0];
-    bool ok = true;
-    QString defaultRev(QLatin1String(ostree_deployment_get_csum (firstDeployment)));
-    QString defaultMetadata = metadataFromRev(defaultRev, &ok);
-    if (!ok)
-        return false;
-    emit defaultRevisionChanged(defaultRev, defaultMetadata);
+    OstreeDeployment *bootedDeployment = (OstreeDeployment*)ostree_sysroot_get_booted_deployment (sysroot);
+    QVector<bool> keep = retainedDeploymentMask(deployments, bootedDeployment, retained - 1);
+    QByteArrayList retainIds;
+    for (uint i = 0; i < deployments->len; i++) {
+        if (keep[i])
+            retainIds.append(deploymentId((OstreeDeployment*)deployments->pdata[i]));
+    }
+    QVector<const char*> retainList;
+    for (const QByteArray &id : qAsConst(retainIds))
+        retainList.append(id.constData());
 
-    int index = rollbackIndex(sysroot);
-    if (index != -1) {
-        OstreeDeployment *rollbackDeployment = (OstreeDeployment*)deployments->pdata[index];
-        QString rollbackRev(QLatin1String(ostree_deployment_get_csum (rollbackDeployment)));
-        QString rollbackMetadata = metadataFromRev(rollbackRev, &ok);
-        if (!ok)
-            return false;
-        emit rollbackMetadataChanged(rollbackRev, rollbackMetadata, deployments->len);
+    OstreeBootconfigParser *bootconfig = ostree_deployment_get_bootconfig (newDeployment);
+    g_autoptr(GKeyFile) staged = g_key_file_new ();
+    g_key_file_set_string (staged, "staged", "osname", ostree_deployment_get_osname (newDeployment));
+    g_key_file_set_string (staged, "staged", "csum", ostree_deployment_get_csum (newDeployment));
+    g_key_file_set_integer (staged, "staged", "deployserial", ostree_deployment_get_deployserial (newDeployment));
+    g_key_file_set_string (staged, "staged", "bootcsum", ostree_deployment_get_bootcsum (newDeployment));
+    g_key_file_set_string (staged, "staged", "options", ostree_bootconfig_parser_get (bootconfig, "options"));
+    g_key_file_set_string_list (staged, "staged", "retain", retainList.constData(), retainList.size());
+    g_key_file_set_integer (staged, "staged", "boot-count-limit", bootCountLimit);
+    QByteArray path = QFile::encodeName(sysrootPath(sysroot) + stagedDeploymentPath);
+    if (!g_key_file_save_to_file (staged, path.constData(), &error)) {
+        emitGError(error);
+        return false;
     }
 
+    qCDebug(qota) << "staged" << commit << "in" << timer.elapsed() << "ms, the sysroot was locked for"
+                  << locked << "ms";
+    emit stagedRevisionChanged(commit);
+    emit statusStringChanged(QStringLiteral("Staged, the update is finalized on the next restart"));
     return true;
 }
 
-void QOtaClientAsync::emitGError(GError *error)
+QString QOtaClientAsync::sysrootPath(OstreeSysroot *sysroot)
 {
-    if (!error)
+    g_autofree char *path = g_file_get_path (ostree_sysroot_get_path (sysroot));
+    return QFile::decodeName(path);
+}
+
+void QOtaClientAsync::armBootCounter(OstreeSysroot *sysroot)
+{
+    QMutexLocker locker(&m_settingsMutex);
+    int limit = m_bootCountLimit;
+    locker.unlock();
+    if (limit == 0)
         return;
 
-    emit errorOccurred(QString::fromLatin1((error->message)));
-    g_error_free (error);
+    GError *error = nullptr;
+    if (!ostree_sysroot_load (sysroot, 0, &error)) {
+        emitGError(error);
+        return;
+    }
+    g_autoptr(GPtrArray) deployments = ostree_sysroot_get_deployments (sysroot);
+    if (deployments->len < 2)
+        return;
+
+    // The boot loader falls back to the second entry, which is the previous default system.
+    OstreeBootconfigParser *config = ostree_deployment_get_bootconfig ((OstreeDeployment*)deployments->pdata[1]);
+    QOtaBootEntry fallback;
+    fallback.kernel = QLatin1String(ostree_bootconfig_parser_get (config, "linux"));
+    fallback.initrd = QLatin1String(ostree_bootconfig_parser_get (config, "initrd"));
+    fallback.options = QLatin1String(ostree_bootconfig_parser_get (config, "options"));
+
+    QString bootCounterError;
+    QOtaBootCounter bootCounter(sysrootPath(sysroot));
+    if (!bootCounter.arm(limit, fallback, &bootCounterError))
+        emit errorOccurred(QString(QStringLiteral("Failed to enable boot counting: %1")).arg(bootCounterError));
 }
 
-void QOtaClientAsync::_rollback()
+void QOtaClientAsync::_markBootSuccessful()
 {
     glnx_unref_object OstreeSysroot *sysroot = defaultSysroot();
     if (!sysroot) {
-        emit rollbackFinished(false);
+        emit markBootSuccessfulFinished(false);
         return;
     }
 
-    int index = rollbackIndex(sysroot);
-    if (index == -1) {
-        emit errorOccurred(QStringLiteral("At least 2 system versions required for rollback"));
-        emit rollbackFinished(false);
+    QString error;
+    QOtaBootCounter bootCounter(sysrootPath(sysroot));
+    bool ok = bootCounter.disarm(&error);
+    if (!ok)
+        emit errorOccurred(error);
+    emit markBootSuccessfulFinished(ok);
+}
+
+void QOtaClientAsync::_checkBootState()
+{
+    glnx_unref_object OstreeSysroot *sysroot = defaultSysroot();
+    if (!sysroot)
+        return;
+
+    // The update was staged, but qota-finalize could not write the boot loader
+    // configuration at the last shutdown, so the old system is still the default.
+    QString failedPath = sysrootPath(sysroot) + failedStagedDeploymentPath;
+    g_autoptr(GKeyFile) failed = g_key_file_new ();
+    if (g_key_file_load_from_file (failed, QFile::encodeName(failedPath).constData(), G_KEY_FILE_NONE, nullptr)) {
+        g_autofree char *csum = g_key_file_get_string (failed, "staged", "csum", nullptr);
+        QString message = QString(QStringLiteral("Failed to finalize the staged update to %1 at shutdown, "
+                                                 "see the log of qota-finalize.service"))
+                          .arg(QLatin1String(csum));
+        emit errorOccurred(message);
+        emit statusStringChanged(message);
+        QFile::remove(failedPath);
+    }
+
+    // A fallback boots another deployment than the default one. GRUB leaves
+    // ota_boot_counter at 0 also for the last boot attempt of the new system,
+    // which must keep the counting armed, so that a failure still falls back.
+    OstreeDeployment *bootedDeployment = (OstreeDeployment*)ostree_sysroot_get_booted_deployment (sysroot);
+    g_autoptr(GPtrArray) deployments = ostree_sysroot_get_deployments (sysroot);
+    if (!bootedDeployment || deployments->len < 2 ||
+        ostree_deployment_equal (deployments->pdata[0], bootedDeployment))
+        return;
+
+    QString error;
+    QOtaBootCounter bootCounter(sysrootPath(sysroot));
+    if (!bootCounter.hasFallenBack(&error)) {
+        if (!error.isEmpty())
+            emit errorOccurred(error);
+        return;
+    }
+
+    // The boot loader booted the previous system, make it the default system as
+    // well, otherwise the next boot would try the failing system again.
+    QString failedRev = QLatin1String(ostree_deployment_get_csum ((OstreeDeployment*)deployments->pdata[0]));
+    QString bootedRev = QLatin1String(ostree_deployment_get_csum (bootedDeployment));
+    if (!bootCounter.disarm(&error)) {
+        emit errorOccurred(error);
         return;
     }
+    int index = rollbackIndex(sysroot, bootedRev);
+    if (index <= 0)
+        return;
 
+    emit errorOccurred(QString(QStringLiteral("The new system %1 failed to boot, falling back to %2"))
+                       .arg(failedRev, bootedRev));
+    if (!makeDefaultDeployment(sysroot, index))
+        return;
+
+    emit statusStringChanged(QString(QStringLiteral("Fell back to %1")).arg(bootedRev));
+    emit bootFallbackOccurred(failedRev, bootedRev);
+    if (handleRevisionChanges(sysroot, true))
+        pruneRepository(sysroot);
+}
+
+// Moves the deployment at the given index to the top of the boot loader
+// configuration. Used by rollbacks and by the boot counting fallback.
+bool QOtaClientAsync::makeDefaultDeployment(OstreeSysroot *sysroot, int index)
+{
     g_autoptr(GPtrArray) deployments = ostree_sysroot_get_deployments (sysroot);
     g_autoptr(GPtrArray) newDeployments = g_ptr_array_new_with_free_func (g_object_unref);
     g_ptr_array_add (newDeployments, g_object_ref (deployments->pdata[index]));
@@ -312,66 +874,1036 @@ void QOtaClientAsync::_rollback()
     }
 
     // atomically update bootloader configuration
+    discardStagedDeployment(sysroot);
     GError *error = nullptr;
     if (!ostree_sysroot_write_deployments (sysroot, newDeployments, 0, &error)) {
         emitGError(error);
-        emit rollbackFinished(false);
-        return;
+        return false;
     }
-
-    bool ok = handleRevisionChanges(sysroot, true);
-    emit rollbackFinished(ok);
+    return true;
 }
 
-bool QOtaClientAsync::extractPackage(const QString &packagePath, OstreeSysroot *sysroot, QString *updateToRev)
+// Routes the fetches of the following ostree commands through the fetch proxy,
+// when transfers need to be shaped.
+bool QOtaClientAsync::startFetchProxy(bool enforceDownloadWindows)
 {
-    GError *error = nullptr;
-    // load delta superblock
-    GMappedFile *mfile = g_mapped_file_new (packagePath.toLatin1().data(), FALSE, &error);
-    if (!mfile) {
-        emitGError(error);
-        return false;
+    QOtaFetchTuning tuning;
+    QScopedPointer<QOtaRepositoryConfig> config(QOtaRepositoryConfigPrivate::repositoryConfigFromFile(repoConfigPath));
+    if (config) {
+        tuning.maxConcurrentRequests = config->maxConcurrentRequests();
+        tuning.connectionTimeout = config->connectionTimeout();
+        tuning.retryCount = config->retryCount();
+        tuning.mirrors = config->mirrors();
     }
-    g_autoptr(GBytes) bytes = g_mapped_file_get_bytes (mfile);
-    g_mapped_file_unref (mfile);
-    g_autoptr(GVariant) deltaSuperblock = nullptr;
-    deltaSuperblock = g_variant_new_from_bytes (G_VARIANT_TYPE (OSTREE_STATIC_DELTA_SUPERBLOCK_FORMAT),
-                                                bytes, FALSE);
-    g_variant_ref_sink (deltaSuperblock);
+    m_fetchProxy->setTuning(tuning);
+    if (!m_fetchProxy->isNeeded())
+        return true;
 
-    // get a timestamp of the commit object from the superblock
-    g_autoptr(GVariant) packageCommitV = g_variant_get_child_value (deltaSuperblock, 4);
-    if (!ostree_validate_structureof_commit (packageCommitV, &error)) {
-        emitGError(error);
-        return false;
-    }
-    guint64 packageTimestamp = ostree_commit_get_timestamp (packageCommitV);
-    // get timestamp of the head commit from the repository
     bool ok = true;
-    g_autoptr(GVariant) currentCommitV = nullptr;
-    OstreeRepo *repo = nullptr;
-    if (!ostree_sysroot_get_repo (sysroot, &repo, 0, &error)) {
-        emitGError(error);
-        return false;
-    }
-    QString currentCommit = ostree(QStringLiteral("ostree rev-parse linux/qt"), &ok);
-    if (!ok || !ostree_repo_load_commit (repo, currentCommit.toLatin1().constData(),
-                                         &currentCommitV, nullptr, &error)) {
-        emitGError(error);
+    QString remoteUrl = ostree(QStringLiteral("ostree remote show-url qt-os"), &ok);
+    if (!ok)
         return false;
-    }
-    guint64 currentTimestamp = ostree_commit_get_timestamp (currentCommitV);
-    qCDebug(qota) << "current timestamp:" << currentTimestamp;
-    qCDebug(qota) << "package timestamp:" << packageTimestamp;
-    if (packageTimestamp < currentTimestamp) {
-        emit errorOccurred(QString(QStringLiteral("Not allowed to downgrade - current timestamp: %1,"
-                           " package timestamp: %2")).arg(currentTimestamp).arg(packageTimestamp));
+    QString httpProxy = m_fetchProxy->start(QUrl(remoteUrl), enforceDownloadWindows);
+    if (httpProxy.isEmpty()) {
+        emit errorOccurred(QStringLiteral("Failed to start the fetch proxy"));
         return false;
     }
-
+    setHttpProxy(httpProxy);
+    return true;
+}
+
+void QOtaClientAsync::setHttpProxy(const QString &url)
+{
+    QMutexLocker locker(&m_settingsMutex);
+    m_httpProxy = url;
+}
+
+void QOtaClientAsync::stopFetchProxy(bool updateStatus)
+{
+    QMutexLocker locker(&m_settingsMutex);
+    if (m_httpProxy.isEmpty())
+        return;
+    m_httpProxy.clear();
+    locker.unlock();
+
+    QString report = m_fetchProxy->stop();
+    if (updateStatus)
+        emit statusStringChanged(report);
+}
+
+// Fetches as many objects as possible from peers on the LAN before pulling from the
+// remote, which then fetches only the objects that the peers did not have. The commit
+// object is already in the repository (see fetchRemoteMetadata), and the objects that
+// it references are verified by checksum as with any other pull. The temporary remote
+// of a peer verifies the signature of the commit as the qt-os remote does. The requests
+// to a peer go through a local proxy that authorizes them, see QOtaPeerServer.
+void QOtaClientAsync::pullFromPeers(const QString &rev)
+{
+    QOtaPeerSettings settings;
+    {
+        QMutexLocker locker(&m_settingsMutex);
+        settings = m_peerSettings;
+    }
+    if (!settings.enabled || settings.secret.isEmpty())
+        return;
+
+    QScopedPointer<QOtaRepositoryConfig> config(QOtaRepositoryConfigPrivate::repositoryConfigFromFile(repoConfigPath));
+    if (!config)
+        return;
+    QString gpgOptions = QStringLiteral(" --set=gpg-verify=false");
+    if (config->gpgVerify()) {
+        gpgOptions = QStringLiteral(" --set=gpg-verify=true");
+        // Keys imported for the qt-os remote only, the global keyrings are used as well.
+        const QString keyring = repoPath + QStringLiteral("/qt-os.trustedkeys.gpg");
+        if (QFile::exists(keyring))
+            gpgOptions += QStringLiteral(" --gpg-import=") + keyring;
+    }
+
+    const QByteArray key = QOtaPeerServer::peerKey(settings.secret);
+    const QVector<QOtaPeer> peers = QOtaPeerServer::discoverPeers(settings, peerDiscoveryTimeout);
+    for (const QOtaPeer &peer : peers) {
+        bool ok = true;
+        ostree(QStringLiteral("ostree remote delete --if-exists qt-os-peer"), &ok);
+        if (ok) ostree(QString(QStringLiteral("ostree remote add%1 qt-os-peer %2")).arg(gpgOptions, peer.url), &ok);
+        if (!ok)
+            break;
+        m_peerProxy->setPeerAuthentication(key, peer.challenge);
+        const QString httpProxy = m_peerProxy->start(QUrl(peer.url), false);
+        if (httpProxy.isEmpty()) {
+            emit errorOccurred(QStringLiteral("Failed to start the fetch proxy"));
+            break;
+        }
+        setHttpProxy(httpProxy);
+        emit statusStringChanged(QStringLiteral("Fetching from peer ") + peer.url);
+        // Static deltas are generated on the server, peers only have objects.
+        ostree(QString(QStringLiteral("ostree pull --disable-static-deltas qt-os-peer %1")).arg(rev), &ok, true, false);
+        setHttpProxy(QString());
+        qCDebug(qota) << m_peerProxy->stop();
+        qCDebug(qota) << "pull from" << peer.url << (ok ? "completed" : "incomplete");
+        if (ok)
+            break;
+    }
+    bool ok = true;
+    ostree(QStringLiteral("ostree remote delete --if-exists qt-os-peer"), &ok);
+}
+
+void QOtaClientAsync::_update(const QString &updateToRev)
+{
+    glnx_unref_object OstreeSysroot *sysroot = defaultSysroot();
+    if (!sysroot) {
+        emit updateFinished(false);
+        return;
+    }
+
+    bool ok = true;
+    emit statusStringChanged(QStringLiteral("Checking for missing objects..."));
+    pullFromPeers(updateToRev);
+    ok = startFetchProxy();
+    if (ok) ostree(QString(QStringLiteral("ostree pull qt-os:%1")).arg(updateToRev), &ok, true);
+    stopFetchProxy();
+    if (!ok || !deployCommit(updateToRev, sysroot)) {
+        emit updateFinished(false);
+        return;
+    }
+
+    ok = handleRevisionChanges(sysroot, true);
+    if (ok) pruneRepository(sysroot);
+    emit updateFinished(ok);
+}
+
+int QOtaClientAsync::rollbackIndex(OstreeSysroot *sysroot, const QString &rev)
+{
+    g_autoptr(GPtrArray) deployments = ostree_sysroot_get_deployments (sysroot);
+    if (deployments->len < 2)
+        return -1;
+
+    if (!rev.isEmpty()) {
+        const QByteArray csum = rev.toLatin1();
+        for (uint i = 0; i < deployments->len; i++) {
+            if (csum == ostree_deployment_get_csum ((OstreeDeployment*)deployments->pdata[i]))
+                return i;
+        }
+        return -1;
+    }
+
+    // 1) if we're not in the default boot index (0), it plans to prepend the
+    //    booted index so that it becomes index 0 (default) and the current
+    //    default becomes index 1.
+    // 2) if we're booted into the default boot index (0), let's roll back to the previous (1)
+    OstreeDeployment *bootedDeployment = (OstreeDeployment*)ostree_sysroot_get_booted_deployment (sysroot);
+    for (uint i = 1; bootedDeployment && i < deployments->len; i++) {
+        if (ostree_deployment_equal (deployments->pdata[i], bootedDeployment))
+            return i;
+    }
+    return 1;
+}
+
+QVector<QOtaDeployment> QOtaClientAsync::deploymentList(OstreeSysroot *sysroot)
+{
+    g_autoptr(GPtrArray) deployments = ostree_sysroot_get_deployments (sysroot);
+    OstreeDeployment *bootedDeployment = (OstreeDeployment*)ostree_sysroot_get_booted_deployment (sysroot);
+    int rollback = rollbackIndex(sysroot);
+    QVector<QOtaDeployment> list;
+    list.reserve(deployments->len);
+    for (uint i = 0; i < deployments->len; i++) {
+        OstreeDeployment *deployment = (OstreeDeployment*)deployments->pdata[i];
+        QOtaDeployment info;
+        info.rev = QLatin1String(ostree_deployment_get_csum (deployment));
+        info.osName = QLatin1String(ostree_deployment_get_osname (deployment));
+        info.index = i;
+        info.deploySerial = ostree_deployment_get_deployserial (deployment);
+        // 'ostree admin pin' stores the flag in the origin file.
+        GKeyFile *origin = ostree_deployment_get_origin (deployment);
+        info.pinned = origin && g_key_file_get_boolean (origin, "libostree-transient", "pinned", nullptr);
+        info.booted = bootedDeployment && ostree_deployment_equal (deployment, bootedDeployment);
+        info.isDefault = i == 0;
+        info.rollback = (int)i == rollback;
+        list.append(info);
+    }
+    return list;
+}
+
+bool QOtaClientAsync::handleRevisionChanges(OstreeSysroot *sysroot, bool reloadSysroot)
+{
+    if (reloadSysroot) {
+        GError *error = nullptr;
+        if (!ostree_sysroot_load (sysroot, 0, &error)) {
+            emitGError(error);
+            return false;
+        }
+    }
+
+    g_autoptr(GPtrArray) deployments = ostree_sysroot_get_deployments (sysroot);
+    OstreeDeployment *firstDeployment = (OstreeDeployment*)deployments->pdata[0];
+    bool ok = true;
+    QString defaultRev(QLatin1String(ostree_deployment_get_csum (firstDeployment)));
+    QString defaultMetadata = metadataFromRev(defaultRev, &ok);
+    if (!ok)
+        return false;
+    emit defaultRevisionChanged(defaultRev, defaultMetadata);
+
+    int index = rollbackIndex(sysroot);
+    if (index != -1) {
+        OstreeDeployment *rollbackDeployment = (OstreeDeployment*)deployments->pdata[index];
+        QString rollbackRev(QLatin1String(ostree_deployment_get_csum (rollbackDeployment)));
+        QString rollbackMetadata = metadataFromRev(rollbackRev, &ok);
+        if (!ok)
+            return false;
+        emit rollbackMetadataChanged(rollbackRev, rollbackMetadata, deployments->len);
+    }
+
+    emit deploymentsChanged(deploymentList(sysroot));
+    emit stagedRevisionChanged(stagedRevision(sysroot));
+
+    return true;
+}
+
+void QOtaClientAsync::emitGError(GError *error)
+{
+    if (!error)
+        return;
+
+    emit errorOccurred(QString::fromLatin1((error->message)));
+    g_error_free (error);
+}
+
+void QOtaClientAsync::_rollback(const QString &rev)
+{
+    glnx_unref_object OstreeSysroot *sysroot = defaultSysroot();
+    if (!sysroot) {
+        emit rollbackFinished(false);
+        return;
+    }
+
+    int index = rollbackIndex(sysroot, rev);
+    if (index == -1) {
+        if (rev.isEmpty())
+            emit errorOccurred(QStringLiteral("At least 2 system versions required for rollback"));
+        else
+            emit errorOccurred(QString(QStringLiteral("Revision %1 is not deployed")).arg(rev));
+        emit rollbackFinished(false);
+        return;
+    }
+    if (index == 0) {
+        emit errorOccurred(QString(QStringLiteral("Revision %1 is already the default system")).arg(rev));
+        emit rollbackFinished(false);
+        return;
+    }
+
+    if (!makeDefaultDeployment(sysroot, index)) {
+        emit rollbackFinished(false);
+        return;
+    }
+
+    bool ok = handleRevisionChanges(sysroot, true);
+    if (ok) pruneRepository(sysroot);
+    emit rollbackFinished(ok);
+}
+
+// Lowers the I/O priority of the calling thread to the idle class for
+// the lifetime of the object.
+class IdleIoPriorityGuard
+{
+public:
+    IdleIoPriorityGuard() : m_previous(syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, 0))
+    {
+        if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) == -1)
+            qCWarning(qota) << "Failed to set the idle I/O priority:" << qt_error_string(errno);
+    }
+    ~IdleIoPriorityGuard()
+    {
+        if (m_previous != -1)
+            syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, m_previous);
+    }
+
+private:
+    long m_previous;
+};
+
+// Returns the disk usage of the repository files that are not hard linked into
+// a deployment, that is the space used by the repository on top of the systems.
+static qint64 repositoryUsage()
+{
+    qint64 usage = 0;
+    QDirIterator it(repoPath, QDir::Files | QDir::Hidden | QDir::System, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        struct stat st;
+        if (lstat(QFile::encodeName(it.next()).constData(), &st) == 0 && st.st_nlink == 1)
+            usage += qint64(st.st_blocks) * 512;
+    }
+    return usage;
+}
+
+// Pulls write into repo/tmp/staging-<boot id>-<random> (see ostree_repo_prepare_transaction()),
+// and the transaction holds a lock on the <name>-lock file next to it. A later pull of
+// the same boot resumes from a staging directory whose lock is free. A staging directory
+// is removed only when it is from an earlier boot or when its lock can be taken, the
+// lock is held until the directory is gone. Without a lock file the directory may be
+// used by a running transaction and it is left alone.
+static bool removeStaleStagingDirectory(const QFileInfo &entry, const QByteArray &bootId)
+{
+    const QByteArray name = QFile::encodeName(entry.fileName());
+    if (!name.startsWith("staging-") || name.endsWith("-lock") || !entry.isDir() || entry.isSymLink())
+        return false;
+
+    const QString lockPath = entry.absoluteFilePath() + QLatin1String("-lock");
+    bool earlierBoot = !bootId.isEmpty() && !name.startsWith("staging-" + bootId + '-');
+    int fd = ::open(QFile::encodeName(lockPath).constData(), O_RDWR | O_CLOEXEC);
+    if (fd == -1 && !earlierBoot)
+        return false;
+    if (fd != -1 && flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        ::close(fd);
+        return false;
+    }
+
+    bool removed = QDir(entry.absoluteFilePath()).removeRecursively();
+    if (removed && fd != -1)
+        QFile::remove(lockPath);
+    if (fd != -1)
+        ::close(fd);
+    return removed;
+}
+
+void QOtaClientAsync::enforceDiskBudget(qint64 budget)
+{
+    qint64 usage = repositoryUsage();
+    qCDebug(qota) << "repository usage:" << usage << "disk budget:" << budget;
+    if (usage <= budget)
+        return;
+
+    // Staging directories of interrupted pulls are not needed by the deployed systems.
+    // Without them an interrupted update is downloaded from the start. The rest of
+    // repo/tmp, such as the cache of the summary files, is kept.
+    QFile bootIdFile(QStringLiteral("/proc/sys/kernel/random/boot_id"));
+    QByteArray bootId;
+    if (bootIdFile.open(QFile::ReadOnly))
+        bootId = bootIdFile.readAll().trimmed();
+    const QFileInfoList entries = QDir(repoPath + QLatin1String("/tmp"))
+            .entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System);
+    for (const QFileInfo &entry : entries) {
+        if (removeStaleStagingDirectory(entry, bootId))
+            qCDebug(qota) << "removed the staging directory" << entry.fileName();
+    }
+
+    usage = repositoryUsage();
+    if (usage > budget)
+        emit errorOccurred(QString(QStringLiteral("The repository uses %1 KiB on top of the deployed systems,"
+                           " which exceeds the disk budget of %2 KiB")).arg(usage / 1024).arg(budget / 1024));
+}
+
+void QOtaClientAsync::pruneRepository(OstreeSysroot *sysroot)
+{
+    QMutexLocker locker(&m_settingsMutex);
+    qint64 budget = m_repositoryDiskBudget;
+    locker.unlock();
+
+    // The cleanup would remove the staged deployment, which is not part of the
+    // boot loader configuration yet, and the objects of its commit.
+    if (!stagedRevision(sysroot).isEmpty()) {
+        qCDebug(qota) << "pruning is postponed until the staged deployment is finalized";
+        return;
+    }
+
+    emit statusStringChanged(QStringLiteral("Pruning the repository..."));
+    IdleIoPriorityGuard ioPriority;
+    QElapsedTimer timer;
+    timer.start();
+    qint64 available = QStorageInfo(repoPath).bytesAvailable();
+
+    // Regenerates the refs that hold the deployed commits and prunes the objects that
+    // are not reachable from any ref, without keeping history (REFS_ONLY, depth 0).
+    // Leftover deployment and boot directories are removed as well.
+    GError *error = nullptr;
+    if (!ostree_sysroot_cleanup (sysroot, nullptr, &error)) {
+        emitGError(error);
+        return;
+    }
+    if (budget > 0)
+        enforceDiskBudget(budget);
+
+    qint64 reclaimed = qMax(Q_INT64_C(0), QStorageInfo(repoPath).bytesAvailable() - available);
+    qCDebug(qota) << "pruned the repository in" << timer.elapsed() << "ms," << reclaimed << "bytes reclaimed";
+    emit statusStringChanged(QString(QStringLiteral("Pruned the repository: %1 KiB reclaimed in %2 ms"))
+                             .arg(reclaimed / 1024).arg(timer.elapsed()));
+}
+
+struct InodeKey
+{
+    quint64 device;
+    quint64 inode;
+    bool operator==(const InodeKey &other) const { return device == other.device && inode == other.inode; }
+};
+
+static uint qHash(const InodeKey &key, uint seed = 0)
+{
+    return qHash(qMakePair(key.device, key.inode), seed);
+}
+
+struct InodeUsage
+{
+    quint64 owners;  // a bit for each deployment that links the inode
+    qint64 bytes;
+};
+
+static void collectInodes(const QString &path, int deployment, QHash<InodeKey, InodeUsage> *inodes)
+{
+    QDirIterator it(path, QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System,
+                    QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        struct stat st;
+        if (lstat(QFile::encodeName(it.next()).constData(), &st) != 0)
+            continue;
+        InodeUsage &usage = (*inodes)[{ quint64(st.st_dev), quint64(st.st_ino) }];
+        usage.owners |= Q_UINT64_C(1) << deployment;
+        usage.bytes = qint64(st.st_blocks) * 512;
+    }
+}
+
+// Deployed files are hard links to the repository objects, and the files of a
+// kernel are shared by the deployments with the same boot checksum. Only the
+// inodes that are linked by a single deployment are counted, which is the space
+// that becomes available when that deployment is removed and the repository
+// is pruned.
+void QOtaClientAsync::_measureDiskUsage()
+{
+    glnx_unref_object OstreeSysroot *sysroot = defaultSysroot();
+    if (!sysroot) {
+        emit measureDiskUsageFinished(false);
+        return;
+    }
+
+    emit statusStringChanged(QStringLiteral("Measuring the disk usage of the deployments..."));
+    IdleIoPriorityGuard ioPriority;
+    QVector<QOtaDeployment> list = deploymentList(sysroot);
+    g_autoptr(GPtrArray) deployments = ostree_sysroot_get_deployments (sysroot);
+    g_autofree char *sysrootPath = g_file_get_path (ostree_sysroot_get_path (sysroot));
+    const int count = qMin(int(deployments->len), 64);
+    QHash<InodeKey, InodeUsage> inodes;
+    for (int i = 0; i < count; i++) {
+        OstreeDeployment *deployment = (OstreeDeployment*)deployments->pdata[i];
+        g_autoptr(GFile) dir = ostree_sysroot_get_deployment_directory (sysroot, deployment);
+        g_autofree char *dirPath = g_file_get_path (dir);
+        collectInodes(QFile::decodeName(dirPath), i, &inodes);
+        collectInodes(QString(QStringLiteral("%1/boot/ostree/%2-%3")).arg(QFile::decodeName(sysrootPath))
+                      .arg(QLatin1String(ostree_deployment_get_osname (deployment)))
+                      .arg(QLatin1String(ostree_deployment_get_bootcsum (deployment))), i, &inodes);
+        list[i].diskUsage = 0;
+    }
+
+    for (const InodeUsage &usage : qAsConst(inodes)) {
+        // exactly one bit set
+        if ((usage.owners & (usage.owners - 1)) == 0)
+            list[qCountTrailingZeroBits(usage.owners)].diskUsage += usage.bytes;
+    }
+
+    emit deploymentsChanged(list);
+    emit measureDiskUsageFinished(true);
+}
+
+// from ostree-repo-static-delta-private.h
+static const char noCompression = 0;
+static const char lzmaCompression = 'x';
+
+struct DeltaPart
+{
+    uint index;
+    QByteArray name;      // inline key or a file path, used for error reporting
+    QByteArray data;      // a view into the mapped package, not a copy
+    QByteArray checksum;  // expected SHA256 from the superblock's meta entry
+    char compression = noCompression; // of data, when it is decompressed
+};
+
+// The tasks run on a thread pool of their own, never on the global pool of the
+// application. A pool thread applies the priority policy (see QOtaClient::niceLevel)
+// before its first task, and again when the policy has changed since.
+static void applyPoolThreadPriorityPolicy(const QOtaPriorityPolicy &policy)
+{
+    static thread_local int appliedPolicy = -1;
+    if (appliedPolicy == policy.generation)
+        return;
+    QString error = applyThreadPriorityPolicy(policy);
+    if (!error.isEmpty())
+        qCWarning(qota) << error;
+    appliedPolicy = policy.generation;
+}
+
+static void setFirstBadPart(QAtomicInt *firstBadPart, uint index)
+{
+    int current = firstBadPart->load();
+    while (int(index) < current && !firstBadPart->testAndSetOrdered(current, index))
+        current = firstBadPart->load();
+}
+
+// Parts are verified concurrently, but the reported error always names the
+// first (lowest index) bad part. Once a bad part is found, parts with a higher
+// index are skipped, as they can not change the outcome.
+class VerifyDeltaPart : public QRunnable
+{
+public:
+    VerifyDeltaPart(const DeltaPart &part, QAtomicInt *firstBadPart, const QOtaPriorityPolicy &policy)
+        : m_part(part), m_firstBadPart(firstBadPart), m_policy(policy) {}
+
+    void run() Q_DECL_OVERRIDE
+    {
+        applyPoolThreadPriorityPolicy(m_policy);
+        if (int(m_part.index) > m_firstBadPart->load())
+            return;
+        if (QCryptographicHash::hash(m_part.data, QCryptographicHash::Sha256) != m_part.checksum)
+            setFirstBadPart(m_firstBadPart, m_part.index);
+    }
+
+private:
+    const DeltaPart &m_part;
+    QAtomicInt *m_firstBadPart;
+    const QOtaPriorityPolicy &m_policy;
+};
+
+// Writes a part in the format of a part file, with the compression type 'none' in
+// the first byte, followed by the uncompressed payload. The payload is streamed,
+// a part is not held in memory uncompressed.
+static bool writeUncompressedPart(const DeltaPart &part, const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QFile::WriteOnly) || !file.putChar(noCompression))
+        return false;
+    if (part.compression == noCompression)
+        return file.write(part.data) == part.data.size();
+    if (part.compression != lzmaCompression)
+        return false;
+
+    lzma_stream stream = LZMA_STREAM_INIT;
+    if (lzma_stream_decoder (&stream, UINT64_MAX, 0) != LZMA_OK)
+        return false;
+    stream.next_in = reinterpret_cast<const uint8_t *>(part.data.constData());
+    stream.avail_in = size_t(part.data.size());
+    QByteArray buffer(64 * 1024, Qt::Uninitialized);
+    lzma_ret ret = LZMA_OK;
+    bool written = true;
+    while (ret == LZMA_OK && written) {
+        stream.next_out = reinterpret_cast<uint8_t *>(buffer.data());
+        stream.avail_out = size_t(buffer.size());
+        ret = lzma_code (&stream, LZMA_FINISH);
+        qint64 produced = buffer.size() - qint64(stream.avail_out);
+        written = file.write(buffer.constData(), produced) == produced;
+    }
+    lzma_end (&stream);
+    return ret == LZMA_STREAM_END && written;
+}
+
+class DecompressDeltaPart : public QRunnable
+{
+public:
+    DecompressDeltaPart(const DeltaPart &part, const QString &path, QAtomicInt *firstBadPart,
+                        const QOtaPriorityPolicy &policy)
+        : m_part(part), m_path(path), m_firstBadPart(firstBadPart), m_policy(policy) {}
+
+    void run() Q_DECL_OVERRIDE
+    {
+        applyPoolThreadPriorityPolicy(m_policy);
+        if (int(m_part.index) > m_firstBadPart->load())
+            return;
+        if (!writeUncompressedPart(m_part, m_path))
+            setFirstBadPart(m_firstBadPart, m_part.index);
+    }
+
+private:
+    const DeltaPart &m_part;
+    QString m_path;
+    QAtomicInt *m_firstBadPart;
+    const QOtaPriorityPolicy &m_policy;
+};
+
+static QByteArray bytesView(GBytes *bytes)
+{
+    gsize size = 0;
+    const char *data = static_cast<const char*>(g_bytes_get_data (bytes, &size));
+    return QByteArray::fromRawData(data, int(size));
+}
+
+static void setPackageError(GError **error, uint index, const QByteArray &name, const char *reason)
+{
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                 "Corrupt update package, delta part %u (%s): %s", index, name.constData(), reason);
+}
+
+// A split package (see qt-ostree --split-self-contained-package) comes with a manifest in
+// the sha256sum format. Delta parts are covered by checksums in the superblock, but the
+// superblock itself is not, so verify it against the manifest when one is available.
+static bool verifySuperblock(const QString &packagePath, GBytes *superblock, GError **error)
+{
+    QFileInfo package(packagePath);
+    QFile manifest(package.absolutePath() + QLatin1String("/manifest"));
+    if (!manifest.open(QFile::ReadOnly))
+        return true;
+
+    const QByteArray name = package.fileName().toLatin1();
+    while (!manifest.atEnd()) {
+        const QList<QByteArray> fields = manifest.readLine().simplified().split(' ');
+        if (fields.size() != 2 || fields.at(1) != name)
+            continue;
+        if (QCryptographicHash::hash(bytesView(superblock), QCryptographicHash::Sha256).toHex() == fields.at(0))
+            return true;
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                     "Corrupt update package, superblock checksum mismatch: %s", name.constData());
+        return false;
+    }
+    return true;
+}
+
+bool QOtaClientAsync::verifyDeltaParts(GVariant *deltaSuperblock, const QString &packagePath, GError **error)
+{
+    QElapsedTimer timer;
+    timer.start();
+    g_autoptr(GPtrArray) partBytes = g_ptr_array_new_with_free_func ((GDestroyNotify)g_bytes_unref);
+
+    // Inline parts are stored in the superblock's metadata, keyed by
+    // their relative path in a repository (deltas/../<part index>).
+    QHash<uint, QByteArray> inlineParts;
+    QHash<uint, QByteArray> inlinePartNames;
+    g_autoptr(GVariant) metadata = g_variant_get_child_value (deltaSuperblock, 0);
+    GVariantIter iter;
+    const char *key = nullptr;
+    GVariant *value = nullptr;
+    g_variant_iter_init (&iter, metadata);
+    while (g_variant_iter_loop (&iter, "{&sv}", &key, &value)) {
+        if (!g_str_has_prefix (key, "deltas/") || !g_variant_is_of_type (value, G_VARIANT_TYPE ("(yay)")))
+            continue;
+        bool ok = false;
+        uint index = QByteArray(strrchr (key, '/') + 1).toUInt(&ok);
+        if (!ok)
+            continue;
+        GBytes *bytes = g_variant_get_data_as_bytes (value);
+        g_ptr_array_add (partBytes, bytes);
+        inlineParts.insert(index, bytesView(bytes));
+        inlinePartNames.insert(index, QByteArray(key));
+    }
+
+    // Other parts are expected to be found next to the superblock (a split package,
+    // see qt-ostree --split-self-contained-package). All parts are located and size
+    // checked before hashing anything, so that a truncated copy is rejected without
+    // reading the package.
+    const QString packageDir = QFileInfo(packagePath).absolutePath();
+    g_autoptr(GVariant) metaEntries = g_variant_get_child_value (deltaSuperblock, 6);
+    const uint partCount = g_variant_n_children (metaEntries);
+    QVector<DeltaPart> parts;
+    QStringList incompleteParts;
+    QStringList incompletePartNames;
+    QList<QByteArray> newlyVerified;
+    parts.reserve(partCount);
+    for (uint i = 0; i < partCount; i++) {
+        guint32 version;
+        guint64 size, usize;
+        g_autoptr(GVariant) csumV = nullptr;
+        g_autoptr(GVariant) objects = nullptr;
+        g_variant_get_child (metaEntries, i, "(u@aytt@ay)", &version, &csumV, &size, &usize, &objects);
+
+        DeltaPart part;
+        part.index = i;
+        gsize csumLength = 0;
+        const char *csum = static_cast<const char*>(g_variant_get_fixed_array (csumV, &csumLength, 1));
+        part.checksum = QByteArray(csum, int(csumLength));
+        // Parts that were verified by an earlier (failed) attempt are not hashed again,
+        // as long as the file has the same size and modification time. They still go
+        // through the checksum and size checks below.
+        bool verified = false;
+        qint64 partSize = 0;
+        if (inlineParts.contains(i)) {
+            part.name = inlinePartNames.value(i);
+            part.data = inlineParts.value(i);
+            partSize = part.data.size();
+        } else {
+            part.name = QString(packageDir + QLatin1Char('/') + QString::number(i)).toLatin1();
+            QFileInfo partInfo(QString::fromLatin1(part.name));
+            if (!partInfo.isFile() || guint64(partInfo.size()) != size) {
+                // Missing or partially transferred, keep going to report all such parts at once.
+                incompleteParts.append(QString::number(i));
+                incompletePartNames.append(QString::fromLatin1(part.name));
+                continue;
+            }
+            QByteArray verifiedKey = part.checksum.toHex() + ':' + part.name + ':'
+                    + QByteArray::number(partInfo.size()) + ':'
+                    + QByteArray::number(partInfo.lastModified().toMSecsSinceEpoch());
+            verified = m_verifiedParts.contains(verifiedKey);
+            if (verified) {
+                partSize = partInfo.size();
+            } else {
+                GMappedFile *mfile = g_mapped_file_new (part.name.constData(), FALSE, error);
+                if (!mfile) {
+                    // The part is there, but can not be read (permissions, I/O error).
+                    g_prefix_error (error, "Failed to read the update package, delta part %u: ", i);
+                    emit packageVerificationFailed(QOtaClient::PackageReadError,
+                                                   QStringList(QString::fromLatin1(part.name)));
+                    return false;
+                }
+                GBytes *bytes = g_mapped_file_get_bytes (mfile);
+                g_mapped_file_unref (mfile);
+                g_ptr_array_add (partBytes, bytes);
+                part.data = bytesView(bytes);
+                partSize = part.data.size();
+                newlyVerified.append(verifiedKey);
+            }
+        }
+
+        if (csumLength != OSTREE_SHA256_DIGEST_LEN) {
+            setPackageError(error, i, part.name, "invalid checksum in the superblock");
+            emit packageVerificationFailed(QOtaClient::InvalidSuperblock, QStringList(QString::fromLatin1(part.name)));
+            return false;
+        }
+        if (guint64(partSize) != size) {
+            setPackageError(error, i, part.name, QString(QStringLiteral("expected %1 bytes, found %2"))
+                            .arg(size).arg(partSize).toLatin1().constData());
+            emit packageVerificationFailed(inlineParts.contains(i) ? QOtaClient::InvalidSuperblock
+                                                                   : QOtaClient::IncompletePackage,
+                                           QStringList(QString::fromLatin1(part.name)));
+            return false;
+        }
+        if (!verified)
+            parts.append(part);
+    }
+
+    if (!incompleteParts.isEmpty()) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                     "Incomplete update package in %s, missing or truncated parts: %s",
+                     packageDir.toLatin1().constData(),
+                     incompleteParts.join(QLatin1String(", ")).toLatin1().constData());
+        emit packageVerificationFailed(QOtaClient::IncompletePackage, incompletePartNames);
+        return false;
+    }
+
+    QAtomicInt firstBadPart(INT_MAX);
+    for (const DeltaPart &part : qAsConst(parts))
+        m_verifyPool.start(new VerifyDeltaPart(part, &firstBadPart, m_priorityPolicy));
+    m_verifyPool.waitForDone();
+    qCDebug(qota) << "verified" << parts.size() << "delta parts in" << timer.elapsed() << "ms";
+    if (firstBadPart.load() != INT_MAX) {
+        for (const DeltaPart &part : qAsConst(parts)) {
+            if (int(part.index) == firstBadPart.load()) {
+                setPackageError(error, part.index, part.name, "checksum mismatch");
+                emit packageVerificationFailed(QOtaClient::ChecksumMismatch, QStringList(QString::fromLatin1(part.name)));
+                break;
+            }
+        }
+        return false;
+    }
+    for (const QByteArray &key : qAsConst(newlyVerified))
+        m_verifiedParts.insert(key);
+
+    return true;
+}
+
+// libostree executes the parts of a delta one after another, and decompresses each
+// part right before it executes it. Here the compressed parts are decompressed in
+// parallel on the verification pool instead, into a copy of the package in repo/tmp
+// that has no inline parts. libostree then executes the uncompressed copy, and the
+// object writes are its only sequential work. Uncompressed parts of a split package
+// are linked, not copied. Returns false when the package should be executed as is:
+// no part is compressed, the free space does not fit the copy and the objects
+// written from it, or a part failed to decompress.
+bool QOtaClientAsync::decompressDeltaParts(GVariant *deltaSuperblock, const QString &packagePath,
+                                           const QString &targetDir)
+{
+    QElapsedTimer timer;
+    timer.start();
+    g_autoptr(GPtrArray) partBytes = g_ptr_array_new_with_free_func ((GDestroyNotify)g_bytes_unref);
+
+    // The copy has the metadata of the superblock, without the inline parts.
+    QHash<uint, GBytes*> inlineParts;
+    QHash<uint, char> inlineCompression;
+    GVariantBuilder metadataBuilder;
+    g_variant_builder_init (&metadataBuilder, G_VARIANT_TYPE ("a{sv}"));
+    g_autoptr(GVariant) metadata = g_variant_get_child_value (deltaSuperblock, 0);
+    GVariantIter iter;
+    const char *key = nullptr;
+    GVariant *value = nullptr;
+    g_variant_iter_init (&iter, metadata);
+    while (g_variant_iter_loop (&iter, "{&sv}", &key, &value)) {
+        bool ok = false;
+        uint index = 0;
+        if (g_str_has_prefix (key, "deltas/") && g_variant_is_of_type (value, G_VARIANT_TYPE ("(yay)")))
+            index = QByteArray(strrchr (key, '/') + 1).toUInt(&ok);
+        if (!ok) {
+            g_variant_builder_add (&metadataBuilder, "{sv}", key, value);
+            continue;
+        }
+        guchar compression = 0;
+        g_autoptr(GVariant) payload = nullptr;
+        g_variant_get (value, "(y@ay)", &compression, &payload);
+        GBytes *bytes = g_variant_get_data_as_bytes (payload);
+        g_ptr_array_add (partBytes, bytes);
+        inlineParts.insert(index, bytes);
+        inlineCompression.insert(index, char(compression));
+    }
+    g_autoptr(GVariant) newMetadata = g_variant_ref_sink (g_variant_builder_end (&metadataBuilder));
+
+    const QString packageDir = QFileInfo(packagePath).absolutePath();
+    g_autoptr(GVariant) metaEntries = g_variant_get_child_value (deltaSuperblock, 6);
+    const uint partCount = g_variant_n_children (metaEntries);
+    QVector<DeltaPart> parts;
+    parts.reserve(partCount);
+    guint64 uncompressedSize = 0;
+    bool compressed = false;
+    for (uint i = 0; i < partCount; i++) {
+        guint32 version;
+        guint64 size, usize;
+        g_autoptr(GVariant) csumV = nullptr;
+        g_autoptr(GVariant) objects = nullptr;
+        g_variant_get_child (metaEntries, i, "(u@aytt@ay)", &version, &csumV, &size, &usize, &objects);
+        uncompressedSize += usize;
+
+        DeltaPart part;
+        part.index = i;
+        const QString target = targetDir + QLatin1Char('/') + QString::number(i);
+        if (inlineParts.contains(i)) {
+            part.name = QByteArray::number(i);
+            part.data = bytesView(inlineParts.value(i));
+            part.compression = inlineCompression.value(i);
+        } else {
+            part.name = QString(packageDir + QLatin1Char('/') + QString::number(i)).toLatin1();
+            GMappedFile *mfile = g_mapped_file_new (part.name.constData(), FALSE, nullptr);
+            if (!mfile)
+                return false;
+            GBytes *bytes = g_mapped_file_get_bytes (mfile);
+            g_mapped_file_unref (mfile);
+            g_ptr_array_add (partBytes, bytes);
+            const QByteArray data = bytesView(bytes);
+            if (data.isEmpty())
+                return false;
+            if (data.at(0) == noCompression) {
+                if (!QFile::link(QString::fromLatin1(part.name), target))
+                    return false;
+                continue;
+            }
+            part.compression = data.at(0);
+            part.data = QByteArray::fromRawData(data.constData() + 1, data.size() - 1);
+        }
+        compressed |= part.compression != noCompression;
+        parts.append(part);
+    }
+
+    if (!compressed)
+        return false;
+    qint64 available = QStorageInfo(targetDir).bytesAvailable();
+    if (available < 0 || guint64(available) < 2 * uncompressedSize) {
+        qCDebug(qota) << "not enough space to decompress the delta parts in advance," << uncompressedSize
+                      << "bytes needed twice," << available << "bytes available";
+        return false;
+    }
+
+    GVariantBuilder superblockBuilder;
+    g_variant_builder_init (&superblockBuilder, G_VARIANT_TYPE_TUPLE);
+    g_variant_builder_add_value (&superblockBuilder, newMetadata);
+    for (gsize i = 1; i < g_variant_n_children (deltaSuperblock); i++) {
+        g_autoptr(GVariant) child = g_variant_get_child_value (deltaSuperblock, i);
+        g_variant_builder_add_value (&superblockBuilder, child);
+    }
+    g_autoptr(GVariant) superblock = g_variant_ref_sink (g_variant_builder_end (&superblockBuilder));
+    QFile superblockFile(targetDir + QLatin1String("/superblock"));
+    qint64 superblockSize = qint64(g_variant_get_size (superblock));
+    if (!superblockFile.open(QFile::WriteOnly) ||
+        superblockFile.write(static_cast<const char*>(g_variant_get_data (superblock)), superblockSize) != superblockSize)
+        return false;
+    superblockFile.close();
+
+    QAtomicInt firstBadPart(INT_MAX);
+    for (const DeltaPart &part : qAsConst(parts)) {
+        m_verifyPool.start(new DecompressDeltaPart(part, targetDir + QLatin1Char('/') + QString::number(part.index),
+                                                   &firstBadPart, m_priorityPolicy));
+    }
+    m_verifyPool.waitForDone();
+    if (firstBadPart.load() != INT_MAX) {
+        qCWarning(qota) << "Failed to decompress delta part" << firstBadPart.load() << "in advance";
+        return false;
+    }
+    qCDebug(qota) << "decompressed" << parts.size() << "delta parts," << uncompressedSize << "bytes, in"
+                  << timer.elapsed() << "ms";
+    return true;
+}
+
+bool QOtaClientAsync::applyDelta(const QString &packagePath, GVariant *deltaSuperblock, OstreeRepo *repo)
+{
+    QElapsedTimer timer;
+    timer.start();
+    QTemporaryDir uncompressed(repoPath + QLatin1String("/tmp/qota-package-XXXXXX"));
+    QString executedPath = packagePath;
+    if (uncompressed.isValid() && decompressDeltaParts(deltaSuperblock, packagePath, uncompressed.path()))
+        executedPath = uncompressed.path();
+
+    // Parts were already verified by verifyDeltaParts(), skip the (sequential)
+    // validation when libostree executes the delta.
+    GError *error = nullptr;
+    g_autoptr(GFile) packageFile = g_file_new_for_path (executedPath.toLatin1().constData());
+    if (!ostree_repo_prepare_transaction (repo, nullptr, nullptr, &error)) {
+        emitGError(error);
+        return false;
+    }
+    if (!ostree_repo_static_delta_execute_offline (repo, packageFile, TRUE, nullptr, &error) ||
+        !ostree_repo_commit_transaction (repo, nullptr, nullptr, &error)) {
+        ostree_repo_abort_transaction (repo, nullptr, nullptr);
+        emitGError(error);
+        return false;
+    }
+
+    qCDebug(qota) << "applied" << packagePath << "in" << timer.elapsed() << "ms";
+    return true;
+}
+
+bool QOtaClientAsync::verifyTimestamp(OstreeRepo *repo, quint64 updateTimestamp)
+{
+    // get timestamp of the head commit from the repository
+    bool ok = true;
+    GError *error = nullptr;
+    g_autoptr(GVariant) currentCommitV = nullptr;
+    QString currentCommit = ostree(QStringLiteral("ostree rev-parse linux/qt"), &ok);
+    if (!ok || !ostree_repo_load_commit (repo, currentCommit.toLatin1().constData(),
+                                         &currentCommitV, nullptr, &error)) {
+        emitGError(error);
+        return false;
+    }
+    guint64 currentTimestamp = ostree_commit_get_timestamp (currentCommitV);
+    qCDebug(qota) << "current timestamp:" << currentTimestamp;
+    qCDebug(qota) << "package timestamp:" << updateTimestamp;
+    if (updateTimestamp < currentTimestamp) {
+        emit errorOccurred(QString(QStringLiteral("Not allowed to downgrade - current timestamp: %1,"
+                           " package timestamp: %2")).arg(currentTimestamp).arg(updateTimestamp));
+        return false;
+    }
+    return true;
+}
+
+// Imports the objects of the linux/qt commit from a repository on removable media.
+// Only the objects that are missing in the system repository are copied.
+bool QOtaClientAsync::pullFromRepository(const QString &repositoryPath, OstreeSysroot *sysroot, QString *updateToRev)
+{
+    GError *error = nullptr;
+    g_autoptr(GFile) path = g_file_new_for_path (repositoryPath.toLocal8Bit().constData());
+    glnx_unref_object OstreeRepo *source = ostree_repo_new (path);
+    g_autofree char *rev = nullptr;
+    g_autoptr(GVariant) commitV = nullptr;
+    if (!ostree_repo_open (source, nullptr, &error) ||
+        !ostree_repo_resolve_rev (source, "linux/qt", FALSE, &rev, &error) ||
+        !ostree_repo_load_commit (source, rev, &commitV, nullptr, &error)) {
+        emitGError(error);
+        return false;
+    }
+
+    OstreeRepo *repo = nullptr;
+    if (!ostree_sysroot_get_repo (sysroot, &repo, 0, &error)) {
+        emitGError(error);
+        return false;
+    }
+    if (!verifyTimestamp(repo, ostree_commit_get_timestamp (commitV)))
+        return false;
+
+    // The media is not trusted, the checksums of the imported objects are verified.
+    bool ok = true;
+    *updateToRev = QString::fromLatin1(rev);
+    emit statusStringChanged(QStringLiteral("Importing the update from ") + repositoryPath);
+    ostree(QString(QStringLiteral("ostree pull-local --untrusted \"%1\" %2")).arg(repositoryPath, *updateToRev), &ok, true);
+
+    QString remoteMetadata;
+    if (ok) ostree(QString(QStringLiteral("ostree reset qt-os:linux/qt %1")).arg(*updateToRev), &ok);
+    if (ok) remoteMetadata = metadataFromRev(*updateToRev, &ok);
+    if (ok) emit remoteMetadataChanged(*updateToRev, remoteMetadata);
+    return ok;
+}
+
+bool QOtaClientAsync::extractPackage(const QString &packagePath, OstreeSysroot *sysroot, QString *updateToRev)
+{
+    GError *error = nullptr;
+    // load delta superblock
+    GMappedFile *mfile = g_mapped_file_new (packagePath.toLatin1().data(), FALSE, &error);
+    if (!mfile) {
+        emit packageVerificationFailed(QOtaClient::PackageReadError, QStringList(packagePath));
+        emitGError(error);
+        return false;
+    }
+    g_autoptr(GBytes) bytes = g_mapped_file_get_bytes (mfile);
+    g_mapped_file_unref (mfile);
+    g_autoptr(GVariant) deltaSuperblock = nullptr;
+    deltaSuperblock = g_variant_new_from_bytes (G_VARIANT_TYPE (OSTREE_STATIC_DELTA_SUPERBLOCK_FORMAT),
+                                                bytes, FALSE);
+    g_variant_ref_sink (deltaSuperblock);
+    if (!verifySuperblock(packagePath, bytes, &error)) {
+        emit packageVerificationFailed(QOtaClient::InvalidSuperblock, QStringList(packagePath));
+        emitGError(error);
+        return false;
+    }
+
+    // The package is loaded as untrusted data. A truncated or otherwise damaged
+    // superblock is not in normal form, reject it before anything is written.
+    if (!g_variant_is_normal_form (deltaSuperblock)) {
+        g_set_error (&error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                     "Corrupt update package, invalid superblock: %s", packagePath.toLatin1().constData());
+        emit packageVerificationFailed(QOtaClient::InvalidSuperblock, QStringList(packagePath));
+        emitGError(error);
+        return false;
+    }
+
+    // get a timestamp of the commit object from the superblock, a downgrade is
+    // rejected before any of the delta parts are read
+    g_autoptr(GVariant) packageCommitV = g_variant_get_child_value (deltaSuperblock, 4);
+    if (!ostree_validate_structureof_commit (packageCommitV, &error)) {
+        emitGError(error);
+        return false;
+    }
+    guint64 packageTimestamp = ostree_commit_get_timestamp (packageCommitV);
+    OstreeRepo *repo = nullptr;
+    if (!ostree_sysroot_get_repo (sysroot, &repo, 0, &error)) {
+        emitGError(error);
+        return false;
+    }
+    if (!verifyTimestamp(repo, packageTimestamp))
+        return false;
+
+    emit statusStringChanged(QStringLiteral("Verifying the update package..."));
+    if (!verifyDeltaParts(deltaSuperblock, packagePath, &error)) {
+        emitGError(error);
+        return false;
+    }
+
     emit statusStringChanged(QStringLiteral("Extracting the update package..."));
-    ostree(QString(QStringLiteral("ostree static-delta apply-offline %1")).arg(packagePath), &ok);
-    if (!ok) return false;
+    if (!applyDelta(packagePath, deltaSuperblock, repo))
+        return false;
 
     g_autoptr(GVariant) toCsumV = g_variant_get_child_value (deltaSuperblock, 3);
     if (!ostree_validate_structureof_csum_v (toCsumV, &error)) {
@@ -382,6 +1914,7 @@ bool QOtaClientAsync::extractPackage(const QString &packagePath, OstreeSysroot *
     g_autofree char *toCsum = ostree_checksum_from_bytes_v (toCsumV);
     *updateToRev = QString::fromLatin1(toCsum);
 
+    bool ok = true;
     QString remoteMetadata;
     ostree(QString(QStringLiteral("ostree reset qt-os:linux/qt %1")).arg(*updateToRev), &ok);
     if (ok) remoteMetadata = metadataFromRev(*updateToRev, &ok);
@@ -403,8 +1936,20 @@ void QOtaClientAsync::_updateOffline(const QString &packagePath)
     glnx_unref_object OstreeSysroot *sysroot = defaultSysroot();
     bool ok = sysroot && extractPackage(packagePath, sysroot, &rev) &&
             deployCommit(rev, sysroot) && handleRevisionChanges(sysroot, true);
+    if (ok) pruneRepository(sysroot);
 
     emit updateOfflineFinished(ok);
 }
 
+void QOtaClientAsync::_updateFromRepository(const QString &repositoryPath)
+{
+    QString rev;
+    glnx_unref_object OstreeSysroot *sysroot = defaultSysroot();
+    bool ok = sysroot && pullFromRepository(repositoryPath, sysroot, &rev) &&
+            deployCommit(rev, sysroot) && handleRevisionChanges(sysroot, true);
+    if (ok) pruneRepository(sysroot);
+
+    emit updateFromRepositoryFinished(ok);
+}
+
 QT_END_NAMESPACE
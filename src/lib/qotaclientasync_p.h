@@ -31,17 +31,37 @@
 
 #include "qotaclient.h"
 #include "qotaclient_p.h"
+#include "qotadeploymentmodel_p.h"
 
+#include <QtCore/QByteArrayList>
 #include <QtCore/QObject>
+#include <QtCore/QMutex>
 #include <QtCore/QProcess>
+#include <QtCore/QSet>
+#include <QtCore/QThreadPool>
 
 QT_BEGIN_NAMESPACE
 
 struct OstreeSysroot;
+struct OstreeRepo;
 // from gerror.h
 typedef struct _GError GError;
+// from ostree-deployment.h
+typedef struct _OstreeDeployment OstreeDeployment;
+// from gvariant.h
+typedef struct _GVariant GVariant;
 
 class QOtaClientPrivate;
+class QOtaFetchProxy;
+class QOtaPeerServer;
+
+struct QOtaPriorityPolicy
+{
+    int niceLevel = 0;
+    int ioPriority = 0;        // ioprio_set() value
+    QByteArray cgroupThreads;  // cgroup.threads or tasks file, or empty
+    int generation = 0;        // incremented on every change
+};
 
 class QOtaClientAsync : public QObject
 {
@@ -50,40 +70,108 @@ public:
     QOtaClientAsync();
     virtual ~QOtaClientAsync();
 
-    QString ostree(const QString &command, bool *ok, bool updateStatus = false);
+    QString ostree(const QString &command, bool *ok, bool updateStatus = false, bool reportErrors = true);
     bool refreshMetadata(QOtaClientPrivate *d = nullptr);
+    void setRepositoryDiskBudget(qint64 budget);
+    void setRetainedDeployments(int count);
+    void setBootCountLimit(int limit);
+    void setDeployOptions(const QOtaDeployOptions &options);
+    void setPeerSettings(const QOtaPeerSettings &settings);
+    QOtaFetchProxy *fetchProxy() const { return m_fetchProxy.data(); }
 
 signals:
     void fetchRemoteMetadata();
     void fetchRemoteMetadataFinished(bool success);
     void update(const QString &updateToRev);
     void updateFinished(bool success);
-    void rollback();
+    void rollback(const QString &rev);
     void rollbackFinished(bool success);
+    void bootFallbackOccurred(const QString &failedRevision, const QString &bootedRevision);
     void updateOffline(const QString &packagePath);
     void updateOfflineFinished(bool success);
     void updateRemoteMetadataOffline(const QString &packagePath);
     void updateRemoteMetadataOfflineFinished(bool success);
+    void updateFromRepository(const QString &repositoryPath);
+    void updateFromRepositoryFinished(bool success);
+    void measureDiskUsage();
+    void markBootSuccessful();
+    void markBootSuccessfulFinished(bool success);
+    void checkBootState();
+    void measureDiskUsageFinished(bool success);
+    void setPriorityPolicy(int niceLevel, int ioPriorityClass, const QString &cgroupPath);
+    void setFetchSettings(const QOtaFetchSettings &settings);
     void rollbackMetadataChanged(const QString &rollbackRev, const QString &rollbackMetadata, int treeCount);
     void errorOccurred(const QString &error);
     void statusStringChanged(const QString &status);
     void remoteMetadataChanged(const QString &remoteRev, const QString &remoteMetadata);
     void defaultRevisionChanged(const QString &defaultRevision, const QString &defaultMetadata);
+    void deploymentsChanged(const QVector<QOtaDeployment> &deployments);
+    void stagedRevisionChanged(const QString &stagedRevision);
+    void loadMetadata(const QString &rev);
+    void metadataLoaded(const QString &rev, const QString &metadata, bool ok);
+    void packageVerificationFailed(int error, const QStringList &parts);
 
 protected:
     OstreeSysroot* defaultSysroot();
-    QString metadataFromRev(const QString &rev, bool *ok);
-    int rollbackIndex(OstreeSysroot *sysroot);
+    QString metadataFromRev(const QString &rev, bool *ok, bool reportErrors = true);
+    int rollbackIndex(OstreeSysroot *sysroot, const QString &rev = QString());
+    QVector<QOtaDeployment> deploymentList(OstreeSysroot *sysroot);
+    OstreeDeployment *deployTree(const QString &commit, const QByteArrayList &kernelArgs,
+                                 OstreeSysroot *sysroot, GError **error);
+    bool syncDeployments(OstreeSysroot *sysroot, int syncPolicy);
+    bool stageCommit(const QString &commit, const QByteArrayList &kernelArgs, int syncPolicy, OstreeSysroot *sysroot);
+    QString stagedRevision(OstreeSysroot *sysroot);
+    void discardStagedDeployment(OstreeSysroot *sysroot);
+    bool makeDefaultDeployment(OstreeSysroot *sysroot, int index);
+    QString sysrootPath(OstreeSysroot *sysroot);
+    void armBootCounter(OstreeSysroot *sysroot);
     bool handleRevisionChanges(OstreeSysroot *sysroot, bool reloadSysroot = false);
     void emitGError(GError *error);
     bool deployCommit(const QString &commit, OstreeSysroot *sysroot);
+    bool verifyDeltaParts(GVariant *deltaSuperblock, const QString &packagePath, GError **error);
+    bool decompressDeltaParts(GVariant *deltaSuperblock, const QString &packagePath, const QString &targetDir);
+    bool applyDelta(const QString &packagePath, GVariant *deltaSuperblock, OstreeRepo *repo);
+    bool verifyTimestamp(OstreeRepo *repo, quint64 updateTimestamp);
     bool extractPackage(const QString &packagePath, OstreeSysroot *sysroot, QString *updateToRev);
+    bool pullFromRepository(const QString &repositoryPath, OstreeSysroot *sysroot, QString *updateToRev);
+    void pruneRepository(OstreeSysroot *sysroot);
+    bool startFetchProxy(bool enforceDownloadWindows = true);
+    void setHttpProxy(const QString &url);
+    void stopFetchProxy(bool updateStatus = true);
+    void pullFromPeers(const QString &rev);
+    void enforceDiskBudget(qint64 budget);
 
     void _fetchRemoteMetadata();
     void _update(const QString &updateToRev);
-    void _rollback();
+    void _rollback(const QString &rev);
     void _updateOffline(const QString &packagePath);
     void _updateRemoteMetadataOffline(const QString &packagePath);
+    void _updateFromRepository(const QString &repositoryPath);
+    void _loadMetadata(const QString &rev);
+    void _measureDiskUsage();
+    void _markBootSuccessful();
+    void _checkBootState();
+    void _setPriorityPolicy(int niceLevel, int ioPriorityClass, const QString &cgroupPath);
+    void _setFetchSettings(const QOtaFetchSettings &settings);
+    void peerServerStarted(bool success, const QString &interfaceName, quint16 port);
+
+private:
+    QSet<QByteArray> m_verifiedParts;
+    // Guards the settings below, which are set from the thread of QOtaClient, and
+    // the environment of the ostree processes, which is read from it (see ostree()).
+    QMutex m_settingsMutex;
+    qint64 m_repositoryDiskBudget;
+    int m_retainedDeployments;
+    int m_bootCountLimit;
+    QOtaDeployOptions m_deployOptions;
+    QByteArray m_cgroupProcs;
+    QOtaPriorityPolicy m_priorityPolicy;
+    QThreadPool m_verifyPool;
+    QScopedPointer<QOtaFetchProxy> m_fetchProxy;
+    QScopedPointer<QOtaFetchProxy> m_peerProxy;
+    QString m_httpProxy;
+    QScopedPointer<QOtaPeerServer> m_peerServer;
+    QOtaPeerSettings m_peerSettings;
 };
 
 QT_END_NAMESPACE
@@ -0,0 +1,346 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the Qt OTA Update module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:GPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 or (at your option) any later version
+** approved by the KDE Free Qt Foundation. The licenses are as published by
+** the Free Software Foundation and appearing in the file LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+#include "qotadeploymentmodel.h"
+#include "qotadeploymentmodel_p.h"
+#include "qotaclientasync_p.h"
+
+#include <algorithm>
+
+QT_BEGIN_NAMESPACE
+
+// Metadata is loaded when a row is shown, only the recently used entries are kept.
+const int metadataCacheSize = 64;
+
+QOtaDeploymentModelPrivate::QOtaDeploymentModelPrivate(QOtaDeploymentModel *model) :
+    q_ptr(model),
+    m_otaAsync(nullptr),
+    m_metadataCache(metadataCacheSize)
+{
+}
+
+QOtaDeploymentModelPrivate::~QOtaDeploymentModelPrivate()
+{
+}
+
+void QOtaDeploymentModelPrivate::setDeployments(const QVector<QOtaDeployment> &newDeployments)
+{
+    Q_Q(QOtaDeploymentModel);
+    int oldCount = m_deployments.size();
+
+    // The unshared disk usage depends only on the set of deployments, keep the
+    // measured values until a deployment is added or removed.
+    QVector<QOtaDeployment> deployments = newDeployments;
+    bool sameSet = deployments.size() == m_deployments.size();
+    for (int i = 0; i < deployments.size() && sameSet; ++i) {
+        sameSet = std::any_of(m_deployments.cbegin(), m_deployments.cend(), [&](const QOtaDeployment &d) {
+            return d.isSameDeployment(deployments.at(i));
+        });
+    }
+    for (int i = 0; i < deployments.size() && sameSet; ++i) {
+        QOtaDeployment &deployment = deployments[i];
+        for (const QOtaDeployment &old : qAsConst(m_deployments)) {
+            if (deployment.diskUsage == -1 && old.isSameDeployment(deployment))
+                deployment.diskUsage = old.diskUsage;
+        }
+    }
+
+    // Remove the deployments that are gone, then move, insert and update rows in the
+    // new order, so that views keep the state of the unchanged rows.
+    for (int i = m_deployments.size() - 1; i >= 0; --i) {
+        const QOtaDeployment &deployment = m_deployments.at(i);
+        auto found = std::find_if(deployments.cbegin(), deployments.cend(), [&deployment](const QOtaDeployment &d) {
+            return d.isSameDeployment(deployment);
+        });
+        if (found == deployments.cend()) {
+            q->beginRemoveRows(QModelIndex(), i, i);
+            m_deployments.remove(i);
+            q->endRemoveRows();
+        }
+    }
+
+    for (int i = 0; i < deployments.size(); ++i) {
+        const QOtaDeployment &deployment = deployments.at(i);
+        int from = -1;
+        for (int j = i; j < m_deployments.size() && from == -1; ++j) {
+            if (m_deployments.at(j).isSameDeployment(deployment))
+                from = j;
+        }
+
+        if (from == -1) {
+            q->beginInsertRows(QModelIndex(), i, i);
+            m_deployments.insert(i, deployment);
+            q->endInsertRows();
+            continue;
+        }
+        if (from != i) {
+            q->beginMoveRows(QModelIndex(), from, from, QModelIndex(), i);
+            m_deployments.move(from, i);
+            q->endMoveRows();
+        }
+        if (m_deployments.at(i) != deployment) {
+            m_deployments[i] = deployment;
+            QModelIndex changed = q->index(i);
+            emit q->dataChanged(changed, changed, QVector<int>() << QOtaDeploymentModel::DeploymentIndexRole
+                                << QOtaDeploymentModel::PinnedRole << QOtaDeploymentModel::BootedRole
+                                << QOtaDeploymentModel::DefaultRole << QOtaDeploymentModel::RollbackRole
+                                << QOtaDeploymentModel::DiskUsageRole);
+        }
+    }
+
+    if (oldCount != m_deployments.size())
+        emit q->countChanged();
+}
+
+void QOtaDeploymentModelPrivate::cacheMetadata(const QString &rev, const QString &metadata)
+{
+    if (!rev.isEmpty())
+        m_metadataCache.insert(rev, new QString(metadata));
+}
+
+void QOtaDeploymentModelPrivate::requestMetadata(const QString &rev) const
+{
+    if (!m_otaAsync || m_pendingMetadata.contains(rev))
+        return;
+
+    m_pendingMetadata.insert(rev);
+    emit m_otaAsync->loadMetadata(rev);
+}
+
+void QOtaDeploymentModelPrivate::metadataLoaded(const QString &rev, const QString &metadata, bool ok)
+{
+    Q_Q(QOtaDeploymentModel);
+    m_pendingMetadata.remove(rev);
+    // Failures are cached as well, a missing commit would be requested over and over.
+    if (!ok)
+        qCWarning(qota) << "Failed to load the metadata of" << rev;
+    cacheMetadata(rev, metadata);
+
+    for (int i = 0; i < m_deployments.size(); ++i) {
+        if (m_deployments.at(i).rev == rev) {
+            QModelIndex changed = q->index(i);
+            emit q->dataChanged(changed, changed, QVector<int>() << QOtaDeploymentModel::MetadataRole);
+        }
+    }
+}
+
+/*!
+    \inqmlmodule QtOtaUpdate
+    \qmltype OtaDeploymentModel
+    \instantiates QOtaDeploymentModel
+    \brief Lists the system versions that are deployed on the device.
+
+    OtaDeploymentModel is not creatable, it is available as OtaClient::deployments.
+    \include qotadeploymentmodel.cpp deployment-model-description
+
+    The following example shows the deployed system versions in a ListView:
+
+    \code
+    ListView {
+        model: OtaClient.deployments
+        delegate: Label {
+            text: revision + (isBooted ? " (booted)" : "") + (isRollback ? " (rollback)" : "")
+        }
+    }
+    \endcode
+*/
+
+/*!
+    \class QOtaDeploymentModel
+    \inmodule qtotaupdate
+    \brief Lists the system versions that are deployed on the device.
+
+    QOtaDeploymentModel is not creatable, it is available from
+    QOtaClient::deployments().
+//! [deployment-model-description]
+    The model has one row for each deployment, in the boot order: the first row
+    is the default system, which is started on the next boot. The following
+    roles are available:
+
+    \table
+    \header
+        \li Role
+        \li Description
+    \row
+        \li \c revision
+        \li The checksum of the deployed commit.
+    \row
+        \li \c osName
+        \li The name of the operating system the deployment belongs to.
+    \row
+        \li \c deploymentIndex
+        \li The position of the deployment in the boot order.
+    \row
+        \li \c deploySerial
+        \li A number that distinguishes several deployments of the same commit.
+    \row
+        \li \c isPinned
+        \li Whether the deployment is pinned, that is excluded from the
+            automatic cleanup.
+    \row
+        \li \c isBooted
+        \li Whether the deployment is currently running.
+    \row
+        \li \c isDefault
+        \li Whether the deployment is started on the next boot.
+    \row
+        \li \c isRollback
+        \li Whether the deployment is the target of the next rollback.
+    \row
+        \li \c metadata
+        \li The metadata of the commit in JSON format. The metadata is loaded
+            in the background when the row is first accessed, the role holds an
+            empty string until then.
+    \row
+        \li \c diskUsage
+        \li The disk space in bytes used only by this deployment, or \c -1
+            when it was not measured, see QOtaClient::measureDiskUsage().
+    \endtable
+
+    When the deployments change, for example after an update, the model inserts,
+    removes and moves only the affected rows.
+//! [deployment-model-description]
+*/
+
+/*!
+    \enum QOtaDeploymentModel::Roles
+
+    This enum type specifies the roles of the model.
+
+    \value RevisionRole The checksum of the deployed commit.
+    \value OsNameRole The name of the operating system.
+    \value DeploymentIndexRole The position of the deployment in the boot order.
+    \value DeploySerialRole A number that distinguishes deployments of the same commit.
+    \value PinnedRole Whether the deployment is pinned.
+    \value BootedRole Whether the deployment is currently running.
+    \value DefaultRole Whether the deployment is started on the next boot.
+    \value RollbackRole Whether the deployment is the target of the next rollback.
+    \value MetadataRole The metadata of the commit in JSON format, loaded on demand.
+    \value DiskUsageRole The disk space in bytes used only by this deployment.
+*/
+
+/*!
+    \qmlproperty int OtaDeploymentModel::count
+    \readonly
+
+    Holds the number of deployments.
+*/
+
+/*!
+    \property QOtaDeploymentModel::count
+
+    Holds the number of deployments.
+*/
+
+/*!
+    \fn void QOtaDeploymentModel::countChanged()
+
+    This signal is emitted when the value of \l count changes.
+*/
+
+QOtaDeploymentModel::QOtaDeploymentModel(QObject *parent) :
+    QAbstractListModel(parent),
+    d_ptr(new QOtaDeploymentModelPrivate(this))
+{
+}
+
+QOtaDeploymentModel::~QOtaDeploymentModel()
+{
+    delete d_ptr;
+}
+
+/*!
+    \reimp
+*/
+int QOtaDeploymentModel::rowCount(const QModelIndex &parent) const
+{
+    Q_D(const QOtaDeploymentModel);
+    return parent.isValid() ? 0 : d->m_deployments.size();
+}
+
+/*!
+    \reimp
+*/
+QVariant QOtaDeploymentModel::data(const QModelIndex &index, int role) const
+{
+    Q_D(const QOtaDeploymentModel);
+    if (!index.isValid() || index.row() >= d->m_deployments.size())
+        return QVariant();
+
+    const QOtaDeployment &deployment = d->m_deployments.at(index.row());
+    switch (role) {
+    case Qt::DisplayRole:
+    case RevisionRole:
+        return deployment.rev;
+    case OsNameRole:
+        return deployment.osName;
+    case DeploymentIndexRole:
+        return deployment.index;
+    case DeploySerialRole:
+        return deployment.deploySerial;
+    case PinnedRole:
+        return deployment.pinned;
+    case BootedRole:
+        return deployment.booted;
+    case DefaultRole:
+        return deployment.isDefault;
+    case RollbackRole:
+        return deployment.rollback;
+    case DiskUsageRole:
+        return deployment.diskUsage;
+    case MetadataRole: {
+        QString *metadata = d->m_metadataCache.object(deployment.rev);
+        if (metadata)
+            return *metadata;
+        d->requestMetadata(deployment.rev);
+        return QString();
+    }
+    }
+    return QVariant();
+}
+
+/*!
+    \reimp
+*/
+QHash<int, QByteArray> QOtaDeploymentModel::roleNames() const
+{
+    QHash<int, QByteArray> roles;
+    roles[RevisionRole] = "revision";
+    roles[OsNameRole] = "osName";
+    roles[DeploymentIndexRole] = "deploymentIndex";
+    roles[DeploySerialRole] = "deploySerial";
+    roles[PinnedRole] = "isPinned";
+    roles[BootedRole] = "isBooted";
+    roles[DefaultRole] = "isDefault";
+    roles[RollbackRole] = "isRollback";
+    roles[MetadataRole] = "metadata";
+    roles[DiskUsageRole] = "diskUsage";
+    return roles;
+}
+
+QT_END_NAMESPACE
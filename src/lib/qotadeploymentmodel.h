@@ -0,0 +1,79 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the Qt OTA Update module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:GPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 or (at your option) any later version
+** approved by the KDE Free Qt Foundation. The licenses are as published by
+** the Free Software Foundation and appearing in the file LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+#ifndef QOTADEPLOYMENTMODEL_H
+#define QOTADEPLOYMENTMODEL_H
+
+#include <QtCore/QAbstractListModel>
+
+QT_BEGIN_NAMESPACE
+
+class QOtaDeploymentModelPrivate;
+class QOtaClient;
+class QOtaClientPrivate;
+
+class Q_DECL_EXPORT QOtaDeploymentModel : public QAbstractListModel
+{
+    Q_OBJECT
+    Q_PROPERTY(int count READ rowCount NOTIFY countChanged)
+public:
+    enum Roles {
+        RevisionRole = Qt::UserRole + 1,
+        OsNameRole,
+        DeploymentIndexRole,
+        DeploySerialRole,
+        PinnedRole,
+        BootedRole,
+        DefaultRole,
+        RollbackRole,
+        MetadataRole,
+        DiskUsageRole
+    };
+    Q_ENUM(Roles)
+
+    ~QOtaDeploymentModel();
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const Q_DECL_OVERRIDE;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const Q_DECL_OVERRIDE;
+    QHash<int, QByteArray> roleNames() const Q_DECL_OVERRIDE;
+
+Q_SIGNALS:
+    void countChanged();
+
+private:
+    explicit QOtaDeploymentModel(QObject *parent = nullptr);
+    Q_DISABLE_COPY(QOtaDeploymentModel)
+    Q_DECLARE_PRIVATE(QOtaDeploymentModel)
+    QOtaDeploymentModelPrivate *const d_ptr;
+    friend class QOtaClient;
+class QOtaClientPrivate;
+};
+
+QT_END_NAMESPACE
+
+#endif // QOTADEPLOYMENTMODEL_H
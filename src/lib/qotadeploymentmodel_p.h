@@ -0,0 +1,98 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the Qt OTA Update module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:GPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 or (at your option) any later version
+** approved by the KDE Free Qt Foundation. The licenses are as published by
+** the Free Software Foundation and appearing in the file LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+#ifndef QOTADEPLOYMENTMODEL_P_H
+#define QOTADEPLOYMENTMODEL_P_H
+
+#include <QtCore/QCache>
+#include <QtCore/QMetaType>
+#include <QtCore/QObject>
+#include <QtCore/QSet>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+
+QT_BEGIN_NAMESPACE
+
+class QOtaClientAsync;
+class QOtaDeploymentModel;
+
+struct QOtaDeployment
+{
+    QOtaDeployment() :
+        index(-1), deploySerial(0), pinned(false), booted(false), isDefault(false), rollback(false), diskUsage(-1) {}
+
+    bool isSameDeployment(const QOtaDeployment &other) const
+    {
+        return rev == other.rev && osName == other.osName && deploySerial == other.deploySerial;
+    }
+    bool operator==(const QOtaDeployment &other) const
+    {
+        return isSameDeployment(other) && index == other.index && pinned == other.pinned &&
+               booted == other.booted && isDefault == other.isDefault && rollback == other.rollback &&
+               diskUsage == other.diskUsage;
+    }
+    bool operator!=(const QOtaDeployment &other) const { return !(*this == other); }
+
+    QString rev;
+    QString osName;
+    int index;
+    int deploySerial;
+    bool pinned;
+    bool booted;
+    bool isDefault;
+    bool rollback;
+    qint64 diskUsage;
+};
+
+class QOtaDeploymentModelPrivate : public QObject
+{
+    Q_OBJECT
+    Q_DECLARE_PUBLIC(QOtaDeploymentModel)
+public:
+    QOtaDeploymentModelPrivate(QOtaDeploymentModel *model);
+    virtual ~QOtaDeploymentModelPrivate();
+
+    void setDeployments(const QVector<QOtaDeployment> &newDeployments);
+    void cacheMetadata(const QString &rev, const QString &metadata);
+    void metadataLoaded(const QString &rev, const QString &metadata, bool ok);
+    void requestMetadata(const QString &rev) const;
+
+    // members
+    QOtaDeploymentModel *const q_ptr;
+    QOtaClientAsync *m_otaAsync;
+    QVector<QOtaDeployment> m_deployments;
+    mutable QCache<QString, QString> m_metadataCache;
+    mutable QSet<QString> m_pendingMetadata;
+};
+
+QT_END_NAMESPACE
+
+Q_DECLARE_METATYPE(QOtaDeployment)
+Q_DECLARE_METATYPE(QVector<QOtaDeployment>)
+
+#endif // QOTADEPLOYMENTMODEL_P_H
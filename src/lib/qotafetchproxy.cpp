@@ -0,0 +1,896 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the Qt OTA Update module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:GPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 or (at your option) any later version
+** approved by the KDE Free Qt Foundation. The licenses are as published by
+** the Free Software Foundation and appearing in the file LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+#include "qotafetchproxy_p.h"
+#include "qotaclient_p.h"
+#include "qotapeerserver_p.h"
+
+#include <QtCore/QEventLoop>
+#include <QtCore/QThread>
+#include <QtCore/QTimer>
+#include <QtNetwork/QHostAddress>
+#include <QtNetwork/QNetworkAccessManager>
+#include <QtNetwork/QNetworkReply>
+#include <QtNetwork/QNetworkRequest>
+#include <QtNetwork/QTcpServer>
+#include <QtNetwork/QTcpSocket>
+
+#include <algorithm>
+#include <limits>
+
+QT_BEGIN_NAMESPACE
+
+static const int maxRequestHeadSize = 64 * 1024;
+static const int readBufferSize = 64 * 1024;
+static const qint64 maxPendingWrite = 256 * 1024;
+static const int defaultProbeTimeout = 5000;
+static const int maxConsecutiveFailures = 3;
+static const qint64 typicalObjectSize = 64 * 1024;
+
+bool QOtaFetchSettings::inDownloadWindow(const QDateTime &time) const
+{
+    if (downloadWindows.isEmpty())
+        return true;
+
+    QTime t = time.time();
+    for (const QPair<QTime, QTime> &window : downloadWindows) {
+        if (window.first < window.second) {
+            if (t >= window.first && t < window.second)
+                return true;
+        } else if (t >= window.first || t < window.second) { // crosses midnight
+            return true;
+        }
+    }
+    return false;
+}
+
+QDateTime QOtaFetchSettings::nextDownloadWindow(const QDateTime &time) const
+{
+    if (inDownloadWindow(time))
+        return time;
+
+    QDateTime next;
+    for (const QPair<QTime, QTime> &window : downloadWindows) {
+        QDateTime start(time.date(), window.first);
+        if (start <= time)
+            start = start.addDays(1);
+        if (!next.isValid() || start < next)
+            next = start;
+    }
+    return next;
+}
+
+bool QOtaFetchSettings::parseDownloadWindows(const QStringList &windows, QVector<QPair<QTime, QTime> > *parsed)
+{
+    parsed->clear();
+    for (const QString &window : windows) {
+        QStringList times = window.split(QLatin1Char('-'));
+        if (times.size() != 2)
+            return false;
+        QTime start = QTime::fromString(times.at(0).trimmed(), QStringLiteral("HH:mm"));
+        QTime end = QTime::fromString(times.at(1).trimmed(), QStringLiteral("HH:mm"));
+        if (!start.isValid() || !end.isValid() || start == end)
+            return false;
+        parsed->append(qMakePair(start, end));
+    }
+    return true;
+}
+
+QOtaTokenBucket::QOtaTokenBucket() :
+    m_rate(0),
+    m_capacity(0),
+    m_tokens(0),
+    m_lastRefill(0)
+{
+}
+
+void QOtaTokenBucket::setRate(qint64 bytesPerSecond)
+{
+    m_rate = bytesPerSecond;
+    // Allow bursts of up to 250 ms worth of data, which keeps the
+    // shaped rate smooth while not requiring too many timer wakeups.
+    m_capacity = qMax(m_rate / 4, Q_INT64_C(16 * 1024));
+    m_tokens = qMin(m_tokens, m_capacity);
+    m_refillTimer.start();
+    m_lastRefill = 0;
+}
+
+qint64 QOtaTokenBucket::available()
+{
+    if (m_rate <= 0)
+        return std::numeric_limits<qint64>::max();
+
+    qint64 now = m_refillTimer.nsecsElapsed();
+    if (now - m_lastRefill >= 1000000000) {
+        // idle for a second or more, the bucket is full
+        m_tokens = m_capacity;
+        m_lastRefill = now;
+    } else {
+        qint64 refill = (now - m_lastRefill) * m_rate / 1000000000;
+        if (refill > 0) {
+            m_tokens = qMin(m_capacity, m_tokens + refill);
+            // Advance only by the time that was converted into tokens, so that
+            // frequent polling does not lose the remainder.
+            m_lastRefill += refill * 1000000000 / m_rate;
+        }
+    }
+    return m_tokens;
+}
+
+void QOtaTokenBucket::consume(qint64 bytes)
+{
+    if (m_rate > 0)
+        m_tokens -= bytes;
+}
+
+int QOtaTokenBucket::msecsUntilAvailable() const
+{
+    if (m_rate <= 0 || m_tokens > 0)
+        return 0;
+    // Wait for a reasonable amount of tokens, not for a single byte.
+    qint64 wanted = qMin(m_capacity, Q_INT64_C(4096)) - m_tokens;
+    return qMax(1, int(wanted * 1000 / m_rate));
+}
+
+QOtaFetchConnection::QOtaFetchConnection(QTcpSocket *client, QOtaFetchProxy *proxy) :
+    QObject(client),
+    m_proxy(proxy),
+    m_client(client),
+    m_reply(nullptr),
+    m_tunnel(nullptr),
+    m_tunnelPort(0),
+    m_busy(false),
+    m_holdsSlot(false),
+    m_headSent(false),
+    m_hasBody(true),
+    m_closeAfterResponse(false),
+    m_pumpScheduled(false),
+    m_resuming(false),
+    m_timedOut(false),
+    m_bodySent(0),
+    m_attempt(0),
+    m_mirror(0),
+    m_mirrorsTried(0),
+    m_mirrorReceived(0)
+{
+    m_timeout.setSingleShot(true);
+    connect(&m_timeout, &QTimer::timeout, this, &QOtaFetchConnection::timeout);
+    connect(m_client, &QTcpSocket::readyRead, this, &QOtaFetchConnection::readClient);
+    connect(m_client, &QTcpSocket::bytesWritten, this, &QOtaFetchConnection::pump);
+    connect(m_client, &QTcpSocket::disconnected, this, &QOtaFetchConnection::close);
+}
+
+void QOtaFetchConnection::readClient()
+{
+    if (m_tunnel) {
+        // client to server direction of a tunnel, not shaped
+        m_tunnel->write(m_client->readAll());
+        return;
+    }
+    m_in.append(m_client->readAll());
+    if (!m_busy)
+        processRequest();
+}
+
+void QOtaFetchConnection::processRequest()
+{
+    int headEnd = m_in.indexOf("\r\n\r\n");
+    if (headEnd == -1) {
+        if (m_in.size() > maxRequestHeadSize) {
+            m_closeAfterResponse = true;
+            sendError(400, "Bad Request");
+        }
+        return;
+    }
+
+    QList<QByteArray> lines = m_in.left(headEnd).split('\n');
+    m_in.remove(0, headEnd + 4);
+    QList<QByteArray> requestLine = lines.takeFirst().trimmed().split(' ');
+    if (requestLine.size() != 3) {
+        m_closeAfterResponse = true;
+        sendError(400, "Bad Request");
+        return;
+    }
+
+    static const char *const hopByHop[] = {
+        "Connection", "Proxy-Connection", "Keep-Alive", "Proxy-Authorization",
+        "TE", "Trailer", "Transfer-Encoding", "Upgrade", "Host", "Accept-Encoding"
+    };
+
+    const QByteArray method = requestLine.at(0);
+    m_closeAfterResponse = requestLine.at(2) == "HTTP/1.0";
+    m_request = QNetworkRequest();
+    for (const QByteArray &line : qAsConst(lines)) {
+        int colon = line.indexOf(':');
+        if (colon <= 0)
+            continue;
+        QByteArray name = line.left(colon).trimmed();
+        QByteArray value = line.mid(colon + 1).trimmed();
+        if (qstricmp(name.constData(), "Connection") == 0 || qstricmp(name.constData(), "Proxy-Connection") == 0)
+            m_closeAfterResponse = value.toLower() == "close";
+        bool skip = false;
+        for (const char *header : hopByHop)
+            skip |= qstricmp(name.constData(), header) == 0;
+        if (!skip)
+            m_request.setRawHeader(name, value);
+    }
+    // Transfer the data as is, the throughput is accounted in transferred bytes.
+    m_request.setRawHeader("Accept-Encoding", "identity");
+
+    if (!m_proxy->inDownloadWindow()) {
+        sendError(503, "Outside Of The Download Window");
+        return;
+    }
+
+    if (method == "CONNECT") {
+        const QByteArray authority = requestLine.at(1);
+        int colon = authority.lastIndexOf(':');
+        m_tunnelHost = QString::fromLatin1(authority.left(colon));
+        m_tunnelPort = authority.mid(colon + 1).toUShort();
+        if (colon <= 0 || m_tunnelPort == 0 || !m_proxy->isAllowedHost(m_tunnelHost)) {
+            m_closeAfterResponse = true;
+            sendError(403, "Forbidden");
+            return;
+        }
+    } else if (method == "GET" || method == "HEAD") {
+        QUrl url(QString::fromLatin1(requestLine.at(1)));
+        if (url.scheme() != QLatin1String("http") || !m_proxy->isAllowedHost(url.host())) {
+            sendError(403, "Forbidden");
+            return;
+        }
+        m_request.setUrl(url);
+    } else {
+        sendError(405, "Method Not Allowed");
+        return;
+    }
+
+    m_method = method;
+    m_busy = true;
+    m_headSent = false;
+    m_hasBody = method == "GET";
+    m_bodySent = 0;
+    m_attempt = 0;
+    m_mirror = m_proxy->preferredMirror();
+    m_mirrorsTried = 1;
+    if (m_proxy->acquireSlot(this))
+        start();
+}
+
+// Starts the current request once it holds one of the proxy's request slots.
+void QOtaFetchConnection::start()
+{
+    m_holdsSlot = true;
+    if (m_method == "CONNECT")
+        startTunnel();
+    else
+        startReply();
+}
+
+void QOtaFetchConnection::startTunnel()
+{
+    m_tunnel = new QTcpSocket(this);
+    m_tunnel->setReadBufferSize(readBufferSize);
+    connect(m_tunnel, &QTcpSocket::connected, this, [this]() {
+        m_client->write("HTTP/1.1 200 Connection Established\r\n\r\n");
+        m_headSent = true;
+        if (!m_in.isEmpty())
+            m_tunnel->write(m_in);
+        m_in.clear();
+    });
+    connect(m_tunnel, &QTcpSocket::readyRead, this, &QOtaFetchConnection::pump);
+    connect(m_tunnel, &QTcpSocket::disconnected, this, &QOtaFetchConnection::pump);
+    connect(m_tunnel, static_cast<void (QTcpSocket::*)(QAbstractSocket::SocketError)>(&QTcpSocket::error),
+            this, [this]() {
+        if (m_headSent) {
+            pump();
+        } else if (!retry()) {
+            m_closeAfterResponse = true;
+            sendError(502, "Bad Gateway");
+        }
+    });
+    restartTimeout();
+    // The tunnel is opened to the selected mirror, the TLS session is between
+    // the fetcher and the mirror.
+    const QUrl mirror = m_proxy->mirrorBaseUrl(m_mirror);
+    m_mirrorReceived = 0;
+    m_mirrorTimer.start();
+    m_tunnel->connectToHost(mirror.host(), mirror.port(m_tunnelPort));
+}
+
+void QOtaFetchConnection::startReply()
+{
+    QNetworkRequest request(m_request);
+    request.setUrl(m_proxy->mirrorUrl(m_mirror, m_request.url()));
+    m_resuming = m_bodySent > 0;
+    if (m_resuming)
+        request.setRawHeader("Range", "bytes=" + QByteArray::number(m_bodySent) + '-');
+    // A retry is a new request, with a new counter.
+    const QByteArray authorization = m_proxy->peerAuthorization(m_method, request.url().path());
+    if (!authorization.isEmpty())
+        request.setRawHeader(peerAuthorizationHeader, authorization);
+
+    m_timedOut = false;
+    m_reply = m_method == "HEAD" ? m_proxy->networkAccessManager()->head(request)
+                                 : m_proxy->networkAccessManager()->get(request);
+    m_reply->setParent(this);
+    m_reply->setReadBufferSize(readBufferSize);
+    m_mirrorReceived = 0;
+    m_mirrorTimer.start();
+    connect(m_reply, &QNetworkReply::metaDataChanged, this, &QOtaFetchConnection::pump);
+    connect(m_reply, &QNetworkReply::readyRead, this, &QOtaFetchConnection::pump);
+    connect(m_reply, &QNetworkReply::finished, this, &QOtaFetchConnection::pump);
+    restartTimeout();
+}
+
+void QOtaFetchConnection::restartTimeout()
+{
+    int seconds = m_proxy->tuning().connectionTimeout;
+    if (seconds > 0)
+        m_timeout.start(seconds * 1000);
+}
+
+void QOtaFetchConnection::timeout()
+{
+    qCDebug(qota) << "fetch timed out:" << (m_reply ? m_reply->url().toString() : m_tunnelHost);
+    m_timedOut = true;
+    if (m_reply)
+        m_reply->abort(); // finishes the reply, see pump()
+    else if (m_tunnel && (m_headSent || !retry()))
+        close();
+}
+
+// A failed request can be retried as long as nothing was sent to the client, or,
+// for bodies, when the transfer can be resumed with a range request. The other
+// mirrors are tried first, then the retries start over from the preferred mirror.
+bool QOtaFetchConnection::retry()
+{
+    m_proxy->recordFailure(m_mirror);
+    if (m_headSent && (!m_hasBody || m_request.hasRawHeader("Range")))
+        return false;
+
+    if (m_mirrorsTried < m_proxy->mirrorCount()) {
+        ++m_mirrorsTried;
+        m_mirror = (m_mirror + 1) % m_proxy->mirrorCount();
+    } else if (m_attempt < m_proxy->tuning().retryCount) {
+        ++m_attempt;
+        m_mirrorsTried = 1;
+        m_mirror = m_proxy->preferredMirror();
+    } else {
+        return false;
+    }
+
+    qCDebug(qota) << "retrying" << m_request.url() << "on" << m_proxy->mirrorBaseUrl(m_mirror)
+                  << "attempt" << m_attempt << "from byte" << m_bodySent;
+    if (m_reply) {
+        m_reply->disconnect(this);
+        m_reply->deleteLater();
+        m_reply = nullptr;
+        startReply();
+    } else {
+        m_tunnel->disconnect(this);
+        m_tunnel->abort();
+        m_tunnel->deleteLater();
+        m_tunnel = nullptr;
+        startTunnel();
+    }
+    return true;
+}
+
+void QOtaFetchConnection::sendHead()
+{
+    int code = m_reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (code == 204 || code == 304 || (code >= 100 && code < 200))
+        m_hasBody = false;
+
+    QByteArray head = "HTTP/1.1 " + QByteArray::number(code) + ' '
+            + m_reply->attribute(QNetworkRequest::HttpReasonPhraseAttribute).toByteArray() + "\r\n";
+    for (const QNetworkReply::RawHeaderPair &header : m_reply->rawHeaderPairs()) {
+        const char *name = header.first.constData();
+        if (qstricmp(name, "Connection") == 0 || qstricmp(name, "Keep-Alive") == 0
+                || qstricmp(name, "Transfer-Encoding") == 0
+                || (m_hasBody && qstricmp(name, "Content-Length") == 0))
+            continue;
+        head += header.first + ": " + header.second + "\r\n";
+    }
+    if (m_hasBody)
+        head += "Transfer-Encoding: chunked\r\n";
+    if (m_closeAfterResponse)
+        head += "Connection: close\r\n";
+    head += "\r\n";
+    m_client->write(head);
+    m_headSent = true;
+}
+
+void QOtaFetchConnection::sendError(int status, const QByteArray &reason)
+{
+    QByteArray body = reason + '\n';
+    m_client->write("HTTP/1.1 " + QByteArray::number(status) + ' ' + reason + "\r\n"
+                    "Content-Type: text/plain\r\n"
+                    "Content-Length: " + QByteArray::number(body.size()) + "\r\n"
+                    + (m_closeAfterResponse ? "Connection: close\r\n" : "") + "\r\n" + body);
+    m_headSent = true;
+    m_hasBody = false;
+    finishResponse();
+}
+
+void QOtaFetchConnection::schedulePump(int msecs)
+{
+    if (m_pumpScheduled)
+        return;
+    m_pumpScheduled = true;
+    QTimer::singleShot(msecs, this, [this]() {
+        m_pumpScheduled = false;
+        pump();
+    });
+}
+
+// Moves data from the server to the client, shaped by the shared token bucket.
+void QOtaFetchConnection::pump()
+{
+    QIODevice *source = m_reply ? static_cast<QIODevice *>(m_reply) : m_tunnel;
+    if (!source)
+        return;
+    restartTimeout();
+
+    if (m_reply) {
+        QVariant status = m_reply->attribute(QNetworkRequest::HttpStatusCodeAttribute);
+        bool failed = m_reply->isFinished() && (m_reply->error() > QNetworkReply::NoError
+                                                && m_reply->error() < QNetworkReply::ContentAccessDenied);
+        if (status.isValid() && status.toInt() >= 500 && !m_headSent) {
+            // server errors (such as an overloaded server) are retried as well
+            failed = m_reply->isFinished();
+            if (!failed)
+                return;
+        }
+        if (failed) {
+            qCDebug(qota) << "fetch failed:" << m_reply->url() << m_reply->errorString();
+            if (retry())
+                return;
+            if (!m_headSent && status.isValid()) {
+                sendHead(); // forward the server error
+            } else if (!m_headSent) {
+                sendError(m_timedOut ? 504 : 502, m_timedOut ? "Gateway Timeout" : "Bad Gateway");
+                return;
+            } else {
+                close();
+                return;
+            }
+        }
+        if (!status.isValid())
+            return;
+        if (m_resuming) {
+            if (status.toInt() != 206) {
+                qCDebug(qota) << "server does not support resuming" << m_reply->url();
+                close();
+                return;
+            }
+            m_resuming = false;
+        } else if (!m_headSent) {
+            sendHead();
+        }
+    }
+
+    QOtaTokenBucket *bucket = m_proxy->tokenBucket();
+    while (source->bytesAvailable() > 0) {
+        if (m_client->bytesToWrite() > maxPendingWrite)
+            return; // continued from bytesWritten()
+        qint64 budget = bucket->available();
+        if (budget <= 0) {
+            schedulePump(bucket->msecsUntilAvailable());
+            return;
+        }
+        QByteArray data = source->read(qMin(budget, qint64(readBufferSize)));
+        bucket->consume(data.size());
+        m_proxy->addReceived(data.size());
+        m_mirrorReceived += data.size();
+        if (m_tunnel) {
+            m_client->write(data);
+        } else if (m_hasBody) {
+            m_bodySent += data.size();
+            m_client->write(QByteArray::number(data.size(), 16) + "\r\n");
+            m_client->write(data);
+            m_client->write("\r\n");
+        }
+    }
+
+    if (m_tunnel) {
+        if (m_tunnel->state() == QAbstractSocket::UnconnectedState)
+            close();
+    } else if (m_reply->isFinished()) {
+        if (m_hasBody)
+            m_client->write("0\r\n\r\n");
+        recordTransfer();
+        m_reply->deleteLater();
+        m_reply = nullptr;
+        finishResponse();
+    }
+}
+
+void QOtaFetchConnection::recordTransfer()
+{
+    m_proxy->recordTransfer(m_mirror, m_mirrorReceived, m_mirrorTimer.elapsed());
+    m_mirrorReceived = 0;
+}
+
+void QOtaFetchConnection::releaseSlot()
+{
+    m_timeout.stop();
+    if (m_holdsSlot) {
+        m_holdsSlot = false;
+        m_proxy->releaseSlot();
+    }
+}
+
+void QOtaFetchConnection::finishResponse()
+{
+    releaseSlot();
+    m_busy = false;
+    if (m_closeAfterResponse) {
+        close();
+        return;
+    }
+    if (!m_in.isEmpty())
+        QTimer::singleShot(0, this, [this]() { if (!m_busy) processRequest(); });
+}
+
+void QOtaFetchConnection::close()
+{
+    releaseSlot();
+    if (m_reply) {
+        m_reply->disconnect(this);
+        m_reply->abort();
+        m_reply->deleteLater();
+        m_reply = nullptr;
+    }
+    if (m_tunnel) {
+        if (m_headSent)
+            recordTransfer();
+        m_tunnel->disconnect(this);
+        m_tunnel->abort();
+        m_tunnel->deleteLater();
+        m_tunnel = nullptr;
+    }
+    if (m_client->state() != QAbstractSocket::UnconnectedState)
+        m_client->disconnectFromHost();
+    m_client->deleteLater();
+}
+
+QOtaFetchProxy::QOtaFetchProxy() :
+    m_thread(new QThread()),
+    m_server(nullptr),
+    m_manager(nullptr),
+    m_peerCounter(0),
+    m_activeRequests(0),
+    m_enforceDownloadWindows(true),
+    m_bytesReceived(0)
+{
+    m_thread->start();
+    moveToThread(m_thread);
+}
+
+QOtaFetchProxy::~QOtaFetchProxy()
+{
+    m_thread->quit();
+    if (!m_thread->wait(4000))
+        qCWarning(qota) << "Timed out waiting for the fetch proxy thread to exit.";
+    delete m_server;
+    delete m_manager;
+    delete m_thread;
+}
+
+void QOtaFetchProxy::setSettings(const QOtaFetchSettings &settings)
+{
+    QMutexLocker locker(&m_settingsMutex);
+    m_settings = settings;
+}
+
+QOtaFetchSettings QOtaFetchProxy::settings() const
+{
+    QMutexLocker locker(&m_settingsMutex);
+    return m_settings;
+}
+
+void QOtaFetchProxy::setTuning(const QOtaFetchTuning &tuning)
+{
+    QMutexLocker locker(&m_settingsMutex);
+    m_tuning = tuning;
+}
+
+QOtaFetchTuning QOtaFetchProxy::tuning() const
+{
+    QMutexLocker locker(&m_settingsMutex);
+    return m_tuning;
+}
+
+void QOtaFetchProxy::setPeerAuthentication(const QByteArray &key, const QByteArray &challenge)
+{
+    QMutexLocker locker(&m_settingsMutex);
+    m_peerKey = key;
+    m_peerChallenge = challenge;
+    m_peerCounter = 0;
+}
+
+QByteArray QOtaFetchProxy::peerAuthorization(const QByteArray &method, const QString &path)
+{
+    QMutexLocker locker(&m_settingsMutex);
+    if (m_peerKey.isEmpty())
+        return QByteArray();
+    return QOtaPeerServer::authorization(m_peerKey, m_peerChallenge, m_peerCounter++, method, path);
+}
+
+bool QOtaFetchProxy::isNeeded() const
+{
+    QMutexLocker locker(&m_settingsMutex);
+    return m_settings.bandwidthLimit > 0 || !m_settings.downloadWindows.isEmpty() || m_tuning.isSet();
+}
+
+// Limits the number of concurrent upstream requests (or tunnels). Connections
+// that exceed the limit wait in a queue and are started in order.
+bool QOtaFetchProxy::acquireSlot(QOtaFetchConnection *connection)
+{
+    int maxRequests = tuning().maxConcurrentRequests;
+    if (maxRequests > 0 && m_activeRequests >= maxRequests) {
+        m_waitingRequests.append(connection);
+        return false;
+    }
+    ++m_activeRequests;
+    return true;
+}
+
+void QOtaFetchProxy::releaseSlot()
+{
+    --m_activeRequests;
+    while (!m_waitingRequests.isEmpty()) {
+        QPointer<QOtaFetchConnection> next = m_waitingRequests.takeFirst();
+        if (next) {
+            ++m_activeRequests;
+            next->start();
+            return;
+        }
+    }
+}
+
+QVector<QOtaMirrorStats> QOtaFetchProxy::mirrorStatistics() const
+{
+    QMutexLocker locker(&m_statsMutex);
+    return m_mirrors;
+}
+
+int QOtaFetchProxy::preferredMirror() const
+{
+    for (int i = 0; i < m_mirrors.size(); ++i) {
+        if (m_mirrors.at(i).consecutiveFailures < maxConsecutiveFailures)
+            return i;
+    }
+    return 0;
+}
+
+QUrl QOtaFetchProxy::mirrorBaseUrl(int mirror) const
+{
+    return m_mirrors.at(mirror).url;
+}
+
+// Maps a URL of the remote to the same file on a mirror.
+QUrl QOtaFetchProxy::mirrorUrl(int mirror, const QUrl &url) const
+{
+    const QUrl &base = m_mirrors.at(mirror).url;
+    if (base == m_remoteUrl)
+        return url;
+
+    const QString remotePath = m_remoteUrl.path();
+    const QString path = url.path();
+    if (!path.startsWith(remotePath) || (path.length() > remotePath.length() && path.at(remotePath.length()) != QLatin1Char('/')))
+        return url;
+
+    QUrl mapped(base);
+    mapped.setPath(base.path() + path.mid(remotePath.length()));
+    mapped.setQuery(url.query());
+    return mapped;
+}
+
+void QOtaFetchProxy::recordTransfer(int mirror, qint64 bytes, qint64 msecs)
+{
+    QMutexLocker locker(&m_statsMutex);
+    QOtaMirrorStats &stats = m_mirrors[mirror];
+    stats.bytes += bytes;
+    stats.msecs += msecs;
+    ++stats.requests;
+    stats.consecutiveFailures = 0;
+}
+
+void QOtaFetchProxy::recordFailure(int mirror)
+{
+    QMutexLocker locker(&m_statsMutex);
+    QOtaMirrorStats &stats = m_mirrors[mirror];
+    ++stats.requests;
+    ++stats.failures;
+    ++stats.consecutiveFailures;
+}
+
+// The expected time for fetching a typical object from a mirror.
+static qint64 mirrorScore(const QOtaMirrorStats &mirror)
+{
+    if (mirror.rtt < 0)
+        return std::numeric_limits<qint64>::max();
+    qint64 throughput = mirror.throughput();
+    return mirror.rtt + (throughput > 0 ? typicalObjectSize * 1000 / throughput : 0);
+}
+
+// The remote is always the first mirror. Statistics of earlier pulls are kept, so that
+// the measured throughput contributes to the order of the mirrors.
+void QOtaFetchProxy::updateMirrors(const QUrl &remoteUrl)
+{
+    const QUrl remote = remoteUrl.adjusted(QUrl::StripTrailingSlash);
+    QStringList urls = tuning().mirrors;
+    urls.prepend(remote.toString());
+
+    QVector<QOtaMirrorStats> mirrors;
+    for (const QString &mirrorUrl : qAsConst(urls)) {
+        QUrl url = QUrl(mirrorUrl.trimmed()).adjusted(QUrl::StripTrailingSlash);
+        if (url != remote && (!url.isValid() || url.host().isEmpty() || url.scheme() != remote.scheme())) {
+            qCWarning(qota) << "Ignoring mirror" << mirrorUrl << "- the URL scheme must match the remote";
+            continue;
+        }
+        auto isSame = [&url](const QOtaMirrorStats &mirror) { return mirror.url == url; };
+        if (std::any_of(mirrors.cbegin(), mirrors.cend(), isSame))
+            continue;
+        auto previous = std::find_if(m_mirrors.cbegin(), m_mirrors.cend(), isSame);
+        QOtaMirrorStats stats = previous != m_mirrors.cend() ? *previous : QOtaMirrorStats();
+        stats.url = url;
+        mirrors.append(stats);
+    }
+
+    QMutexLocker locker(&m_statsMutex);
+    m_remoteUrl = remote;
+    m_mirrors = mirrors;
+}
+
+// A HEAD request of the summary file costs about one round trip on top of the
+// connection setup, the same as fetching a small object.
+void QOtaFetchProxy::probeMirrors()
+{
+    if (m_mirrors.size() < 2)
+        return;
+
+    QEventLoop loop;
+    QElapsedTimer timer;
+    QVector<QNetworkReply *> replies;
+    QVector<qint64> rtts(m_mirrors.size(), -1);
+    int pending = m_mirrors.size();
+    timer.start();
+    for (int i = 0; i < m_mirrors.size(); ++i) {
+        QNetworkRequest request(QUrl(m_mirrors.at(i).url.toString() + QLatin1String("/summary")));
+        QNetworkReply *reply = m_manager->head(request);
+        connect(reply, &QNetworkReply::finished, &loop, [&, i, reply]() {
+            // any HTTP response means that the mirror is reachable
+            if (reply->error() == QNetworkReply::NoError || reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).isValid())
+                rtts[i] = timer.elapsed();
+            if (--pending == 0)
+                loop.quit();
+        });
+        replies.append(reply);
+    }
+    int timeout = tuning().connectionTimeout;
+    QTimer::singleShot(timeout > 0 ? timeout * 1000 : defaultProbeTimeout, &loop, &QEventLoop::quit);
+    loop.exec();
+    for (QNetworkReply *reply : qAsConst(replies)) {
+        reply->disconnect(&loop);
+        reply->abort();
+        reply->deleteLater();
+    }
+
+    QMutexLocker locker(&m_statsMutex);
+    for (int i = 0; i < m_mirrors.size(); ++i) {
+        m_mirrors[i].rtt = rtts.at(i);
+        m_mirrors[i].consecutiveFailures = 0;
+    }
+    std::stable_sort(m_mirrors.begin(), m_mirrors.end(), [](const QOtaMirrorStats &a, const QOtaMirrorStats &b) {
+        return mirrorScore(a) < mirrorScore(b);
+    });
+    for (const QOtaMirrorStats &mirror : qAsConst(m_mirrors))
+        qCDebug(qota) << "mirror" << mirror.url << "rtt" << mirror.rtt << "ms, throughput" << mirror.throughput() << "bytes/s";
+}
+
+bool QOtaFetchProxy::inDownloadWindow() const
+{
+    if (!m_enforceDownloadWindows)
+        return true;
+    QMutexLocker locker(&m_settingsMutex);
+    return m_settings.inDownloadWindow(QDateTime::currentDateTime());
+}
+
+bool QOtaFetchProxy::isAllowedHost(const QString &host) const
+{
+    return m_allowedHosts.contains(host.toLower());
+}
+
+QString QOtaFetchProxy::start(const QUrl &remoteUrl, bool enforceDownloadWindows)
+{
+    QString proxyUrl;
+    QMetaObject::invokeMethod(this, "_start", Qt::BlockingQueuedConnection,
+                              Q_RETURN_ARG(QString, proxyUrl), Q_ARG(QUrl, remoteUrl),
+                              Q_ARG(bool, enforceDownloadWindows));
+    return proxyUrl;
+}
+
+QString QOtaFetchProxy::stop()
+{
+    QString report;
+    QMetaObject::invokeMethod(this, "_stop", Qt::BlockingQueuedConnection,
+                              Q_RETURN_ARG(QString, report));
+    return report;
+}
+
+QString QOtaFetchProxy::_start(const QUrl &remoteUrl, bool enforceDownloadWindows)
+{
+    if (!m_manager)
+        m_manager = new QNetworkAccessManager();
+    if (!m_server) {
+        m_server = new QTcpServer();
+        connect(m_server, &QTcpServer::newConnection, this, &QOtaFetchProxy::newConnection);
+    }
+    // Only the loopback interface and only the hosts of the repository, so
+    // that the proxy can not be used by other processes to reach the network.
+    if (!m_server->isListening() && !m_server->listen(QHostAddress::LocalHost)) {
+        qCWarning(qota) << "Failed to start the fetch proxy:" << m_server->errorString();
+        return QString();
+    }
+
+    m_allowedHosts.clear();
+    m_allowedHosts.insert(remoteUrl.host().toLower());
+    m_enforceDownloadWindows = enforceDownloadWindows;
+    updateMirrors(remoteUrl);
+    probeMirrors();
+    m_tokenBucket.setRate(settings().bandwidthLimit);
+    m_bytesReceived = 0;
+    m_transferTimer.start();
+    return QString(QStringLiteral("http://127.0.0.1:%1")).arg(m_server->serverPort());
+}
+
+QString QOtaFetchProxy::_stop()
+{
+    if (m_server)
+        m_server->close();
+    m_allowedHosts.clear();
+    m_waitingRequests.clear();
+
+    qint64 elapsed = qMax(Q_INT64_C(1), m_transferTimer.elapsed());
+    qint64 throughput = m_bytesReceived * 1000 / elapsed;
+    qCDebug(qota) << "fetched" << m_bytesReceived << "bytes in" << elapsed << "ms,"
+                  << throughput << "bytes/s, limit" << settings().bandwidthLimit << "bytes/s";
+    return QString(QStringLiteral("Downloaded %1 KiB in %2 s (%3 KiB/s)"))
+            .arg(m_bytesReceived / 1024).arg(elapsed / 1000.0, 0, 'f', 1).arg(throughput / 1024);
+}
+
+void QOtaFetchProxy::newConnection()
+{
+    while (QTcpSocket *client = m_server->nextPendingConnection())
+        new QOtaFetchConnection(client, this);
+}
+
+QT_END_NAMESPACE
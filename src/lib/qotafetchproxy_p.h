@@ -0,0 +1,246 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the Qt OTA Update module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:GPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 or (at your option) any later version
+** approved by the KDE Free Qt Foundation. The licenses are as published by
+** the Free Software Foundation and appearing in the file LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+#ifndef QOTAFETCHPROXY_P_H
+#define QOTAFETCHPROXY_P_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QDateTime>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QMutex>
+#include <QtCore/QObject>
+#include <QtCore/QPair>
+#include <QtCore/QPointer>
+#include <QtCore/QSet>
+#include <QtCore/QStringList>
+#include <QtCore/QTime>
+#include <QtCore/QTimer>
+#include <QtCore/QUrl>
+#include <QtCore/QVector>
+#include <QtNetwork/QNetworkRequest>
+
+QT_BEGIN_NAMESPACE
+
+class QNetworkAccessManager;
+class QNetworkReply;
+class QOtaFetchProxy;
+class QTcpServer;
+class QTcpSocket;
+class QThread;
+
+struct QOtaFetchSettings
+{
+    QOtaFetchSettings() : bandwidthLimit(0) {}
+
+    bool inDownloadWindow(const QDateTime &time) const;
+    QDateTime nextDownloadWindow(const QDateTime &time) const;
+    static bool parseDownloadWindows(const QStringList &windows, QVector<QPair<QTime, QTime> > *parsed);
+
+    qint64 bandwidthLimit; // bytes per second, 0 for no limit
+    QVector<QPair<QTime, QTime> > downloadWindows;
+};
+
+// from the repository configuration, 0 means the libostree default
+struct QOtaFetchTuning
+{
+    QOtaFetchTuning() : maxConcurrentRequests(0), connectionTimeout(0), retryCount(0) {}
+
+    bool isSet() const
+    {
+        return maxConcurrentRequests > 0 || connectionTimeout > 0 || retryCount > 0 || !mirrors.isEmpty();
+    }
+
+    int maxConcurrentRequests;
+    int connectionTimeout; // seconds
+    int retryCount;
+    QStringList mirrors;
+};
+
+struct QOtaMirrorStats
+{
+    QOtaMirrorStats() : rtt(-1), bytes(0), msecs(0), requests(0), failures(0), consecutiveFailures(0) {}
+
+    qint64 throughput() const { return msecs > 0 ? bytes * 1000 / msecs : 0; }
+
+    QUrl url;
+    qint64 rtt; // msecs, -1 when the mirror did not respond to the probe
+    qint64 bytes;
+    qint64 msecs;
+    int requests;
+    int failures;
+    int consecutiveFailures;
+};
+
+class QOtaTokenBucket
+{
+public:
+    QOtaTokenBucket();
+
+    void setRate(qint64 bytesPerSecond);
+    qint64 available();
+    void consume(qint64 bytes);
+    int msecsUntilAvailable() const;
+
+private:
+    qint64 m_rate;
+    qint64 m_capacity;
+    qint64 m_tokens;
+    qint64 m_lastRefill;
+    QElapsedTimer m_refillTimer;
+};
+
+// Handles one client connection of the ostree fetcher. Requests are served one
+// at a time, the fetcher does not pipeline requests on a connection.
+class QOtaFetchConnection : public QObject
+{
+public:
+    QOtaFetchConnection(QTcpSocket *client, QOtaFetchProxy *proxy);
+
+    void start();
+
+private:
+    void readClient();
+    void processRequest();
+    void startTunnel();
+    void startReply();
+    void restartTimeout();
+    void timeout();
+    bool retry();
+    void sendHead();
+    void sendError(int status, const QByteArray &reason);
+    void pump();
+    void schedulePump(int msecs);
+    void releaseSlot();
+    void finishResponse();
+    void close();
+    void recordTransfer();
+
+    QOtaFetchProxy *m_proxy;
+    QTcpSocket *m_client;
+    QByteArray m_in;
+    QTimer m_timeout;
+
+    // current request
+    QByteArray m_method;
+    QNetworkRequest m_request;
+    QNetworkReply *m_reply;
+    QTcpSocket *m_tunnel;
+    QString m_tunnelHost;
+    quint16 m_tunnelPort;
+    bool m_busy;
+    bool m_holdsSlot;
+    bool m_headSent;
+    bool m_hasBody;
+    bool m_closeAfterResponse;
+    bool m_pumpScheduled;
+    bool m_resuming;
+    bool m_timedOut;
+    qint64 m_bodySent;
+    int m_attempt;
+    int m_mirror;
+    int m_mirrorsTried;
+    qint64 m_mirrorReceived;
+    QElapsedTimer m_mirrorTimer;
+};
+
+// A local HTTP proxy for the 'ostree pull' processes. The fetcher in libostree
+// has no rate limiting, so the transfers are shaped here instead. Plain http
+// requests are forwarded one by one, https remotes are tunneled (CONNECT).
+// The requests of a pull from a peer are authorized here as well, the fetcher
+// can not add headers.
+class Q_DECL_EXPORT QOtaFetchProxy : public QObject
+{
+    Q_OBJECT
+public:
+    QOtaFetchProxy();
+    virtual ~QOtaFetchProxy();
+
+    // thread-safe
+    void setSettings(const QOtaFetchSettings &settings);
+    QOtaFetchSettings settings() const;
+    void setTuning(const QOtaFetchTuning &tuning);
+    QOtaFetchTuning tuning() const;
+    bool isNeeded() const;
+    QVector<QOtaMirrorStats> mirrorStatistics() const;
+    // The requests are authorized for a peer, see QOtaPeerServer.
+    void setPeerAuthentication(const QByteArray &key, const QByteArray &challenge);
+
+    // Called from the worker thread, blocks until the proxy thread has handled the call.
+    QString start(const QUrl &remoteUrl, bool enforceDownloadWindows);
+    QString stop();
+
+    // used by the proxy thread
+    QOtaTokenBucket *tokenBucket() { return &m_tokenBucket; }
+    QNetworkAccessManager *networkAccessManager() const { return m_manager; }
+    bool isAllowedHost(const QString &host) const;
+    bool inDownloadWindow() const;
+    void addReceived(qint64 bytes) { m_bytesReceived += bytes; }
+    bool acquireSlot(QOtaFetchConnection *connection);
+    void releaseSlot();
+    int mirrorCount() const { return m_mirrors.size(); }
+    int preferredMirror() const;
+    QUrl mirrorBaseUrl(int mirror) const;
+    QUrl mirrorUrl(int mirror, const QUrl &url) const;
+    void recordTransfer(int mirror, qint64 bytes, qint64 msecs);
+    void recordFailure(int mirror);
+    QByteArray peerAuthorization(const QByteArray &method, const QString &path);
+
+protected:
+    Q_INVOKABLE QString _start(const QUrl &remoteUrl, bool enforceDownloadWindows);
+    Q_INVOKABLE QString _stop();
+    void newConnection();
+    void updateMirrors(const QUrl &remoteUrl);
+    void probeMirrors();
+
+private:
+    QThread *m_thread;
+    QTcpServer *m_server;
+    QNetworkAccessManager *m_manager;
+    mutable QMutex m_settingsMutex;
+    QOtaFetchSettings m_settings;
+    QOtaFetchTuning m_tuning;
+    QByteArray m_peerKey;
+    QByteArray m_peerChallenge;
+    quint64 m_peerCounter;
+    int m_activeRequests;
+    QList<QPointer<QOtaFetchConnection> > m_waitingRequests;
+    QOtaTokenBucket m_tokenBucket;
+    QSet<QString> m_allowedHosts;
+    bool m_enforceDownloadWindows;
+    QUrl m_remoteUrl;
+    mutable QMutex m_statsMutex;
+    QVector<QOtaMirrorStats> m_mirrors; // ordered by preference
+    QElapsedTimer m_transferTimer;
+    qint64 m_bytesReceived;
+};
+
+QT_END_NAMESPACE
+
+Q_DECLARE_METATYPE(QOtaFetchSettings)
+
+#endif // QOTAFETCHPROXY_P_H
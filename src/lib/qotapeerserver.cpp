@@ -0,0 +1,687 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the Qt OTA Update module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:GPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 or (at your option) any later version
+** approved by the KDE Free Qt Foundation. The licenses are as published by
+** the Free Software Foundation and appearing in the file LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+#include "ostree-1/ostree.h"
+#include "glib-2.0/glib.h"
+
+#include "qotapeerserver_p.h"
+#include "qotaclient_p.h"
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QMessageAuthenticationCode>
+#include <QtCore/QRegularExpression>
+#include <QtCore/QThread>
+#include <QtCore/QUrl>
+#include <QtCore/QtEndian>
+#include <QtNetwork/QHostAddress>
+#include <QtNetwork/QHostInfo>
+#include <QtNetwork/QNetworkInterface>
+#include <QtNetwork/QTcpServer>
+#include <QtNetwork/QTcpSocket>
+#include <QtNetwork/QUdpSocket>
+
+#include <algorithm>
+
+QT_BEGIN_NAMESPACE
+
+static const int maxRequestHeadSize = 8 * 1024;
+static const int chunkSize = 64 * 1024;
+static const qint64 maxPendingWrite = 256 * 1024;
+static const char discoveryRequest[] = "qt-ota-peer-discovery";
+static const char discoveryResponse[] = "qt-ota-peer";
+static const int nonceSize = 16;
+// A challenge expires when no request used it for this long.
+static const qint64 challengeLifetime = 10 * 60 * 1000;
+static const int maxChallenges = 256;
+// 'ostree pull' checks the mode of the remote repository.
+static const char remoteConfig[] = "[core]\nrepo_version=1\nmode=archive-z2\n";
+// Files of the system that hold credentials of the device, directories include
+// everything below them. Their content objects are never shared.
+static const char *const privatePaths[] = {
+    "/usr/etc/shadow",
+    "/usr/etc/gshadow",
+    "/usr/etc/ssh",
+    "/usr/share/ostree/certs"
+};
+
+static void addFileChecksums(GFile *file, QSet<QByteArray> *checksums)
+{
+    GFileType type = g_file_query_file_type(file, G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, nullptr);
+    if (type == G_FILE_TYPE_UNKNOWN)
+        return; // not in this commit
+    if (type != G_FILE_TYPE_DIRECTORY) {
+        checksums->insert(ostree_repo_file_get_checksum(OSTREE_REPO_FILE(file)));
+        return;
+    }
+
+    g_autoptr(GFileEnumerator) children = g_file_enumerate_children(file, "standard::name",
+            G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, nullptr, nullptr);
+    GFileInfo *info = nullptr;
+    GFile *child = nullptr;
+    while (children && g_file_enumerator_iterate(children, &info, &child, nullptr, nullptr) && info)
+        addFileChecksums(child, checksums);
+}
+
+// Adds the content objects of the private files of a commit. A partially pulled
+// commit adds the files that are already in the repository.
+static void addPrivateObjects(OstreeRepo *repo, const char *commit, QSet<QByteArray> *objects)
+{
+    g_autoptr(GFile) root = nullptr;
+    if (!ostree_repo_read_commit(repo, commit, &root, nullptr, nullptr, nullptr))
+        return;
+    for (const char *path : privatePaths) {
+        g_autoptr(GFile) file = g_file_resolve_relative_path(root, path);
+        addFileChecksums(file, objects);
+    }
+}
+
+// A random value in hex, empty when the system has no source of random numbers.
+static QByteArray randomNonce()
+{
+    QFile random(QStringLiteral("/dev/urandom"));
+    if (!random.open(QFile::ReadOnly))
+        return QByteArray();
+    QByteArray nonce = random.read(nonceSize);
+    return nonce.size() == nonceSize ? nonce.toHex() : QByteArray();
+}
+
+static QByteArray mac(const QByteArray &key, const QByteArray &message)
+{
+    return QMessageAuthenticationCode::hash(message, key, QCryptographicHash::Sha256).toHex();
+}
+
+// Takes the same time for all values of the same size.
+static bool equalMacs(const QByteArray &a, const QByteArray &b)
+{
+    if (a.size() != b.size())
+        return false;
+    char difference = 0;
+    for (int i = 0; i < a.size(); ++i)
+        difference |= a.at(i) ^ b.at(i);
+    return difference == 0;
+}
+
+static QByteArray responseMac(const QByteArray &key, const QByteArray &nonce, const QByteArray &port,
+                              const QByteArray &challenge)
+{
+    return mac(key, "response " + nonce + ' ' + port + ' ' + challenge);
+}
+
+QOtaPeerConnection::QOtaPeerConnection(QTcpSocket *client, QOtaPeerServer *server) :
+    QObject(client),
+    m_client(client),
+    m_server(server),
+    m_stream(nullptr),
+    m_busy(false),
+    m_closeAfterResponse(false)
+{
+    connect(m_client, &QTcpSocket::readyRead, this, &QOtaPeerConnection::readClient);
+    connect(m_client, &QTcpSocket::bytesWritten, this, &QOtaPeerConnection::pump);
+    connect(m_client, &QTcpSocket::disconnected, m_client, &QObject::deleteLater);
+}
+
+QOtaPeerConnection::~QOtaPeerConnection()
+{
+    closeStream();
+}
+
+void QOtaPeerConnection::readClient()
+{
+    m_in.append(m_client->readAll());
+    if (!m_busy)
+        processRequest();
+}
+
+void QOtaPeerConnection::processRequest()
+{
+    int headEnd = m_in.indexOf("\r\n\r\n");
+    if (headEnd == -1) {
+        if (m_in.size() > maxRequestHeadSize) {
+            m_closeAfterResponse = true;
+            sendError(400, "Bad Request");
+        }
+        return;
+    }
+
+    QList<QByteArray> lines = m_in.left(headEnd).split('\n');
+    m_in.remove(0, headEnd + 4);
+    QList<QByteArray> requestLine = lines.takeFirst().trimmed().split(' ');
+    if (requestLine.size() != 3) {
+        m_closeAfterResponse = true;
+        sendError(400, "Bad Request");
+        return;
+    }
+    m_closeAfterResponse = requestLine.at(2) == "HTTP/1.0";
+    QByteArray authorization;
+    for (const QByteArray &line : qAsConst(lines)) {
+        int colon = line.indexOf(':');
+        if (colon <= 0)
+            continue;
+        const QByteArray name = line.left(colon).trimmed();
+        if (qstricmp(name.constData(), "Connection") == 0)
+            m_closeAfterResponse = line.mid(colon + 1).trimmed().toLower() == "close";
+        else if (qstricmp(name.constData(), peerAuthorizationHeader) == 0)
+            authorization = line.mid(colon + 1).trimmed();
+    }
+
+    const QByteArray method = requestLine.at(0);
+    if (method != "GET" && method != "HEAD") {
+        sendError(405, "Method Not Allowed");
+        return;
+    }
+
+    // Only the objects are shared, refs and the configuration of the repository are not.
+    // Requests that are not authorized get the same answer as for a missing object.
+    static const QRegularExpression objectPath(QStringLiteral(
+            "^/objects/([0-9a-f]{2})/([0-9a-f]{62})\\.(filez|commit|commitmeta|dirtree|dirmeta)$"));
+    const QString path = QUrl(QString::fromLatin1(requestLine.at(1))).path();
+    if (!m_server->isAuthorized(method, path, authorization)) {
+        sendError(404, "Not Found");
+        return;
+    }
+    QRegularExpressionMatch match = objectPath.match(path);
+    if (path == QLatin1String("/config")) {
+        m_prefix = remoteConfig;
+    } else if (!match.hasMatch() || !openObject(match.captured(1) + match.captured(2), match.captured(3))) {
+        sendError(404, "Not Found");
+        return;
+    }
+
+    m_busy = true;
+    sendHead(200, "OK");
+    if (method == "HEAD") {
+        closeStream();
+        finishResponse();
+        return;
+    }
+    pump();
+}
+
+bool QOtaPeerConnection::openObject(const QString &checksum, const QString &objectType)
+{
+    GError *error = nullptr;
+    const QByteArray object = checksum.toLatin1();
+    OstreeRepo *repo = m_server->repository();
+    if (objectType == QLatin1String("commit")) {
+        // A commit that is not deployed yet may have no ref, its files are added when
+        // a peer starts to pull it.
+        addPrivateObjects(repo, object.constData(), m_server->privateObjects());
+    } else if (objectType == QLatin1String("filez") && m_server->privateObjects()->contains(object)) {
+        qCWarning(qota) << "Refused to share the private object" << checksum << "with"
+                        << m_client->peerAddress().toString();
+        return false;
+    }
+
+    if (objectType != QLatin1String("filez")) {
+        // Metadata objects are stored the same way in all repository modes.
+        const QString objectPath = repoPath + QStringLiteral("/objects/%1/%2.%3")
+                .arg(checksum.left(2), checksum.mid(2), objectType);
+        g_autoptr(GFile) file = g_file_new_for_path(objectPath.toLocal8Bit().constData());
+        m_stream = (GInputStream *)g_file_read(file, nullptr, &error);
+        if (!m_stream) {
+            g_error_free(error);
+            return false;
+        }
+        return true;
+    }
+
+    GInputStream *content = nullptr;
+    GFileInfo *info = nullptr;
+    GVariant *xattrs = nullptr;
+    if (!ostree_repo_load_file(repo, object.constData(), &content, &info, &xattrs, nullptr, &error)) {
+        g_error_free(error);
+        return false;
+    }
+
+    // The header of an archive-z2 content object, followed by the raw deflate
+    // compressed file content (regular files only).
+    bool regular = g_file_info_get_file_type(info) == G_FILE_TYPE_REGULAR;
+    const char *symlinkTarget = regular ? "" : g_file_info_get_symlink_target(info);
+    GVariant *header = g_variant_ref_sink(g_variant_new("(tuuuus@a(ayay))",
+            GUINT64_TO_BE(regular ? g_file_info_get_size(info) : 0),
+            GUINT32_TO_BE(g_file_info_get_attribute_uint32(info, "unix::uid")),
+            GUINT32_TO_BE(g_file_info_get_attribute_uint32(info, "unix::gid")),
+            GUINT32_TO_BE(g_file_info_get_attribute_uint32(info, "unix::mode")),
+            GUINT32_TO_BE(0),
+            symlinkTarget ? symlinkTarget : "",
+            xattrs ? xattrs : g_variant_new_array(G_VARIANT_TYPE("(ayay)"), nullptr, 0)));
+    quint32 headerSize = qToBigEndian(quint32(g_variant_get_size(header)));
+    m_prefix.append(reinterpret_cast<const char *>(&headerSize), sizeof(headerSize));
+    m_prefix.append(4, '\0'); // alignment
+    m_prefix.append(static_cast<const char *>(g_variant_get_data(header)), int(g_variant_get_size(header)));
+    g_variant_unref(header);
+
+    if (regular && content) {
+        // The lowest compression level keeps the CPU usage of the serving device low.
+        GConverter *compressor = G_CONVERTER(g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_RAW, 1));
+        m_stream = g_converter_input_stream_new(content, compressor);
+        g_object_unref(compressor);
+    }
+    if (content)
+        g_object_unref(content);
+    if (xattrs)
+        g_variant_unref(xattrs);
+    g_object_unref(info);
+    return true;
+}
+
+void QOtaPeerConnection::sendHead(int status, const QByteArray &reason)
+{
+    m_client->write("HTTP/1.1 " + QByteArray::number(status) + ' ' + reason + "\r\n"
+                    "Content-Type: application/octet-stream\r\n"
+                    "Transfer-Encoding: chunked\r\n"
+                    + (m_closeAfterResponse ? "Connection: close\r\n" : "") + "\r\n");
+}
+
+void QOtaPeerConnection::sendError(int status, const QByteArray &reason)
+{
+    QByteArray body = reason + '\n';
+    m_client->write("HTTP/1.1 " + QByteArray::number(status) + ' ' + reason + "\r\n"
+                    "Content-Type: text/plain\r\n"
+                    "Content-Length: " + QByteArray::number(body.size()) + "\r\n"
+                    + (m_closeAfterResponse ? "Connection: close\r\n" : "") + "\r\n" + body);
+    finishResponse();
+}
+
+void QOtaPeerConnection::pump()
+{
+    if (!m_busy)
+        return;
+
+    while (m_client->bytesToWrite() < maxPendingWrite) {
+        QByteArray data;
+        if (!m_prefix.isEmpty()) {
+            data.swap(m_prefix);
+        } else if (m_stream) {
+            GError *error = nullptr;
+            data.resize(chunkSize);
+            gssize read = g_input_stream_read(m_stream, data.data(), chunkSize, nullptr, &error);
+            if (read < 0) {
+                qCWarning(qota) << "Failed to read a shared object:" << error->message;
+                g_error_free(error);
+                // the response is incomplete, the client must not use it
+                closeStream();
+                m_client->abort();
+                return;
+            }
+            data.resize(int(read));
+            if (read == 0)
+                closeStream();
+        } else {
+            m_client->write("0\r\n\r\n");
+            finishResponse();
+            return;
+        }
+        if (!data.isEmpty()) {
+            m_client->write(QByteArray::number(data.size(), 16) + "\r\n");
+            m_client->write(data);
+            m_client->write("\r\n");
+        }
+    }
+}
+
+void QOtaPeerConnection::finishResponse()
+{
+    m_busy = false;
+    if (m_closeAfterResponse) {
+        m_client->disconnectFromHost();
+        return;
+    }
+    if (!m_in.isEmpty())
+        processRequest();
+}
+
+void QOtaPeerConnection::closeStream()
+{
+    if (m_stream) {
+        g_object_unref(m_stream);
+        m_stream = nullptr;
+    }
+    m_prefix.clear();
+}
+
+QOtaPeerServer::QOtaPeerServer() :
+    m_thread(new QThread()),
+    m_server(nullptr),
+    m_discovery(nullptr),
+    m_repo(nullptr)
+{
+    m_clock.start();
+    m_thread->start();
+    moveToThread(m_thread);
+}
+
+QOtaPeerServer::~QOtaPeerServer()
+{
+    m_thread->quit();
+    if (!m_thread->wait(4000))
+        qCWarning(qota) << "Timed out waiting for the peer server thread to exit.";
+    _stop();
+    delete m_thread;
+}
+
+void QOtaPeerServer::start(const QOtaPeerSettings &settings)
+{
+    QMetaObject::invokeMethod(this, "_start", Qt::QueuedConnection, Q_ARG(quint16, settings.port),
+                              Q_ARG(QString, settings.interfaceName),
+                              Q_ARG(QByteArray, peerKey(settings.secret)));
+}
+
+void QOtaPeerServer::stop()
+{
+    QMetaObject::invokeMethod(this, "_stop", Qt::QueuedConnection);
+}
+
+// Neither the secret nor the key are sent over the network, only MACs made with the key.
+QByteArray QOtaPeerServer::peerKey(const QString &secret)
+{
+    return QMessageAuthenticationCode::hash("qt-ota-peer key", secret.toUtf8(), QCryptographicHash::Sha256);
+}
+
+QByteArray QOtaPeerServer::authorization(const QByteArray &key, const QByteArray &challenge, quint64 counter,
+                                         const QByteArray &method, const QString &path)
+{
+    const QByteArray prefix = challenge + ' ' + QByteArray::number(counter);
+    return prefix + ' ' + mac(key, "request " + prefix + ' ' + method + ' ' + path.toUtf8());
+}
+
+// A request is authorized by a MAC over the request, the challenge that the server
+// issued and a counter, which must not have been used with the challenge before.
+bool QOtaPeerServer::isAuthorized(const QByteArray &method, const QString &path, const QByteArray &authorization)
+{
+    const QList<QByteArray> fields = authorization.split(' ');
+    if (fields.size() != 3)
+        return false;
+    auto challenge = m_challenges.find(fields.at(0));
+    if (challenge == m_challenges.end() || challenge->expiry < m_clock.elapsed())
+        return false;
+    bool ok = false;
+    quint64 counter = fields.at(1).toULongLong(&ok);
+    if (!ok || challenge->counters.contains(counter)
+            || !equalMacs(fields.at(2), mac(m_key, "request " + fields.at(0) + ' ' + fields.at(1) + ' '
+                                                   + method + ' ' + path.toUtf8()))) {
+        return false;
+    }
+    challenge->counters.insert(counter);
+    challenge->expiry = m_clock.elapsed() + challengeLifetime;
+    return true;
+}
+
+void QOtaPeerServer::_start(quint16 port, const QString &interfaceName, const QByteArray &key)
+{
+    if (m_server && m_server->serverPort() == port && m_interfaceName == interfaceName && m_key == key) {
+        emit started(true, interfaceName, port);
+        return;
+    }
+    _stop();
+    m_key = key;
+    bool success = listen(port, interfaceName);
+    if (!success)
+        _stop();
+    emit started(success, interfaceName, port);
+}
+
+bool QOtaPeerServer::listen(quint16 port, const QString &interfaceName)
+{
+    // Objects are served only on the addresses of an explicitly configured interface,
+    // not on the interfaces that face the internet.
+    const QList<QNetworkAddressEntry> entries = QNetworkInterface::interfaceFromName(interfaceName).addressEntries();
+    for (const QNetworkAddressEntry &entry : entries) {
+        if (entry.ip().protocol() == QAbstractSocket::IPv4Protocol) {
+            m_address = entry;
+            break;
+        }
+    }
+    if (m_address.ip().isNull()) {
+        qCWarning(qota) << "No IPv4 address to share the repository on" << interfaceName;
+        return false;
+    }
+    m_interfaceName = interfaceName;
+
+    GError *error = nullptr;
+    g_autoptr(GFile) path = g_file_new_for_path(repoPath.toLocal8Bit().constData());
+    m_repo = ostree_repo_new(path);
+    if (!ostree_repo_open(m_repo, nullptr, &error)) {
+        qCWarning(qota) << "Failed to open the repository for sharing:" << error->message;
+        g_error_free(error);
+        return false;
+    }
+    updatePrivateObjects();
+
+    m_server = new QTcpServer();
+    connect(m_server, &QTcpServer::newConnection, this, &QOtaPeerServer::newConnection);
+    if (!m_server->listen(m_address.ip(), port)) {
+        qCWarning(qota) << "Failed to share the repository:" << m_server->errorString();
+        return false;
+    }
+
+    // Peers get their challenges from the discovery responses, configured peers as well.
+    // Broadcasts are received only on a socket that is bound to any address, requests
+    // from outside of the subnet of the interface are ignored.
+    m_discovery = new QUdpSocket();
+    connect(m_discovery, &QUdpSocket::readyRead, this, &QOtaPeerServer::readDiscoveryRequests);
+    if (!m_discovery->bind(QHostAddress::AnyIPv4, port, QUdpSocket::ShareAddress)) {
+        qCWarning(qota) << "Failed to answer peer discovery:" << m_discovery->errorString();
+        return false;
+    }
+    return true;
+}
+
+void QOtaPeerServer::_stop()
+{
+    // the connections are children of the server
+    delete m_server;
+    m_server = nullptr;
+    delete m_discovery;
+    m_discovery = nullptr;
+    if (m_repo) {
+        g_object_unref(m_repo);
+        m_repo = nullptr;
+    }
+    m_interfaceName.clear();
+    m_address = QNetworkAddressEntry();
+    m_key.clear();
+    m_challenges.clear();
+    m_privateObjects.clear();
+}
+
+void QOtaPeerServer::newConnection()
+{
+    // Deployments and refs change with updates while the server runs.
+    updatePrivateObjects();
+    while (QTcpSocket *client = m_server->nextPendingConnection())
+        new QOtaPeerConnection(client, this);
+}
+
+// Collects the private objects of the deployed commits and of the commits that
+// refs point to. Pulled objects stay in the repository until they are pruned, so
+// the objects found once are kept until the server stops.
+void QOtaPeerServer::updatePrivateObjects()
+{
+    GError *error = nullptr;
+    QString path = otaSysroot();
+    g_autoptr(GFile) sysrootPath = g_file_new_for_path(path.isEmpty() ? "/" : QFile::encodeName(path).constData());
+    OstreeSysroot *sysroot = ostree_sysroot_new(sysrootPath);
+    if (ostree_sysroot_load(sysroot, nullptr, &error)) {
+        GPtrArray *deployments = ostree_sysroot_get_deployments(sysroot);
+        for (guint i = 0; i < deployments->len; ++i) {
+            OstreeDeployment *deployment = (OstreeDeployment *)deployments->pdata[i];
+            addPrivateObjects(m_repo, ostree_deployment_get_csum(deployment), &m_privateObjects);
+        }
+        g_ptr_array_unref(deployments);
+    } else {
+        qCWarning(qota) << "Failed to load the deployments:" << error->message;
+        g_clear_error(&error);
+    }
+    g_object_unref(sysroot);
+
+    GHashTable *refs = nullptr;
+    if (!ostree_repo_list_refs(m_repo, nullptr, &refs, nullptr, &error)) {
+        qCWarning(qota) << "Failed to list the refs:" << error->message;
+        g_error_free(error);
+        return;
+    }
+    GHashTableIter iter;
+    gpointer commit = nullptr;
+    g_hash_table_iter_init(&iter, refs);
+    while (g_hash_table_iter_next(&iter, nullptr, &commit))
+        addPrivateObjects(m_repo, static_cast<const char *>(commit), &m_privateObjects);
+    g_hash_table_unref(refs);
+}
+
+// Answers "qt-ota-peer-discovery <nonce>" with "qt-ota-peer <port> <challenge> <MAC>".
+void QOtaPeerServer::readDiscoveryRequests()
+{
+    while (m_discovery->hasPendingDatagrams()) {
+        QByteArray datagram(int(m_discovery->pendingDatagramSize()), Qt::Uninitialized);
+        QHostAddress sender;
+        quint16 senderPort = 0;
+        m_discovery->readDatagram(datagram.data(), datagram.size(), &sender, &senderPort);
+        const QList<QByteArray> fields = datagram.split(' ');
+        if (fields.size() != 2 || fields.at(0) != discoveryRequest || fields.at(1).size() != 2 * nonceSize
+                || !sender.isInSubnet(m_address.ip(), m_address.prefixLength())) {
+            continue;
+        }
+        const QByteArray challenge = issueChallenge();
+        if (challenge.isEmpty())
+            continue;
+        const QByteArray port = QByteArray::number(m_server->serverPort());
+        m_discovery->writeDatagram(discoveryResponse + (' ' + port) + ' ' + challenge + ' '
+                                   + responseMac(m_key, fields.at(1), port, challenge), sender, senderPort);
+    }
+}
+
+// Every discovery request gets a challenge of its own. Devices that do not know the
+// secret can request challenges as well, so their number is limited: the challenge
+// that expires first makes room for a new one.
+QByteArray QOtaPeerServer::issueChallenge()
+{
+    const qint64 now = m_clock.elapsed();
+    for (auto it = m_challenges.begin(); it != m_challenges.end(); ) {
+        if (it->expiry < now)
+            it = m_challenges.erase(it);
+        else
+            ++it;
+    }
+    if (m_challenges.size() >= maxChallenges) {
+        auto first = std::min_element(m_challenges.begin(), m_challenges.end(),
+                                      [](const Challenge &a, const Challenge &b) { return a.expiry < b.expiry; });
+        m_challenges.erase(first);
+    }
+
+    const QByteArray challenge = randomNonce();
+    if (challenge.isEmpty()) {
+        qCWarning(qota) << "No random numbers for the peer discovery";
+        return challenge;
+    }
+    Challenge &entry = m_challenges[challenge];
+    entry.expiry = now + challengeLifetime;
+    return challenge;
+}
+
+QVector<QOtaPeer> QOtaPeerServer::discoverPeers(const QOtaPeerSettings &settings, int msecs)
+{
+    QVector<QOtaPeer> peers;
+    const QByteArray key = peerKey(settings.secret);
+    const QByteArray nonce = randomNonce();
+    QUdpSocket socket;
+    if (nonce.isEmpty() || !socket.bind(QHostAddress::AnyIPv4, 0)) {
+        qCWarning(qota) << "Peer discovery failed:" << (nonce.isEmpty() ? QStringLiteral("no random numbers")
+                                                                        : socket.errorString());
+        return peers;
+    }
+
+    // Configured peers are asked directly, for networks that filter broadcasts.
+    const QByteArray request = discoveryRequest + (' ' + nonce);
+    QList<QHostAddress> configuredPeers;
+    for (const QString &peer : settings.peers) {
+        QUrl url(QStringLiteral("http://") + peer.trimmed());
+        if (url.host().isEmpty())
+            continue;
+        QHostAddress address(url.host());
+        if (address.isNull()) {
+            const QList<QHostAddress> addresses = QHostInfo::fromName(url.host()).addresses();
+            for (const QHostAddress &candidate : addresses) {
+                if (candidate.protocol() == QAbstractSocket::IPv4Protocol) {
+                    address = candidate;
+                    break;
+                }
+            }
+        }
+        if (address.isNull())
+            continue;
+        configuredPeers.append(address);
+        socket.writeDatagram(request, address, quint16(url.port(settings.port)));
+    }
+    socket.writeDatagram(request, QHostAddress::Broadcast, settings.port);
+
+    // Only the peers that know the secret can answer with a valid MAC.
+    const QList<QHostAddress> ownAddresses = QNetworkInterface::allAddresses();
+    int configuredFound = 0;
+    QElapsedTimer timer;
+    timer.start();
+    while (timer.elapsed() < msecs && socket.waitForReadyRead(msecs - int(timer.elapsed()))) {
+        while (socket.hasPendingDatagrams()) {
+            QByteArray datagram(int(socket.pendingDatagramSize()), Qt::Uninitialized);
+            QHostAddress sender;
+            socket.readDatagram(datagram.data(), datagram.size(), &sender);
+            const QList<QByteArray> fields = datagram.split(' ');
+            if (fields.size() != 4 || fields.at(0) != discoveryResponse
+                    || !equalMacs(fields.at(3), responseMac(key, nonce, fields.at(1), fields.at(2)))) {
+                continue;
+            }
+            quint16 port = fields.at(1).toUShort();
+            bool isOwnServer = !settings.interfaceName.isEmpty() && port == settings.port
+                    && ownAddresses.contains(sender);
+            if (port == 0 || isOwnServer)
+                continue;
+
+            QOtaPeer peer;
+            QUrl url;
+            url.setScheme(QStringLiteral("http"));
+            url.setHost(sender.toString());
+            url.setPort(port);
+            peer.url = url.toString();
+            peer.challenge = fields.at(2);
+            auto isSame = [&peer](const QOtaPeer &other) { return other.url == peer.url; };
+            if (std::any_of(peers.cbegin(), peers.cend(), isSame))
+                continue;
+            // Configured peers are tried first.
+            if (configuredPeers.contains(sender))
+                peers.insert(configuredFound++, peer);
+            else
+                peers.append(peer);
+        }
+    }
+    for (const QOtaPeer &peer : qAsConst(peers))
+        qCDebug(qota) << "peer:" << peer.url;
+    return peers;
+}
+
+QT_END_NAMESPACE
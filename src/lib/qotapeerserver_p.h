@@ -0,0 +1,170 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the Qt OTA Update module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:GPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 or (at your option) any later version
+** approved by the KDE Free Qt Foundation. The licenses are as published by
+** the Free Software Foundation and appearing in the file LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+#ifndef QOTAPEERSERVER_P_H
+#define QOTAPEERSERVER_P_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
+#include <QtCore/QObject>
+#include <QtCore/QSet>
+#include <QtCore/QStringList>
+#include <QtCore/QVector>
+#include <QtNetwork/QNetworkAddressEntry>
+
+QT_BEGIN_NAMESPACE
+
+struct OstreeRepo;
+// from gio
+typedef struct _GInputStream GInputStream;
+
+class QOtaPeerServer;
+class QTcpServer;
+class QTcpSocket;
+class QThread;
+class QUdpSocket;
+
+static const quint16 defaultPeerPort = 8091;
+// carries the authorization of a request, see QOtaPeerServer::authorization()
+static const char peerAuthorizationHeader[] = "X-Qt-Ota-Peer";
+
+struct QOtaPeerSettings
+{
+    QOtaPeerSettings() : enabled(false), port(defaultPeerPort) {}
+
+    bool enabled;
+    quint16 port;
+    QStringList peers; // host or host:port
+    QString interfaceName; // objects are served only on this interface
+    QString secret; // shared by the devices that exchange objects
+};
+
+// A peer that proved the knowledge of the secret in its discovery response.
+struct QOtaPeer
+{
+    QString url;
+    QByteArray challenge; // authorizes the requests to the peer
+};
+
+// Serves one client of the peer server. The objects are sent in the archive-z2
+// format that 'ostree pull' expects from a remote, content objects are
+// converted from the bare repository on the fly. Only authorized requests are
+// served, and the private files are never served.
+class QOtaPeerConnection : public QObject
+{
+public:
+    QOtaPeerConnection(QTcpSocket *client, QOtaPeerServer *server);
+    virtual ~QOtaPeerConnection();
+
+private:
+    void readClient();
+    void processRequest();
+    bool openObject(const QString &checksum, const QString &objectType);
+    void sendHead(int status, const QByteArray &reason);
+    void sendError(int status, const QByteArray &reason);
+    void pump();
+    void finishResponse();
+    void closeStream();
+
+    QTcpSocket *m_client;
+    QOtaPeerServer *m_server;
+    QByteArray m_in;
+    GInputStream *m_stream;
+    QByteArray m_prefix; // sent before the stream data
+    bool m_busy;
+    bool m_closeAfterResponse;
+};
+
+// Shares the objects of the local repository read-only with the devices on the
+// subnet of one network interface that know the peer secret, and answers their
+// discovery requests.
+//
+// Neither the secret nor a value that grants access is sent over the network. A
+// discovery request carries a random nonce, a server answers with a fresh challenge
+// and a MAC of the nonce and the challenge, made with a key derived from the secret.
+// Every HTTP request to the server then carries the challenge, a counter and a MAC
+// of the request. Captured requests can not be replayed, and a device that does not
+// know the secret can neither fetch objects nor pose as a peer.
+class Q_DECL_EXPORT QOtaPeerServer : public QObject
+{
+    Q_OBJECT
+public:
+    QOtaPeerServer();
+    virtual ~QOtaPeerServer();
+
+    // Called from other threads, the server thread reports the result with started().
+    void start(const QOtaPeerSettings &settings);
+    void stop();
+
+    // Blocking, returns the peers that answered within the timeout.
+    static QVector<QOtaPeer> discoverPeers(const QOtaPeerSettings &settings, int msecs);
+    static QByteArray peerKey(const QString &secret);
+    // The value of the peerAuthorizationHeader of a request.
+    static QByteArray authorization(const QByteArray &key, const QByteArray &challenge, quint64 counter,
+                                    const QByteArray &method, const QString &path);
+
+    // used by the connections
+    OstreeRepo *repository() const { return m_repo; }
+    QSet<QByteArray> *privateObjects() { return &m_privateObjects; }
+    bool isAuthorized(const QByteArray &method, const QString &path, const QByteArray &authorization);
+
+signals:
+    void started(bool success, const QString &interfaceName, quint16 port);
+
+protected:
+    Q_INVOKABLE void _start(quint16 port, const QString &interfaceName, const QByteArray &key);
+    Q_INVOKABLE void _stop();
+    bool listen(quint16 port, const QString &interfaceName);
+    void newConnection();
+    void readDiscoveryRequests();
+    QByteArray issueChallenge();
+    void updatePrivateObjects();
+
+private:
+    struct Challenge
+    {
+        qint64 expiry;            // msecs of m_clock
+        QSet<quint64> counters;   // of the requests that were served
+    };
+
+    QThread *m_thread;
+    QTcpServer *m_server;
+    QUdpSocket *m_discovery;
+    OstreeRepo *m_repo;
+    QString m_interfaceName;
+    QNetworkAddressEntry m_address;
+    QByteArray m_key;
+    QHash<QByteArray, Challenge> m_challenges;
+    QElapsedTimer m_clock;
+    QSet<QByteArray> m_privateObjects;
+};
+
+QT_END_NAMESPACE
+
+#endif // QOTAPEERSERVER_P_H
@@ -39,6 +39,11 @@ const QString url(QStringLiteral("url="));
 const QString clientCert(QStringLiteral("tls-client-cert-path="));
 const QString clientKey(QStringLiteral("tls-client-key-path="));
 const QString ca(QStringLiteral("tls-ca-path="));
+// not used by libostree, enforced by the fetch proxy
+const QString maxRequests(QStringLiteral("qt-max-concurrent-requests="));
+const QString timeout(QStringLiteral("qt-connection-timeout="));
+const QString retries(QStringLiteral("qt-retry-count="));
+const QString mirrors(QStringLiteral("qt-mirrors="));
 // these 'bool' values by default are 'false' in QOtaRepositoryConfig
 const QString gpg(QStringLiteral("gpg-verify=true"));
 const QString tls(QStringLiteral("tls-permissive=true"));
@@ -46,7 +51,10 @@ const QString tls(QStringLiteral("tls-permissive=true"));
 QOtaRepositoryConfigPrivate::QOtaRepositoryConfigPrivate(QOtaRepositoryConfig *repo) :
     q_ptr(repo),
     m_gpgVerify(false),
-    m_tlsPermissive(false)
+    m_tlsPermissive(false),
+    m_maxConcurrentRequests(0),
+    m_connectionTimeout(0),
+    m_retryCount(0)
 {
 }
 
@@ -54,7 +62,7 @@ QOtaRepositoryConfigPrivate::~QOtaRepositoryConfigPrivate()
 {
 }
 
-QOtaRepositoryConfig *QOtaRepositoryConfigPrivate::repositoryConfigFromFile(const QString &configPath) const
+QOtaRepositoryConfig *QOtaRepositoryConfigPrivate::repositoryConfigFromFile(const QString &configPath)
 {
     if (!QDir().exists(configPath))
         return nullptr;
@@ -81,6 +89,16 @@ QOtaRepositoryConfig *QOtaRepositoryConfigPrivate::repositoryConfigFromFile(cons
             conf->setGpgVerify(true);
         else if (line.startsWith(tls))
             conf->setTlsPermissive(true);
+        // int(s)
+        else if (line.startsWith(maxRequests))
+            conf->setMaxConcurrentRequests(line.mid(maxRequests.length()).toInt());
+        else if (line.startsWith(timeout))
+            conf->setConnectionTimeout(line.mid(timeout.length()).toInt());
+        else if (line.startsWith(retries))
+            conf->setRetryCount(line.mid(retries.length()).toInt());
+        // list(s)
+        else if (line.startsWith(mirrors))
+            conf->setMirrors(line.mid(mirrors.length()).split(QLatin1Char(';'), QString::SkipEmptyParts));
     }
 
     return conf;
@@ -106,9 +124,11 @@ QOtaRepositoryConfig *QOtaRepositoryConfigPrivate::repositoryConfigFromFile(cons
     provides an API to configure the OSTree repository (located in \c {/ostree/repo}). The
     update process synchronizes the local repository with the remote repository (see \l url).
     The local repository keeps history for the current and the previous snapshot of the system.
+    Objects that belong to older snapshots are pruned after each system update or rollback.
 
     This class is used to configure TLS authentication and whether to utilize GPG for update
-    integrity verification.
+    integrity verification. It also tunes how objects are fetched from the remote repository,
+    see maxConcurrentRequests, connectionTimeout and retryCount.
 
 //! [repository-config-description]
 */
@@ -185,6 +205,54 @@ QOtaRepositoryConfig *QOtaRepositoryConfigPrivate::repositoryConfigFromFile(cons
     This signal is emitted when the value of tlsCaPath changes.
 */
 
+/*!
+    \qmlsignal OtaRepositoryConfig::maxConcurrentRequestsChanged()
+
+    This signal is emitted when the value of maxConcurrentRequests changes.
+*/
+
+/*!
+    \fn void QOtaRepositoryConfig::maxConcurrentRequestsChanged()
+
+    This signal is emitted when the value of maxConcurrentRequests changes.
+*/
+
+/*!
+    \qmlsignal OtaRepositoryConfig::connectionTimeoutChanged()
+
+    This signal is emitted when the value of connectionTimeout changes.
+*/
+
+/*!
+    \fn void QOtaRepositoryConfig::connectionTimeoutChanged()
+
+    This signal is emitted when the value of connectionTimeout changes.
+*/
+
+/*!
+    \qmlsignal OtaRepositoryConfig::retryCountChanged()
+
+    This signal is emitted when the value of retryCount changes.
+*/
+
+/*!
+    \fn void QOtaRepositoryConfig::retryCountChanged()
+
+    This signal is emitted when the value of retryCount changes.
+*/
+
+/*!
+    \qmlsignal OtaRepositoryConfig::mirrorsChanged()
+
+    This signal is emitted when the value of mirrors changes.
+*/
+
+/*!
+    \fn void QOtaRepositoryConfig::mirrorsChanged()
+
+    This signal is emitted when the value of mirrors changes.
+*/
+
 QOtaRepositoryConfig::QOtaRepositoryConfig(QObject *parent) :
     QObject(parent),
     d_ptr(new QOtaRepositoryConfigPrivate(this))
@@ -366,4 +434,142 @@ QString QOtaRepositoryConfig::tlsCaPath() const
     return d_func()->m_tlsCaPath;
 }
 
+void QOtaRepositoryConfig::setMaxConcurrentRequests(int maxRequests)
+{
+    Q_D(QOtaRepositoryConfig);
+    maxRequests = qMax(0, maxRequests);
+    if (maxRequests == d->m_maxConcurrentRequests)
+        return;
+
+    d->m_maxConcurrentRequests = maxRequests;
+    emit maxConcurrentRequestsChanged();
+}
+
+/*!
+    \qmlproperty int OtaRepositoryConfig::maxConcurrentRequests
+
+    Holds the maximum number of objects that are fetched in parallel.
+    \include qotarepositoryconfig.cpp fetch-tuning
+*/
+
+/*!
+    \property QOtaRepositoryConfig::maxConcurrentRequests
+
+    Holds the maximum number of objects that are fetched in parallel.
+//! [fetch-tuning]
+    The libostree fetcher keeps up to 8 requests in flight, so this property can only lower
+    the concurrency. This can help on links where parallel transfers hurt each other.
+
+    Default is \c 0, which means the libostree default. When any of the fetch tuning
+    properties is set, downloads are routed through a proxy on the loopback interface that
+    enforces them. The proxy keeps the connections to the server alive between requests.
+//! [fetch-tuning]
+*/
+int QOtaRepositoryConfig::maxConcurrentRequests() const
+{
+    return d_func()->m_maxConcurrentRequests;
+}
+
+void QOtaRepositoryConfig::setConnectionTimeout(int seconds)
+{
+    Q_D(QOtaRepositoryConfig);
+    seconds = qMax(0, seconds);
+    if (seconds == d->m_connectionTimeout)
+        return;
+
+    d->m_connectionTimeout = seconds;
+    emit connectionTimeoutChanged();
+}
+
+/*!
+    \qmlproperty int OtaRepositoryConfig::connectionTimeout
+
+    Holds the time in seconds after which a request that makes no progress is aborted.
+    An aborted request is retried, see retryCount. Default is \c 0, which means no timeout.
+*/
+
+/*!
+    \property QOtaRepositoryConfig::connectionTimeout
+
+    Holds the time in seconds after which a request that makes no progress is aborted.
+    An aborted request is retried, see retryCount. Default is \c 0, which means no timeout.
+*/
+int QOtaRepositoryConfig::connectionTimeout() const
+{
+    return d_func()->m_connectionTimeout;
+}
+
+void QOtaRepositoryConfig::setRetryCount(int retries)
+{
+    Q_D(QOtaRepositoryConfig);
+    retries = qMax(0, retries);
+    if (retries == d->m_retryCount)
+        return;
+
+    d->m_retryCount = retries;
+    emit retryCountChanged();
+}
+
+/*!
+    \qmlproperty int OtaRepositoryConfig::retryCount
+
+    Holds how many times a request is retried after a network error, a timeout or a
+    server error (5xx). A partially transferred object is resumed with a range request,
+    if the server supports it. Default is \c 0, which means no retries.
+*/
+
+/*!
+    \property QOtaRepositoryConfig::retryCount
+
+    Holds how many times a request is retried after a network error, a timeout or a
+    server error (5xx). A partially transferred object is resumed with a range request,
+    if the server supports it. Default is \c 0, which means no retries.
+*/
+int QOtaRepositoryConfig::retryCount() const
+{
+    return d_func()->m_retryCount;
+}
+
+void QOtaRepositoryConfig::setMirrors(const QStringList &mirrors)
+{
+    Q_D(QOtaRepositoryConfig);
+    QStringList trimmed;
+    for (const QString &mirror : mirrors) {
+        if (!mirror.trimmed().isEmpty())
+            trimmed.append(mirror.trimmed());
+    }
+    if (trimmed == d->m_mirrors)
+        return;
+
+    d->m_mirrors = trimmed;
+    emit mirrorsChanged();
+}
+
+/*!
+    \qmlproperty list<string> OtaRepositoryConfig::mirrors
+
+    \include qotarepositoryconfig.cpp mirrors
+*/
+
+/*!
+    \property QOtaRepositoryConfig::mirrors
+
+//! [mirrors]
+    Holds a list of URLs of mirrors of the repository at \l url. The mirrors must
+    use the same URL scheme as \l url. For HTTPS mirrors, the server certificate
+    must be valid for the host name of \l url.
+
+    Before each pull, the latency of the repository and of each mirror is measured
+    with a \c HEAD request of the \c summary file. The mirrors are ordered by the
+    measured latency and by the throughput of earlier pulls, and requests are sent
+    to the best one. A request that fails is retried on the next mirror, and a
+    mirror that fails repeatedly is skipped for the rest of the pull. The collected
+    statistics are available from OtaClient::mirrorStatistics().
+//! [mirrors]
+*/
+QStringList QOtaRepositoryConfig::mirrors() const
+{
+    return d_func()->m_mirrors;
+}
+
 QT_END_NAMESPACE
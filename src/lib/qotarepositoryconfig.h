@@ -31,6 +31,7 @@
 
 #include <QtCore/QObject>
 #include <QtCore/QString>
+#include <QtCore/QStringList>
 
 QT_BEGIN_NAMESPACE
 
@@ -46,6 +47,10 @@ class Q_DECL_EXPORT QOtaRepositoryConfig : public QObject
     Q_PROPERTY(QString tlsClientKeyPath READ tlsClientKeyPath WRITE setTlsClientKeyPath NOTIFY tlsClientKeyPathChanged)
     Q_PROPERTY(bool tlsPermissive READ tlsPermissive WRITE setTlsPermissive NOTIFY tlsPermissiveChanged)
     Q_PROPERTY(QString tlsCaPath READ tlsCaPath WRITE setTlsCaPath NOTIFY tlsCaPathChanged)
+    Q_PROPERTY(int maxConcurrentRequests READ maxConcurrentRequests WRITE setMaxConcurrentRequests NOTIFY maxConcurrentRequestsChanged)
+    Q_PROPERTY(int connectionTimeout READ connectionTimeout WRITE setConnectionTimeout NOTIFY connectionTimeoutChanged)
+    Q_PROPERTY(int retryCount READ retryCount WRITE setRetryCount NOTIFY retryCountChanged)
+    Q_PROPERTY(QStringList mirrors READ mirrors WRITE setMirrors NOTIFY mirrorsChanged)
 public:
     explicit QOtaRepositoryConfig(QObject *parent = nullptr);
     virtual ~QOtaRepositoryConfig();
@@ -68,6 +73,18 @@ public:
     void setTlsCaPath(const QString &caPath);
     QString tlsCaPath() const;
 
+    void setMaxConcurrentRequests(int maxRequests);
+    int maxConcurrentRequests() const;
+
+    void setConnectionTimeout(int seconds);
+    int connectionTimeout() const;
+
+    void setRetryCount(int retries);
+    int retryCount() const;
+
+    void setMirrors(const QStringList &mirrors);
+    QStringList mirrors() const;
+
 Q_SIGNALS:
     void urlChanged();
     void gpgVerifyChanged();
@@ -75,6 +92,10 @@ Q_SIGNALS:
     void tlsClientKeyPathChanged();
     void tlsPermissiveChanged();
     void tlsCaPathChanged();
+    void maxConcurrentRequestsChanged();
+    void connectionTimeoutChanged();
+    void retryCountChanged();
+    void mirrorsChanged();
 
 private:
     Q_DISABLE_COPY(QOtaRepositoryConfig)
@@ -33,12 +33,13 @@
 
 #include <QtCore/QObject>
 #include <QtCore/QString>
+#include <QtCore/QStringList>
 
 QT_BEGIN_NAMESPACE
 
 class QOtaRepositoryConfig;
 
-class QOtaRepositoryConfigPrivate : public QObject
+class Q_DECL_EXPORT QOtaRepositoryConfigPrivate : public QObject
 {
     Q_OBJECT
     Q_DECLARE_PUBLIC(QOtaRepositoryConfig)
@@ -46,7 +47,7 @@ public:
     QOtaRepositoryConfigPrivate(QOtaRepositoryConfig *repo);
     virtual ~QOtaRepositoryConfigPrivate();
 
-    QOtaRepositoryConfig *repositoryConfigFromFile(const QString &configPath) const;
+    static QOtaRepositoryConfig *repositoryConfigFromFile(const QString &configPath);
 
     // members
     QOtaRepositoryConfig *const q_ptr;
@@ -56,6 +57,10 @@ public:
     QString m_clientKeyPath;
     bool m_tlsPermissive;
     QString m_tlsCaPath;
+    int m_maxConcurrentRequests;
+    int m_connectionTimeout;
+    int m_retryCount;
+    QStringList m_mirrors;
 };
 
 QT_END_NAMESPACE
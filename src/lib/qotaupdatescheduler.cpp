@@ -0,0 +1,1035 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the Qt OTA Update module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:GPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 or (at your option) any later version
+** approved by the KDE Free Qt Foundation. The licenses are as published by
+** the Free Software Foundation and appearing in the file LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+#include "glib-2.0/glib.h"
+
+#include "qotaupdatescheduler_p.h"
+#include "qotaupdatescheduler.h"
+#include "qotaclient_p.h"
+#include "qotaclient.h"
+#include "qotarepositoryconfig.h"
+
+#include <QtCore/QFile>
+#include <QtCore/QLocale>
+#include <QtCore/QUrl>
+#include <QtNetwork/QNetworkAccessManager>
+#include <QtNetwork/QNetworkReply>
+#include <QtNetwork/QNetworkRequest>
+#ifndef QT_NO_SSL
+#include <QtNetwork/QSslConfiguration>
+#include <QtNetwork/QSslKey>
+#endif
+
+#include <limits>
+
+QT_BEGIN_NAMESPACE
+
+static const int defaultInterval = 60 * 60;
+static const int defaultRetryInterval = 60;
+static const qreal defaultJitter = 0.2;
+// The notifier sends a comment every 30 seconds, the connection is considered
+// dead when nothing arrives for three times as long.
+static const int streamIdleTimeout = 90 * 1000;
+static const int defaultStreamRetry = 3000;
+// Summary metadata key with the interval, in seconds, that the server asks the
+// devices to wait at least between update checks.
+static const char summaryCheckIntervalKey[] = "qt.ota.check-interval";
+
+// Retry-After is either a number of seconds or an HTTP date.
+static qint64 retryAfter(QNetworkReply *reply)
+{
+    const QByteArray value = reply->rawHeader("Retry-After").trimmed();
+    if (value.isEmpty())
+        return 0;
+
+    bool ok = false;
+    qint64 seconds = value.toLongLong(&ok);
+    if (!ok) {
+        QDateTime date = QLocale::c().toDateTime(QString::fromLatin1(value),
+                                                 QStringLiteral("ddd, dd MMM yyyy HH:mm:ss 'GMT'"));
+        date.setTimeSpec(Qt::UTC);
+        seconds = date.isValid() ? QDateTime::currentDateTimeUtc().secsTo(date) : 0;
+    }
+    return qMax(Q_INT64_C(0), seconds) * 1000;
+}
+
+static QUrl repositoryFile(QOtaRepositoryConfig *config, const QString &path)
+{
+    QString url = config->url();
+    if (url.endsWith(QLatin1Char('/')))
+        url.chop(1);
+    return QUrl(url + QLatin1Char('/') + path);
+}
+
+// Returns the check interval that the server requests in the metadata of the
+// summary file, in milliseconds, or 0.
+static qint64 summaryCheckInterval(const QByteArray &summary)
+{
+    g_autoptr(GBytes) bytes = g_bytes_new (summary.constData(), summary.size());
+    // GVariant does not trust serialized data, malformed input yields default values.
+    g_autoptr(GVariant) summaryVariant = g_variant_ref_sink (g_variant_new_from_bytes (
+        G_VARIANT_TYPE ("(a(s(taya{sv}))a{sv})"), bytes, FALSE));
+    g_autoptr(GVariant) metadata = g_variant_get_child_value (summaryVariant, 1);
+    guint32 seconds = 0;
+    if (!g_variant_lookup (metadata, summaryCheckIntervalKey, "u", &seconds))
+        return 0;
+    return qint64(seconds) * 1000;
+}
+
+QOtaUpdateSchedulerPrivate::QOtaUpdateSchedulerPrivate(QOtaUpdateScheduler *scheduler) :
+    q_ptr(scheduler),
+    m_active(false),
+    m_interval(defaultInterval),
+    m_retryInterval(defaultRetryInterval),
+    m_jitter(defaultJitter),
+    m_conditionalPolling(true),
+    m_consecutiveFailures(0),
+    // Devices are often started at the same time, the seed must differ between them.
+    m_random(std::random_device()()),
+    m_checking(false),
+    m_waitingForFetch(false),
+    m_serverHint(0),
+    m_summaryHint(0),
+    m_manager(new QNetworkAccessManager(this)),
+    m_reply(nullptr),
+    m_stream(nullptr),
+    m_streamConnected(false),
+    m_streamDelivered(false),
+    m_notificationPending(false),
+    m_streamFailures(0),
+    m_streamRetry(defaultStreamRetry)
+{
+    m_timer.setSingleShot(true);
+    connect(&m_timer, &QTimer::timeout, this, &QOtaUpdateSchedulerPrivate::scheduledCheck);
+    m_reconnectTimer.setSingleShot(true);
+    connect(&m_reconnectTimer, &QTimer::timeout, this, &QOtaUpdateSchedulerPrivate::openStream);
+    m_streamWatchdog.setSingleShot(true);
+    m_streamWatchdog.setInterval(streamIdleTimeout);
+    connect(&m_streamWatchdog, &QTimer::timeout, this, [this]() {
+        qCWarning(qota) << "No data on the notification channel, reconnecting";
+        if (m_stream)
+            m_stream->abort();
+    });
+    connect(&QOtaClient::instance(), &QOtaClient::fetchRemoteMetadataFinished,
+            this, &QOtaUpdateSchedulerPrivate::fetchFinished);
+}
+
+QOtaUpdateSchedulerPrivate::~QOtaUpdateSchedulerPrivate()
+{
+}
+
+qreal QOtaUpdateSchedulerPrivate::random(qreal from, qreal to)
+{
+    return std::uniform_real_distribution<qreal>(from, to)(m_random);
+}
+
+void QOtaUpdateSchedulerPrivate::schedule(qint64 msecs)
+{
+    Q_Q(QOtaUpdateScheduler);
+    msecs = qBound(Q_INT64_C(0), msecs, qint64(std::numeric_limits<int>::max()));
+    m_timer.start(int(msecs));
+    m_nextCheck = QDateTime::currentDateTime().addMSecs(msecs);
+    emit q->nextCheckChanged();
+}
+
+qint64 QOtaUpdateSchedulerPrivate::firstCheckDelay(int interval, qreal jitter, qreal random)
+{
+    // Devices that are started together spread their first check over the jitter.
+    return qint64(interval * 1000 * jitter * random);
+}
+
+qint64 QOtaUpdateSchedulerPrivate::nextCheckDelay(int interval, int retryInterval, qreal jitter,
+                                                  int consecutiveFailures, bool success,
+                                                  qint64 serverHint, qreal random)
+{
+    qint64 delay = 0;
+    if (success) {
+        delay = qint64(interval * 1000 * (1.0 + jitter * (2 * random - 1)));
+    } else {
+        // Exponential backoff, capped at the regular interval. Half of the delay is
+        // randomized, so that clients that failed together do not retry together.
+        int exponent = qBound(0, consecutiveFailures - 1, 30);
+        qint64 backoff = qMin(qint64(interval), qint64(retryInterval) << exponent) * 1000;
+        delay = qint64(backoff * (0.5 + 0.5 * random));
+    }
+    if (serverHint > delay)
+        delay = serverHint + qint64(serverHint * jitter * random);
+    return delay;
+}
+
+qint64 QOtaUpdateSchedulerPrivate::firstCheckDelay()
+{
+    return firstCheckDelay(m_interval, m_jitter, random(0, 1));
+}
+
+qint64 QOtaUpdateSchedulerPrivate::nextCheckDelay(bool success, qint64 serverHint)
+{
+    return nextCheckDelay(m_interval, m_retryInterval, m_jitter, m_consecutiveFailures,
+                          success, serverHint, random(0, 1));
+}
+
+void QOtaUpdateSchedulerPrivate::scheduleNext(bool success, qint64 serverHint)
+{
+    qint64 delay = nextCheckDelay(success, serverHint);
+    qCDebug(qota) << "next update check in" << delay << "ms";
+    schedule(delay);
+}
+
+void QOtaUpdateSchedulerPrivate::scheduledCheck()
+{
+    // While the notification channel is up, the server tells when the reference moves.
+    if (m_streamConnected) {
+        scheduleNext(true, 0);
+        return;
+    }
+    startCheck();
+}
+
+void QOtaUpdateSchedulerPrivate::startCheck()
+{
+    if (m_checking)
+        return;
+
+    m_checking = true;
+    m_serverHint = 0;
+    QScopedPointer<QOtaRepositoryConfig> config(QOtaClient::instance().repositoryConfig());
+    if (!m_conditionalPolling || !config || config->url().isEmpty()) {
+        startFetch();
+        return;
+    }
+
+    // The reference file is a few bytes and the server can answer with 304 when the
+    // validators match, this is much cheaper than running 'ostree pull'.
+    QNetworkRequest request(repositoryFile(config.data(), QStringLiteral("refs/heads/linux/qt")));
+    request.setAttribute(QNetworkRequest::CacheLoadControlAttribute, QNetworkRequest::AlwaysNetwork);
+    if (!m_etag.isEmpty())
+        request.setRawHeader("If-None-Match", m_etag);
+    if (!m_lastModified.isEmpty())
+        request.setRawHeader("If-Modified-Since", m_lastModified);
+    setupTls(&request, config.data());
+    m_reply = m_manager->get(request);
+    connect(m_reply, &QNetworkReply::finished, this, &QOtaUpdateSchedulerPrivate::pollFinished);
+}
+
+void QOtaUpdateSchedulerPrivate::setupTls(QNetworkRequest *request, QOtaRepositoryConfig *config) const
+{
+#ifndef QT_NO_SSL
+    if (request->url().scheme() != QLatin1String("https"))
+        return;
+
+    QSslConfiguration ssl = request->sslConfiguration();
+    if (config->tlsPermissive())
+        ssl.setPeerVerifyMode(QSslSocket::VerifyNone);
+    if (!config->tlsCaPath().isEmpty())
+        ssl.setCaCertificates(QSslCertificate::fromPath(config->tlsCaPath()));
+    if (!config->tlsClientCertPath().isEmpty() && !config->tlsClientKeyPath().isEmpty()) {
+        QList<QSslCertificate> certificates = QSslCertificate::fromPath(config->tlsClientCertPath());
+        QFile keyFile(config->tlsClientKeyPath());
+        if (!certificates.isEmpty() && keyFile.open(QFile::ReadOnly)) {
+            QByteArray pem = keyFile.readAll();
+            QSslKey key(pem, QSsl::Rsa);
+            if (key.isNull())
+                key = QSslKey(pem, QSsl::Ec);
+            ssl.setLocalCertificate(certificates.first());
+            ssl.setPrivateKey(key);
+        }
+    }
+    request->setSslConfiguration(ssl);
+#else
+    Q_UNUSED(request);
+    Q_UNUSED(config);
+#endif
+}
+
+void QOtaUpdateSchedulerPrivate::pollFinished()
+{
+    QNetworkReply *reply = m_reply;
+    m_reply = nullptr;
+    reply->deleteLater();
+
+    int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    qint64 serverHint = retryAfter(reply);
+    qCDebug(qota) << "update check:" << reply->url() << "status" << status;
+    if (status == 304) {
+        finishCheck(true, serverHint);
+        return;
+    }
+    if (status == 0 || status == 429 || status >= 500) {
+        qCWarning(qota) << "Update check failed:" << reply->errorString();
+        finishCheck(false, serverHint);
+        return;
+    }
+
+    m_pendingEtag = reply->rawHeader("ETag");
+    m_pendingLastModified = reply->rawHeader("Last-Modified");
+    if (status == 200) {
+        QString rev = QString::fromLatin1(reply->readAll().trimmed());
+        if (!rev.isEmpty() && rev == QOtaClient::instance().remoteRevision()) {
+            m_etag = m_pendingEtag;
+            m_lastModified = m_pendingLastModified;
+            finishCheck(true, serverHint);
+            return;
+        }
+    } else {
+        // for example, the server does not expose the references as files
+        m_pendingEtag.clear();
+        m_pendingLastModified.clear();
+    }
+    m_serverHint = serverHint;
+    startFetch();
+}
+
+void QOtaUpdateSchedulerPrivate::startFetch()
+{
+    m_waitingForFetch = true;
+    if (!QOtaClient::instance().fetchRemoteMetadata()) {
+        m_waitingForFetch = false;
+        finishCheck(false, m_serverHint);
+    }
+}
+
+void QOtaUpdateSchedulerPrivate::fetchFinished(bool success)
+{
+    // fetches that were not started by the scheduler are ignored
+    if (!m_waitingForFetch)
+        return;
+
+    m_waitingForFetch = false;
+    if (success) {
+        // The validators are stored only now, a 304 must not hide a failed fetch.
+        m_etag = m_pendingEtag;
+        m_lastModified = m_pendingLastModified;
+        if (startSummaryFetch())
+            return;
+    }
+    finishCheck(success, m_serverHint);
+}
+
+bool QOtaUpdateSchedulerPrivate::startSummaryFetch()
+{
+    QScopedPointer<QOtaRepositoryConfig> config(QOtaClient::instance().repositoryConfig());
+    if (!config || config->url().isEmpty())
+        return false;
+
+    // The summary changes with each commit, it is requested after a fetch only, and
+    // the server answers with 304 when it has not changed.
+    QNetworkRequest request(repositoryFile(config.data(), QStringLiteral("summary")));
+    request.setAttribute(QNetworkRequest::CacheLoadControlAttribute, QNetworkRequest::AlwaysNetwork);
+    if (!m_summaryEtag.isEmpty())
+        request.setRawHeader("If-None-Match", m_summaryEtag);
+    setupTls(&request, config.data());
+    m_reply = m_manager->get(request);
+    connect(m_reply, &QNetworkReply::finished, this, &QOtaUpdateSchedulerPrivate::summaryFinished);
+    return true;
+}
+
+void QOtaUpdateSchedulerPrivate::summaryFinished()
+{
+    QNetworkReply *reply = m_reply;
+    m_reply = nullptr;
+    reply->deleteLater();
+
+    int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    qCDebug(qota) << "summary:" << reply->url() << "status" << status;
+    if (status == 200) {
+        m_summaryEtag = reply->rawHeader("ETag");
+        m_summaryHint = summaryCheckInterval(reply->readAll());
+    } else if (status == 404) {
+        m_summaryEtag.clear();
+        m_summaryHint = 0;
+    }
+    // The metadata has already been fetched, a missing summary does not fail the check.
+    finishCheck(true, qMax(m_serverHint, retryAfter(reply)));
+}
+
+void QOtaUpdateSchedulerPrivate::finishCheck(bool success, qint64 serverHint)
+{
+    Q_Q(QOtaUpdateScheduler);
+    m_checking = false;
+    m_serverHint = 0;
+    if (success)
+        serverHint = qMax(serverHint, m_summaryHint);
+    int failures = success ? 0 : m_consecutiveFailures + 1;
+    if (failures != m_consecutiveFailures) {
+        m_consecutiveFailures = failures;
+        emit q->consecutiveFailuresChanged();
+    }
+    emit q->checkFinished(success);
+    if (!m_active)
+        return;
+
+    if (m_notificationPending) {
+        // the reference moved while this check was running
+        m_notificationPending = false;
+        schedule(0);
+        return;
+    }
+    scheduleNext(success, serverHint);
+}
+
+void QOtaUpdateSchedulerPrivate::stopCheck()
+{
+    Q_Q(QOtaUpdateScheduler);
+    m_timer.stop();
+    m_notificationPending = false;
+    if (m_reply) {
+        m_reply->disconnect(this);
+        m_reply->abort();
+        m_reply->deleteLater();
+        m_reply = nullptr;
+        m_checking = false;
+    }
+    if (m_nextCheck.isValid()) {
+        m_nextCheck = QDateTime();
+        emit q->nextCheckChanged();
+    }
+}
+
+void QOtaUpdateSchedulerPrivate::openStream()
+{
+    if (m_stream || !m_active || m_notificationUrl.isEmpty())
+        return;
+
+    QNetworkRequest request((QUrl(m_notificationUrl)));
+    request.setRawHeader("Accept", "text/event-stream");
+    request.setRawHeader("Cache-Control", "no-cache");
+    if (!m_lastEventId.isEmpty())
+        request.setRawHeader("Last-Event-ID", m_lastEventId);
+    request.setAttribute(QNetworkRequest::CacheLoadControlAttribute, QNetworkRequest::AlwaysNetwork);
+    QScopedPointer<QOtaRepositoryConfig> config(QOtaClient::instance().repositoryConfig());
+    if (config)
+        setupTls(&request, config.data());
+
+    qCDebug(qota) << "opening notification channel" << m_notificationUrl;
+    m_streamBuffer.clear();
+    m_eventData.clear();
+    m_stream = m_manager->get(request);
+    connect(m_stream, &QNetworkReply::readyRead, this, &QOtaUpdateSchedulerPrivate::streamReadyRead);
+    connect(m_stream, &QNetworkReply::finished, this, &QOtaUpdateSchedulerPrivate::streamFinished);
+    m_streamWatchdog.start();
+}
+
+void QOtaUpdateSchedulerPrivate::closeStream()
+{
+    m_reconnectTimer.stop();
+    m_streamWatchdog.stop();
+    if (m_stream) {
+        m_stream->disconnect(this);
+        m_stream->abort();
+        m_stream->deleteLater();
+        m_stream = nullptr;
+    }
+    setStreamConnected(false);
+}
+
+void QOtaUpdateSchedulerPrivate::setStreamConnected(bool connected)
+{
+    Q_Q(QOtaUpdateScheduler);
+    if (m_streamConnected == connected)
+        return;
+
+    m_streamConnected = connected;
+    if (connected) {
+        m_streamUptime.start();
+        m_streamDelivered = false;
+    }
+    emit q->notificationsConnectedChanged();
+}
+
+void QOtaUpdateSchedulerPrivate::streamReadyRead()
+{
+    m_streamWatchdog.start();
+    int status = m_stream->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    QByteArray contentType = m_stream->header(QNetworkRequest::ContentTypeHeader).toByteArray();
+    if (status != 200 || !contentType.startsWith("text/event-stream")) {
+        // not a notification channel, streamFinished() retries later
+        m_stream->abort();
+        return;
+    }
+
+    setStreamConnected(true);
+    m_streamFailures = 0;
+    m_streamBuffer += m_stream->readAll();
+    int end;
+    while ((end = m_streamBuffer.indexOf('\n')) != -1) {
+        QByteArray line = m_streamBuffer.left(end);
+        m_streamBuffer.remove(0, end + 1);
+        if (line.endsWith('\r'))
+            line.chop(1);
+
+        if (line.isEmpty()) {
+            dispatchEvent();
+            continue;
+        }
+        if (line.startsWith(':'))
+            continue; // comment, used as a heartbeat
+
+        int colon = line.indexOf(':');
+        QByteArray field = line.left(colon);
+        QByteArray value = colon == -1 ? QByteArray() : line.mid(colon + 1);
+        if (value.startsWith(' '))
+            value.remove(0, 1);
+
+        if (field == "data") {
+            if (!m_eventData.isEmpty())
+                m_eventData += '\n';
+            m_eventData += value;
+        } else if (field == "id") {
+            // With numeric IDs, a jump shows events that the server did not replay.
+            bool lastOk = false;
+            bool ok = false;
+            quint64 last = m_lastEventId.toULongLong(&lastOk);
+            quint64 id = value.toULongLong(&ok);
+            if (lastOk && ok && id > last + 1) {
+                qCDebug(qota) << "missed notifications between" << last << "and" << id;
+                scheduleCatchUpCheck();
+            }
+            m_lastEventId = value;
+        } else if (field == "retry") {
+            bool ok = false;
+            int retry = value.toInt(&ok);
+            if (ok && retry >= 0)
+                m_streamRetry = retry;
+        }
+    }
+}
+
+void QOtaUpdateSchedulerPrivate::dispatchEvent()
+{
+    m_streamDelivered = true;
+    QString rev = QString::fromLatin1(m_eventData.trimmed());
+    m_eventData.clear();
+    if (rev.isEmpty() || rev == QOtaClient::instance().remoteRevision())
+        return;
+
+    qCDebug(qota) << "linux/qt moved to" << rev;
+    if (m_checking)
+        m_notificationPending = true;
+    else
+        startCheck();
+}
+
+void QOtaUpdateSchedulerPrivate::streamFinished()
+{
+    QNetworkReply *stream = m_stream;
+    m_stream = nullptr;
+    stream->deleteLater();
+    m_streamWatchdog.stop();
+    bool wasConnected = m_streamConnected;
+    bool shortLived = wasConnected && !m_streamDelivered && m_streamUptime.elapsed() < streamIdleTimeout;
+    setStreamConnected(false);
+    if (!m_active)
+        return;
+
+    // A server that closes the stream after each event (long-polling) is reconnected
+    // after the retry time, failed connections back off exponentially up to the
+    // check interval.
+    if (!wasConnected)
+        m_streamFailures = qMin(m_streamFailures + 1, 30);
+    qint64 delay = qMin(qint64(m_interval) * 1000, qint64(m_streamRetry) << m_streamFailures);
+    delay = qint64(delay * random(0.5, 1.0));
+    qCDebug(qota) << "notification channel closed:" << stream->errorString()
+                  << "reconnecting in" << delay << "ms";
+    m_reconnectTimer.start(int(qMin(delay, qint64(std::numeric_limits<int>::max()))));
+
+    // The reconnect sends Last-Event-ID and the server replays what was missed, so
+    // the regular schedule is kept. A connection that closed before the watchdog
+    // timeout without an event (a long-polling server closes after each event) has
+    // not proven to deliver events, a check catches up on them.
+    if (shortLived)
+        scheduleCatchUpCheck();
+}
+
+void QOtaUpdateSchedulerPrivate::scheduleCatchUpCheck()
+{
+    // All devices see the same gap when the server restarts, the check is spread
+    // over the retry interval.
+    qint64 delay = qint64(m_retryInterval * 1000 * random(0, 1));
+    if (m_checking || (m_timer.isActive() && m_timer.remainingTime() <= delay))
+        return;
+    schedule(delay);
+}
+
+/*!
+    \inqmlmodule QtOtaUpdate
+    \qmltype OtaUpdateScheduler
+    \instantiates QOtaUpdateScheduler
+    \brief Checks for system updates periodically.
+
+    OtaUpdateScheduler
+    \include qotaupdatescheduler.cpp update-scheduler-description
+*/
+
+/*!
+    \class QOtaUpdateScheduler
+    \inmodule qtotaupdate
+    \brief Checks for system updates periodically.
+
+    QOtaUpdateScheduler
+//! [update-scheduler-description]
+    calls QOtaClient::fetchRemoteMetadata() in regular intervals. When many devices
+    check the same update server, fixed intervals synchronize the devices, for
+    example after a power outage, and the server receives the requests in bursts.
+    The scheduler avoids this:
+
+    \list
+        \li The first check after activation happens at a random time within
+            \c {jitter * interval}, and each following interval is randomized by
+            \l jitter.
+        \li After a failed check the next check is delayed exponentially, starting
+            from \l retryInterval and limited by \l interval. Half of the delay is
+            random.
+        \li A \c Retry-After header sent by the server (with any status code) delays
+            the next check at least by the requested time.
+        \li The server can set the minimum time between successful checks in the
+            metadata of the repository summary, with the key
+            \c qt.ota.check-interval of type \c uint32 in seconds, for example:
+            \badcode
+            ostree summary --repo=repo -u --add-metadata=qt.ota.check-interval='uint32 7200'
+            \endcode
+            The summary is requested after fetchRemoteMetadata() has run, and the
+            last value applies until the next summary is received.
+        \li With \l conditionalPolling, the reference file of the repository is
+            requested with the validators of the previous response. Only when the
+            reference has changed, fetchRemoteMetadata() runs \c {ostree pull}.
+        \li With \l notificationUrl, the server notifies the scheduler when the
+            reference moves, and the regular checks are skipped while the
+            notification channel is connected.
+    \endlist
+
+    When a check completes, the checkFinished() signal is emitted, and
+    QOtaClient::updateAvailable holds whether an update is available.
+//! [update-scheduler-description]
+*/
+
+/*!
+    \qmlsignal OtaUpdateScheduler::checkFinished(bool success)
+
+    This signal is emitted when a check for updates completes. The \a success
+    argument indicates whether the check was successful.
+*/
+
+/*!
+    \fn void QOtaUpdateScheduler::checkFinished(bool success)
+
+    This signal is emitted when a check for updates completes. The \a success
+    argument indicates whether the check was successful.
+*/
+
+/*!
+    \qmlsignal OtaUpdateScheduler::activeChanged()
+
+    This signal is emitted when the value of \l active changes.
+*/
+
+/*!
+    \fn void QOtaUpdateScheduler::activeChanged()
+
+    This signal is emitted when the value of \l active changes.
+*/
+
+/*!
+    \qmlsignal OtaUpdateScheduler::intervalChanged()
+
+    This signal is emitted when the value of \l interval changes.
+*/
+
+/*!
+    \fn void QOtaUpdateScheduler::intervalChanged()
+
+    This signal is emitted when the value of \l interval changes.
+*/
+
+/*!
+    \qmlsignal OtaUpdateScheduler::retryIntervalChanged()
+
+    This signal is emitted when the value of \l retryInterval changes.
+*/
+
+/*!
+    \fn void QOtaUpdateScheduler::retryIntervalChanged()
+
+    This signal is emitted when the value of \l retryInterval changes.
+*/
+
+/*!
+    \qmlsignal OtaUpdateScheduler::jitterChanged()
+
+    This signal is emitted when the value of \l jitter changes.
+*/
+
+/*!
+    \fn void QOtaUpdateScheduler::jitterChanged()
+
+    This signal is emitted when the value of \l jitter changes.
+*/
+
+/*!
+    \qmlsignal OtaUpdateScheduler::conditionalPollingChanged()
+
+    This signal is emitted when the value of \l conditionalPolling changes.
+*/
+
+/*!
+    \fn void QOtaUpdateScheduler::conditionalPollingChanged()
+
+    This signal is emitted when the value of \l conditionalPolling changes.
+*/
+
+/*!
+    \qmlsignal OtaUpdateScheduler::notificationUrlChanged()
+
+    This signal is emitted when the value of \l notificationUrl changes.
+*/
+
+/*!
+    \fn void QOtaUpdateScheduler::notificationUrlChanged()
+
+    This signal is emitted when the value of \l notificationUrl changes.
+*/
+
+/*!
+    \qmlsignal OtaUpdateScheduler::notificationsConnectedChanged()
+
+    This signal is emitted when the value of \l notificationsConnected changes.
+*/
+
+/*!
+    \fn void QOtaUpdateScheduler::notificationsConnectedChanged()
+
+    This signal is emitted when the value of \l notificationsConnected changes.
+*/
+
+/*!
+    \qmlsignal OtaUpdateScheduler::nextCheckChanged()
+
+    This signal is emitted when the value of \l nextCheck changes.
+*/
+
+/*!
+    \fn void QOtaUpdateScheduler::nextCheckChanged()
+
+    This signal is emitted when the value of \l nextCheck changes.
+*/
+
+/*!
+    \qmlsignal OtaUpdateScheduler::consecutiveFailuresChanged()
+
+    This signal is emitted when the value of \l consecutiveFailures changes.
+*/
+
+/*!
+    \fn void QOtaUpdateScheduler::consecutiveFailuresChanged()
+
+    This signal is emitted when the value of \l consecutiveFailures changes.
+*/
+
+QOtaUpdateScheduler::QOtaUpdateScheduler(QObject *parent) :
+    QObject(parent),
+    d_ptr(new QOtaUpdateSchedulerPrivate(this))
+{
+}
+
+QOtaUpdateScheduler::~QOtaUpdateScheduler()
+{
+    delete d_ptr;
+}
+
+/*!
+    Checks for updates immediately, unless a check is already in progress.
+    When the scheduler is \l active, the following check is scheduled relative to
+    the completion of this check.
+*/
+void QOtaUpdateScheduler::checkNow()
+{
+    Q_D(QOtaUpdateScheduler);
+    d->m_timer.stop();
+    d->startCheck();
+}
+
+void QOtaUpdateScheduler::setActive(bool active)
+{
+    Q_D(QOtaUpdateScheduler);
+    if (d->m_active == active)
+        return;
+
+    d->m_active = active;
+    if (active) {
+        d->schedule(d->firstCheckDelay());
+        d->m_streamFailures = 0;
+        d->openStream();
+    } else {
+        d->closeStream();
+        d->stopCheck();
+    }
+    emit activeChanged();
+}
+
+/*!
+    \qmlproperty bool OtaUpdateScheduler::active
+
+    Holds whether the scheduler checks for updates. The default value is \c false.
+*/
+
+/*!
+    \property QOtaUpdateScheduler::active
+
+    Holds whether the scheduler checks for updates. The default value is \c false.
+*/
+bool QOtaUpdateScheduler::isActive() const
+{
+    return d_func()->m_active;
+}
+
+void QOtaUpdateScheduler::setInterval(int seconds)
+{
+    Q_D(QOtaUpdateScheduler);
+    seconds = qMax(1, seconds);
+    if (d->m_interval == seconds)
+        return;
+
+    d->m_interval = seconds;
+    emit intervalChanged();
+}
+
+/*!
+    \qmlproperty int OtaUpdateScheduler::interval
+    \include qotaupdatescheduler.cpp interval
+*/
+
+/*!
+    \property QOtaUpdateScheduler::interval
+//! [interval]
+    Holds the average time in seconds between two checks for updates. A new
+    value is used from the next scheduled check. The default value is \c 3600.
+//! [interval]
+*/
+int QOtaUpdateScheduler::interval() const
+{
+    return d_func()->m_interval;
+}
+
+void QOtaUpdateScheduler::setRetryInterval(int seconds)
+{
+    Q_D(QOtaUpdateScheduler);
+    seconds = qMax(1, seconds);
+    if (d->m_retryInterval == seconds)
+        return;
+
+    d->m_retryInterval = seconds;
+    emit retryIntervalChanged();
+}
+
+/*!
+    \qmlproperty int OtaUpdateScheduler::retryInterval
+    \include qotaupdatescheduler.cpp retry-interval
+*/
+
+/*!
+    \property QOtaUpdateScheduler::retryInterval
+//! [retry-interval]
+    Holds the delay in seconds after the first failed check. The delay doubles
+    with each consecutive failure, up to \l interval. The default value is \c 60.
+//! [retry-interval]
+*/
+int QOtaUpdateScheduler::retryInterval() const
+{
+    return d_func()->m_retryInterval;
+}
+
+void QOtaUpdateScheduler::setJitter(qreal jitter)
+{
+    Q_D(QOtaUpdateScheduler);
+    jitter = qBound(qreal(0), jitter, qreal(1));
+    if (qFuzzyCompare(d->m_jitter, jitter))
+        return;
+
+    d->m_jitter = jitter;
+    emit jitterChanged();
+}
+
+/*!
+    \qmlproperty real OtaUpdateScheduler::jitter
+    \include qotaupdatescheduler.cpp jitter
+*/
+
+/*!
+    \property QOtaUpdateScheduler::jitter
+//! [jitter]
+    Holds the fraction of \l interval by which the intervals are randomized,
+    in the range from \c 0 to \c 1. With the default value of \c 0.2, an interval
+    of one hour varies between 48 and 72 minutes.
+//! [jitter]
+*/
+qreal QOtaUpdateScheduler::jitter() const
+{
+    return d_func()->m_jitter;
+}
+
+void QOtaUpdateScheduler::setConditionalPolling(bool enabled)
+{
+    Q_D(QOtaUpdateScheduler);
+    if (d->m_conditionalPolling == enabled)
+        return;
+
+    d->m_conditionalPolling = enabled;
+    emit conditionalPollingChanged();
+}
+
+/*!
+    \qmlproperty bool OtaUpdateScheduler::conditionalPolling
+    \include qotaupdatescheduler.cpp conditional-polling
+*/
+
+/*!
+    \property QOtaUpdateScheduler::conditionalPolling
+//! [conditional-polling]
+    Holds whether the scheduler first requests the \c linux/qt reference of the
+    repository, with the \c If-None-Match and \c If-Modified-Since headers of the
+    previous response. When the server answers with \c {304 Not Modified}, or the
+    reference points to the known remote revision, the check completes without
+    running fetchRemoteMetadata(). If the server does not serve the reference
+    file, the scheduler falls back to fetchRemoteMetadata(). The default value is
+    \c true.
+//! [conditional-polling]
+*/
+bool QOtaUpdateScheduler::conditionalPolling() const
+{
+    return d_func()->m_conditionalPolling;
+}
+
+void QOtaUpdateScheduler::setNotificationUrl(const QString &url)
+{
+    Q_D(QOtaUpdateScheduler);
+    if (d->m_notificationUrl == url)
+        return;
+
+    d->m_notificationUrl = url;
+    d->closeStream();
+    d->m_lastEventId.clear();
+    d->m_streamFailures = 0;
+    d->m_streamRetry = defaultStreamRetry;
+    d->openStream();
+    emit notificationUrlChanged();
+}
+
+/*!
+    \qmlproperty string OtaUpdateScheduler::notificationUrl
+    \include qotaupdatescheduler.cpp notification-url
+*/
+
+/*!
+    \property QOtaUpdateScheduler::notificationUrl
+//! [notification-url]
+    Holds the URL of a notification channel for the repository. The server keeps
+    the connection open and sends a \l {Server-Sent Events} {server-sent event}
+    with the checksum of the \c linux/qt reference in the \c data field
+    whenever the reference moves. When the checksum differs from
+    OtaClient::remoteRevision, a check starts immediately. Lines that start with
+    a colon are heartbeats and must be sent at least every 90 seconds. A server
+    that closes the connection after each event (long-polling) is supported as
+    well.
+
+    When the connection fails, the scheduler reconnects with an exponential
+    backoff, starting from the \c retry field sent by the server (3 seconds by
+    default) and limited by \l interval. While the channel is not connected,
+    the regular checks run as usual. The reconnect sends the \c Last-Event-ID
+    header, and the server is expected to replay the events that were missed.
+    An extra check, at a random time within \l retryInterval, runs only when
+    the numeric event IDs skip a value or when a connection closes within 90
+    seconds without delivering an event.
+
+    The \c {qt-ostree --start-trivial-httpd} command starts a reference notifier
+    next to the repository server and writes its URL to the
+    \c {httpd/notifier-address} file. The default value is an empty string,
+    which disables notifications.
+//! [notification-url]
+*/
+QString QOtaUpdateScheduler::notificationUrl() const
+{
+    return d_func()->m_notificationUrl;
+}
+
+/*!
+    \qmlproperty bool OtaUpdateScheduler::notificationsConnected
+    \readonly
+
+    Holds whether the notification channel is connected.
+
+    \sa notificationUrl
+*/
+
+/*!
+    \property QOtaUpdateScheduler::notificationsConnected
+
+    Holds whether the notification channel is connected.
+
+    \sa notificationUrl
+*/
+bool QOtaUpdateScheduler::notificationsConnected() const
+{
+    return d_func()->m_streamConnected;
+}
+
+/*!
+    \qmlproperty date OtaUpdateScheduler::nextCheck
+    \readonly
+
+    Holds the time of the next scheduled check, or an invalid date if no check
+    is scheduled.
+*/
+
+/*!
+    \property QOtaUpdateScheduler::nextCheck
+
+    Holds the time of the next scheduled check, or an invalid date if no check
+    is scheduled.
+*/
+QDateTime QOtaUpdateScheduler::nextCheck() const
+{
+    return d_func()->m_nextCheck;
+}
+
+/*!
+    \qmlproperty int OtaUpdateScheduler::consecutiveFailures
+    \readonly
+
+    Holds the number of consecutive failed checks.
+*/
+
+/*!
+    \property QOtaUpdateScheduler::consecutiveFailures
+
+    Holds the number of consecutive failed checks.
+*/
+int QOtaUpdateScheduler::consecutiveFailures() const
+{
+    return d_func()->m_consecutiveFailures;
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,94 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the Qt OTA Update module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:GPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 or (at your option) any later version
+** approved by the KDE Free Qt Foundation. The licenses are as published by
+** the Free Software Foundation and appearing in the file LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+#ifndef QOTAUPDATESCHEDULER_H
+#define QOTAUPDATESCHEDULER_H
+
+#include <QtCore/QDateTime>
+#include <QtCore/QObject>
+#include <QtCore/QString>
+
+QT_BEGIN_NAMESPACE
+
+class QOtaUpdateSchedulerPrivate;
+
+class Q_DECL_EXPORT QOtaUpdateScheduler : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(bool active READ isActive WRITE setActive NOTIFY activeChanged)
+    Q_PROPERTY(int interval READ interval WRITE setInterval NOTIFY intervalChanged)
+    Q_PROPERTY(int retryInterval READ retryInterval WRITE setRetryInterval NOTIFY retryIntervalChanged)
+    Q_PROPERTY(qreal jitter READ jitter WRITE setJitter NOTIFY jitterChanged)
+    Q_PROPERTY(bool conditionalPolling READ conditionalPolling WRITE setConditionalPolling NOTIFY conditionalPollingChanged)
+    Q_PROPERTY(QString notificationUrl READ notificationUrl WRITE setNotificationUrl NOTIFY notificationUrlChanged)
+    Q_PROPERTY(bool notificationsConnected READ notificationsConnected NOTIFY notificationsConnectedChanged)
+    Q_PROPERTY(QDateTime nextCheck READ nextCheck NOTIFY nextCheckChanged)
+    Q_PROPERTY(int consecutiveFailures READ consecutiveFailures NOTIFY consecutiveFailuresChanged)
+public:
+    explicit QOtaUpdateScheduler(QObject *parent = nullptr);
+    ~QOtaUpdateScheduler();
+
+    bool isActive() const;
+    void setActive(bool active);
+    int interval() const;
+    void setInterval(int seconds);
+    int retryInterval() const;
+    void setRetryInterval(int seconds);
+    qreal jitter() const;
+    void setJitter(qreal jitter);
+    bool conditionalPolling() const;
+    void setConditionalPolling(bool enabled);
+    QString notificationUrl() const;
+    void setNotificationUrl(const QString &url);
+    bool notificationsConnected() const;
+    QDateTime nextCheck() const;
+    int consecutiveFailures() const;
+
+    Q_INVOKABLE void checkNow();
+
+Q_SIGNALS:
+    void activeChanged();
+    void intervalChanged();
+    void retryIntervalChanged();
+    void jitterChanged();
+    void conditionalPollingChanged();
+    void notificationUrlChanged();
+    void notificationsConnectedChanged();
+    void nextCheckChanged();
+    void consecutiveFailuresChanged();
+    void checkFinished(bool success);
+
+private:
+    Q_DISABLE_COPY(QOtaUpdateScheduler)
+    Q_DECLARE_PRIVATE(QOtaUpdateScheduler)
+    QOtaUpdateSchedulerPrivate *const d_ptr;
+};
+
+QT_END_NAMESPACE
+
+#endif // QOTAUPDATESCHEDULER_H
@@ -0,0 +1,132 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the Qt OTA Update module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:GPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 or (at your option) any later version
+** approved by the KDE Free Qt Foundation. The licenses are as published by
+** the Free Software Foundation and appearing in the file LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+#ifndef QOTAUPDATESCHEDULER_P_H
+#define QOTAUPDATESCHEDULER_P_H
+
+#include "qotaupdatescheduler.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QDateTime>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QObject>
+#include <QtCore/QTimer>
+
+#include <random>
+
+QT_BEGIN_NAMESPACE
+
+class QNetworkAccessManager;
+class QNetworkReply;
+class QNetworkRequest;
+class QOtaRepositoryConfig;
+
+class Q_AUTOTEST_EXPORT QOtaUpdateSchedulerPrivate : public QObject
+{
+    Q_OBJECT
+    Q_DECLARE_PUBLIC(QOtaUpdateScheduler)
+public:
+    QOtaUpdateSchedulerPrivate(QOtaUpdateScheduler *scheduler);
+    virtual ~QOtaUpdateSchedulerPrivate();
+    static QOtaUpdateSchedulerPrivate *get(QOtaUpdateScheduler *scheduler) { return scheduler->d_func(); }
+
+    // The delays are pure functions of their arguments, random is uniformly
+    // distributed in [0, 1).
+    static qint64 firstCheckDelay(int interval, qreal jitter, qreal random);
+    static qint64 nextCheckDelay(int interval, int retryInterval, qreal jitter,
+                                 int consecutiveFailures, bool success,
+                                 qint64 serverHint, qreal random);
+    qint64 firstCheckDelay();
+    qint64 nextCheckDelay(bool success, qint64 serverHint);
+    void schedule(qint64 msecs);
+    void scheduleNext(bool success, qint64 serverHint);
+    void scheduledCheck();
+    void startCheck();
+    void pollFinished();
+    void startFetch();
+    void fetchFinished(bool success);
+    bool startSummaryFetch();
+    void summaryFinished();
+    void finishCheck(bool success, qint64 serverHint);
+    void stopCheck();
+    qreal random(qreal from, qreal to);
+    void setupTls(QNetworkRequest *request, QOtaRepositoryConfig *config) const;
+    void openStream();
+    void closeStream();
+    void streamReadyRead();
+    void streamFinished();
+    void scheduleCatchUpCheck();
+    void dispatchEvent();
+    void setStreamConnected(bool connected);
+
+    // members
+    QOtaUpdateScheduler *const q_ptr;
+    bool m_active;
+    int m_interval;
+    int m_retryInterval;
+    qreal m_jitter;
+    bool m_conditionalPolling;
+    int m_consecutiveFailures;
+    QDateTime m_nextCheck;
+    QTimer m_timer;
+    std::mt19937 m_random;
+
+    // current check
+    bool m_checking;
+    bool m_waitingForFetch;
+    qint64 m_serverHint;
+    QNetworkAccessManager *m_manager;
+    QNetworkReply *m_reply;
+    // validators of the last response for the reference
+    QByteArray m_etag;
+    QByteArray m_lastModified;
+    QByteArray m_pendingEtag;
+    QByteArray m_pendingLastModified;
+    // check interval requested in the summary metadata
+    qint64 m_summaryHint;
+    QByteArray m_summaryEtag;
+
+    // notification channel (server-sent events)
+    QString m_notificationUrl;
+    QNetworkReply *m_stream;
+    QByteArray m_streamBuffer;
+    QByteArray m_eventData;
+    QByteArray m_lastEventId;
+    bool m_streamConnected;
+    QElapsedTimer m_streamUptime;
+    bool m_streamDelivered;
+    bool m_notificationPending;
+    int m_streamFailures;
+    int m_streamRetry;
+    QTimer m_reconnectTimer;
+    QTimer m_streamWatchdog;
+};
+
+QT_END_NAMESPACE
+
+#endif // QOTAUPDATESCHEDULER_P_H
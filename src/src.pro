@@ -2,4 +2,5 @@ TEMPLATE = subdirs
 CONFIG += ordered
 SUBDIRS += \
     lib \
-    imports
+    imports \
+    tools
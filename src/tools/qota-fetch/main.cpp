@@ -0,0 +1,106 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the Qt OTA Update module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:GPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 or (at your option) any later version
+** approved by the KDE Free Qt Foundation. The licenses are as published by
+** the Free Software Foundation and appearing in the file LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+// Pulls a commit the way QOtaClient::update() does, through the fetch proxy of the
+// library when the remote configuration tunes the fetches (the qt-* settings, see
+// QOtaRepositoryConfig::maxConcurrentRequests, connectionTimeout, retryCount and
+// mirrors). Used by qt-ostree/fetch-benchmark.
+//
+// Usage: qota-fetch CONFIG REPO REMOTE REV
+//
+// CONFIG is a remote configuration file, such as /etc/ostree/remotes.d/qt-os.conf,
+// and REMOTE is the name of the same remote in REPO.
+
+#include <QtOtaUpdate/private/qotafetchproxy_p.h>
+#include <QtOtaUpdate/private/qotarepositoryconfig_p.h>
+#include <QtOtaUpdate/qotarepositoryconfig.h>
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QProcess>
+#include <QtCore/QScopedPointer>
+#include <QtCore/QTextStream>
+#include <QtCore/QUrl>
+
+QT_USE_NAMESPACE
+
+static QTextStream &err()
+{
+    static QTextStream stream(stderr);
+    return stream;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    const QStringList args = app.arguments();
+    if (args.size() != 5) {
+        err() << "Usage: qota-fetch CONFIG REPO REMOTE REV" << endl;
+        return 2;
+    }
+
+    QScopedPointer<QOtaRepositoryConfig> config(QOtaRepositoryConfigPrivate::repositoryConfigFromFile(args.at(1)));
+    if (!config || config->url().isEmpty()) {
+        err() << "qota-fetch: no remote URL in " << args.at(1) << endl;
+        return 1;
+    }
+
+    QOtaFetchTuning tuning;
+    tuning.maxConcurrentRequests = config->maxConcurrentRequests();
+    tuning.connectionTimeout = config->connectionTimeout();
+    tuning.retryCount = config->retryCount();
+    tuning.mirrors = config->mirrors();
+    QOtaFetchProxy proxy;
+    proxy.setTuning(tuning);
+
+    QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
+    if (proxy.isNeeded()) {
+        QString httpProxy = proxy.start(QUrl(config->url()), false);
+        if (httpProxy.isEmpty()) {
+            err() << "qota-fetch: failed to start the fetch proxy" << endl;
+            return 1;
+        }
+        env.insert(QStringLiteral("http_proxy"), httpProxy);
+    }
+
+    // Static deltas are disabled to measure the object fetcher.
+    QProcess ostree;
+    ostree.setProcessEnvironment(env);
+    ostree.setProcessChannelMode(QProcess::ForwardedChannels);
+    ostree.start(QStringLiteral("ostree"), QStringList() << QStringLiteral("--repo=") + args.at(2)
+                 << QStringLiteral("pull") << QStringLiteral("--disable-static-deltas")
+                 << args.at(3) << args.at(4));
+    bool ok = ostree.waitForFinished(-1) && ostree.exitStatus() == QProcess::NormalExit &&
+              ostree.exitCode() == 0;
+    if (ostree.error() == QProcess::FailedToStart)
+        err() << "qota-fetch: " << ostree.errorString() << endl;
+
+    if (proxy.isNeeded())
+        QTextStream(stdout) << "qota-fetch: " << proxy.stop() << endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,195 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the Qt OTA Update module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:GPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 or (at your option) any later version
+** approved by the KDE Free Qt Foundation. The licenses are as published by
+** the Free Software Foundation and appearing in the file LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+// Finalizes a deployment that was staged by QOtaClient (see QOtaClient::stagedDeployment)
+// by writing the boot loader configuration. Runs at shutdown from qota-finalize.service.
+
+#include "ostree-1/ostree.h"
+#include "glib-2.0/glib.h"
+
+#include <QtOtaUpdate/private/qotabootcounter_p.h>
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QList>
+#include <QtCore/QTextStream>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+QT_USE_NAMESPACE
+
+// from libglnx
+#define GLNX_DEFINE_CLEANUP_FUNCTION0(Type, name, func) \
+  static inline void name (void *v) \
+  { \
+    if (*(Type*)v) \
+      func (*(Type*)v); \
+  }
+#define glnx_unref_object __attribute__ ((cleanup(glnx_local_obj_unref)))
+GLNX_DEFINE_CLEANUP_FUNCTION0(GObject*, glnx_local_obj_unref, g_object_unref)
+
+// Written by QOtaClientAsync::stageCommit(), relative to the sysroot.
+static const char stagedDeploymentPath[] = "/ostree/staged-deployment";
+// Reported by QOtaClientAsync::_checkBootState() on the next start.
+static const char failedStagedDeploymentPath[] = "/ostree/staged-deployment.failed";
+
+static QTextStream &err()
+{
+    static QTextStream stream(stderr);
+    return stream;
+}
+
+static bool reportGError(GError *error)
+{
+    err() << "qota-finalize: " << (error ? error->message : "unknown error") << endl;
+    g_clear_error (&error);
+    return false;
+}
+
+static QByteArray deploymentId(OstreeDeployment *deployment)
+{
+    return QByteArray(ostree_deployment_get_csum (deployment)) + '.' +
+           QByteArray::number(ostree_deployment_get_deployserial (deployment));
+}
+
+static OstreeDeployment *loadStagedDeployment(OstreeSysroot *sysroot, GKeyFile *staged, GError **error)
+{
+    g_autofree char *osname = g_key_file_get_string (staged, "staged", "osname", error);
+    g_autofree char *csum = osname ? g_key_file_get_string (staged, "staged", "csum", error) : nullptr;
+    g_autofree char *bootcsum = csum ? g_key_file_get_string (staged, "staged", "bootcsum", error) : nullptr;
+    g_autofree char *options = bootcsum ? g_key_file_get_string (staged, "staged", "options", error) : nullptr;
+    if (!options)
+        return nullptr;
+    int deployserial = g_key_file_get_integer (staged, "staged", "deployserial", nullptr);
+
+    // The boot serial is assigned when the deployments are written.
+    OstreeDeployment *deployment = ostree_deployment_new (-1, osname, csum, deployserial, bootcsum, -1);
+    g_autoptr(GFile) deploymentDir = ostree_sysroot_get_deployment_directory (sysroot, deployment);
+    g_autoptr(GFile) originPath = ostree_sysroot_get_deployment_origin_path (deploymentDir);
+    g_autoptr(GKeyFile) origin = g_key_file_new ();
+    g_autofree char *originFile = g_file_get_path (originPath);
+    if (!g_key_file_load_from_file (origin, originFile, G_KEY_FILE_KEEP_COMMENTS, error)) {
+        g_object_unref (deployment);
+        return nullptr;
+    }
+    ostree_deployment_set_origin (deployment, origin);
+
+    glnx_unref_object OstreeBootconfigParser *bootconfig = ostree_bootconfig_parser_new ();
+    ostree_bootconfig_parser_set (bootconfig, "options", options);
+    ostree_deployment_set_bootconfig (deployment, bootconfig);
+    return deployment;
+}
+
+static bool finalize(OstreeSysroot *sysroot, GKeyFile *staged)
+{
+    GError *error = nullptr;
+    if (!ostree_sysroot_load (sysroot, nullptr, &error))
+        return reportGError(error);
+
+    OstreeDeployment *stagedDeployment = loadStagedDeployment(sysroot, staged, &error);
+    if (!stagedDeployment)
+        return reportGError(error);
+
+    // The staged deployment becomes the default system, followed by the deployments
+    // that were selected for retention when the deployment was staged.
+    gsize retainCount = 0;
+    g_auto(GStrv) retain = g_key_file_get_string_list (staged, "staged", "retain", &retainCount, nullptr);
+    g_autoptr(GPtrArray) deployments = ostree_sysroot_get_deployments (sysroot);
+    g_autoptr(GPtrArray) newDeployments = g_ptr_array_new_with_free_func (g_object_unref);
+    g_ptr_array_add (newDeployments, stagedDeployment);
+    for (uint i = 0; i < deployments->len; i++) {
+        OstreeDeployment *deployment = (OstreeDeployment*)deployments->pdata[i];
+        if (!retain || g_strv_contains (retain, deploymentId(deployment).constData()))
+            g_ptr_array_add (newDeployments, g_object_ref (deployment));
+    }
+
+    if (!ostree_sysroot_write_deployments (sysroot, newDeployments, nullptr, &error))
+        return reportGError(error);
+
+    // Boot counting falls back to the previous default system.
+    int bootCountLimit = g_key_file_get_integer (staged, "staged", "boot-count-limit", nullptr);
+    if (bootCountLimit > 0 && newDeployments->len > 1) {
+        OstreeBootconfigParser *config = ostree_deployment_get_bootconfig ((OstreeDeployment*)newDeployments->pdata[1]);
+        QOtaBootEntry fallback;
+        fallback.kernel = QLatin1String(ostree_bootconfig_parser_get (config, "linux"));
+        fallback.initrd = QLatin1String(ostree_bootconfig_parser_get (config, "initrd"));
+        fallback.options = QLatin1String(ostree_bootconfig_parser_get (config, "options"));
+        QString bootCounterError;
+        g_autofree char *path = g_file_get_path (ostree_sysroot_get_path (sysroot));
+        QOtaBootCounter bootCounter(QFile::decodeName(path));
+        if (!bootCounter.arm(bootCountLimit, fallback, &bootCounterError))
+            err() << "qota-finalize: failed to enable boot counting: " << bootCounterError << endl;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QElapsedTimer timer;
+    timer.start();
+
+    GError *error = nullptr;
+    glnx_unref_object OstreeSysroot *sysroot = ostree_sysroot_new_default ();
+    g_autofree char *root = g_file_get_path (ostree_sysroot_get_path (sysroot));
+    QByteArray stagedPath = QByteArray(root) + stagedDeploymentPath;
+    g_autoptr(GKeyFile) staged = g_key_file_new ();
+    if (!g_key_file_load_from_file (staged, stagedPath.constData(), G_KEY_FILE_NONE, &error)) {
+        if (g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+            g_clear_error (&error);
+            return 0;
+        }
+        reportGError(error);
+        return 1;
+    }
+
+    if (!ostree_sysroot_lock (sysroot, &error)) {
+        reportGError(error);
+        return 1;
+    }
+    // A deployment that cannot be finalized now would not succeed on the next
+    // shutdown either. On failure the staged file is kept under another name, so
+    // that the path unit does not start this again and the library reports it.
+    bool ok = finalize(sysroot, staged);
+    if (ok) {
+        QFile::remove(QFile::decodeName(stagedPath));
+    } else {
+        QByteArray failedPath = QByteArray(root) + failedStagedDeploymentPath;
+        if (rename (stagedPath.constData(), failedPath.constData()) != 0)
+            err() << "qota-finalize: failed to rename " << stagedPath << ": " << strerror(errno) << endl;
+    }
+    ostree_sysroot_unlock (sysroot);
+
+    QTextStream(stdout) << "qota-finalize: " << (ok ? "finalized" : "failed to finalize")
+                        << " the staged deployment in " << timer.elapsed() << " ms" << endl;
+    return ok ? 0 : 1;
+}
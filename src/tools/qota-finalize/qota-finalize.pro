@@ -0,0 +1,19 @@
+TARGET = qota-finalize
+QT = core qtotaupdate-private
+
+INCLUDEPATH += \
+    $$[QT_SYSROOT]/usr/include/ostree-1/ \
+    $$[QT_SYSROOT]/usr/include/glib-2.0/ \
+    $$[QT_SYSROOT]/usr/lib/glib-2.0/include
+
+LIBS += -lostree-1 -lgio-2.0 -lglib-2.0 -lgobject-2.0
+
+SOURCES += main.cpp
+
+systemd.files = qota-finalize.path qota-finalize.service
+systemd.path = /lib/systemd/system
+INSTALLS += systemd
+
+OTHER_FILES += $$systemd.files
+
+load(qt_tool)
@@ -0,0 +1,166 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the Qt OTA Update module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:GPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 or (at your option) any later version
+** approved by the KDE Free Qt Foundation. The licenses are as published by
+** the Free Software Foundation and appearing in the file LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+// Runs the peer sharing of the library outside of QOtaClient, for the system root
+// in the OSTREE_SYSROOT environment variable. Used by tests/peer-sharing-test.
+//
+// Usage: qota-peer serve INTERFACE SECRET [PORT]
+//        qota-peer discover SECRET [PORT] [PEER...]
+//        qota-peer proxy SECRET PEER
+//        qota-peer authorize SECRET PEER METHOD PATH
+//
+// 'serve' shares the objects of the repository on INTERFACE until it is terminated.
+// 'discover' prints the URLs of the peers that accept the SECRET, one per line.
+// 'proxy' runs the proxy that authorizes the requests to PEER (host:port), as
+// QOtaClient does for 'ostree pull', and prints its URL. 'authorize' prints the
+// authorization header of one request to PEER.
+
+#include <QtOtaUpdate/private/qotafetchproxy_p.h>
+#include <QtOtaUpdate/private/qotapeerserver_p.h>
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QTextStream>
+#include <QtCore/QUrl>
+
+QT_USE_NAMESPACE
+
+static const int discoveryTimeout = 1000;
+
+static QTextStream &err()
+{
+    static QTextStream stream(stderr);
+    return stream;
+}
+
+static int usage()
+{
+    err() << "Usage: qota-peer serve INTERFACE SECRET [PORT]" << endl
+          << "       qota-peer discover SECRET [PORT] [PEER...]" << endl
+          << "       qota-peer proxy SECRET PEER" << endl
+          << "       qota-peer authorize SECRET PEER METHOD PATH" << endl;
+    return 2;
+}
+
+static bool parsePort(const QString &arg, QOtaPeerSettings *settings)
+{
+    bool ok = false;
+    settings->port = arg.toUShort(&ok);
+    return ok && settings->port != 0;
+}
+
+// Asks PEER (host:port) for a challenge.
+static bool discoverPeer(const QString &secret, const QString &peerArg, QOtaPeer *peer)
+{
+    const QUrl wanted(QStringLiteral("http://") + peerArg);
+    QOtaPeerSettings settings;
+    settings.secret = secret;
+    settings.port = quint16(wanted.port(defaultPeerPort));
+    settings.peers = QStringList(peerArg);
+    for (const QOtaPeer &candidate : QOtaPeerServer::discoverPeers(settings, discoveryTimeout)) {
+        const QUrl url(candidate.url);
+        if (url.host() == wanted.host() && url.port() == int(settings.port)) {
+            *peer = candidate;
+            return true;
+        }
+    }
+    err() << "qota-peer: " << peerArg << " did not answer with the secret" << endl;
+    return false;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments().mid(1);
+    if (args.size() < 2)
+        return usage();
+
+    QOtaPeerSettings settings;
+    settings.enabled = true;
+    const QString command = args.takeFirst();
+    if (command == QLatin1String("discover")) {
+        settings.secret = args.takeFirst();
+        if (!args.isEmpty() && !parsePort(args.takeFirst(), &settings))
+            return usage();
+        settings.peers = args;
+        QTextStream out(stdout);
+        for (const QOtaPeer &peer : QOtaPeerServer::discoverPeers(settings, discoveryTimeout))
+            out << peer.url << endl;
+        return 0;
+    }
+
+    if (command == QLatin1String("proxy")) {
+        if (args.size() != 2)
+            return usage();
+        QOtaPeer peer;
+        if (!discoverPeer(args.at(0), args.at(1), &peer))
+            return 1;
+        QOtaFetchProxy proxy;
+        proxy.setPeerAuthentication(QOtaPeerServer::peerKey(args.at(0)), peer.challenge);
+        const QString proxyUrl = proxy.start(QUrl(peer.url), false);
+        if (proxyUrl.isEmpty()) {
+            err() << "qota-peer: failed to start the proxy" << endl;
+            return 1;
+        }
+        QTextStream(stdout) << "qota-peer: proxy " << proxyUrl << " for " << peer.url << endl;
+        return app.exec();
+    }
+
+    if (command == QLatin1String("authorize")) {
+        if (args.size() != 4)
+            return usage();
+        QOtaPeer peer;
+        if (!discoverPeer(args.at(0), args.at(1), &peer))
+            return 1;
+        QTextStream(stdout) << peerAuthorizationHeader << ": "
+                            << QOtaPeerServer::authorization(QOtaPeerServer::peerKey(args.at(0)), peer.challenge, 0,
+                                                             args.at(2).toLatin1(), args.at(3))
+                            << endl;
+        return 0;
+    }
+
+    if (command != QLatin1String("serve") || args.size() < 2 || args.size() > 3)
+        return usage();
+    settings.interfaceName = args.at(0);
+    settings.secret = args.at(1);
+    if (args.size() == 3 && !parsePort(args.at(2), &settings))
+        return usage();
+
+    QOtaPeerServer server;
+    QObject::connect(&server, &QOtaPeerServer::started, &app, [&app](bool success, const QString &interfaceName,
+                                                                      quint16 port) {
+        if (!success) {
+            err() << "qota-peer: failed to share the repository on " << interfaceName << endl;
+            app.exit(1);
+            return;
+        }
+        QTextStream(stdout) << "qota-peer: sharing on " << interfaceName << " port " << port << endl;
+    });
+    server.start(settings);
+    return app.exec();
+}
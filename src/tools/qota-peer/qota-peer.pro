@@ -0,0 +1,6 @@
+TARGET = qota-peer
+QT = core network qtotaupdate-private
+
+SOURCES += main.cpp
+
+load(qt_tool)
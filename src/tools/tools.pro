@@ -0,0 +1,5 @@
+TEMPLATE = subdirs
+SUBDIRS += \
+    qota-fetch \
+    qota-peer \
+    qota-finalize
@@ -0,0 +1,8 @@
+CONFIG += testcase
+TARGET = tst_qotaupdatescheduler
+QT = core testlib qtotaupdate-private
+
+# QOtaUpdateSchedulerPrivate is exported only for autotests.
+requires(contains(QT_CONFIG, private_tests))
+
+SOURCES += tst_qotaupdatescheduler.cpp
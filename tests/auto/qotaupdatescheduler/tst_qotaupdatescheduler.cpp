@@ -0,0 +1,178 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the Qt OTA Update module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:GPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 or (at your option) any later version
+** approved by the KDE Free Qt Foundation. The licenses are as published by
+** the Free Software Foundation and appearing in the file LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+#include <QtOtaUpdate/private/qotaupdatescheduler_p.h>
+
+#include <QtCore/QObject>
+#include <QtCore/QVector>
+#include <QtTest/QtTest>
+
+#include <functional>
+#include <queue>
+#include <random>
+#include <utility>
+#include <vector>
+
+QT_USE_NAMESPACE
+
+// Each device polls the server once per interval, see QOtaUpdateScheduler::interval.
+static const int interval = 60 * 60;
+static const int retryInterval = 60;
+static const qreal jitter = 0.2;
+static const int simulatedTime = 6 * interval;
+
+class tst_QOtaUpdateScheduler : public QObject
+{
+    Q_OBJECT
+private slots:
+    void fleetStart_data();
+    void fleetStart();
+    void serverOutage_data();
+    void serverOutage();
+};
+
+// Runs the update checks of the given number of devices in virtual time, all
+// devices are started at the same time. Every update check is a request at the
+// server, which answers it when serverUp() returns true for the time of the request.
+// Returns the number of requests in each second of the simulation.
+static QVector<int> simulate(int devices, const std::function<bool(int second)> &serverUp)
+{
+    typedef std::pair<qint64, int> Check; // time in ms, device
+    std::priority_queue<Check, std::vector<Check>, std::greater<Check>> checks;
+    // a fixed seed makes the result reproducible
+    std::mt19937 generator(1);
+    std::uniform_real_distribution<qreal> random(0, 1);
+    for (int i = 0; i < devices; ++i)
+        checks.push(Check(QOtaUpdateSchedulerPrivate::firstCheckDelay(interval, jitter, random(generator)), i));
+
+    QVector<int> consecutiveFailures(devices, 0);
+    QVector<int> requests(simulatedTime, 0);
+    while (!checks.empty() && checks.top().first < qint64(simulatedTime) * 1000) {
+        Check check = checks.top();
+        checks.pop();
+        int second = int(check.first / 1000);
+        requests[second]++;
+
+        int &failures = consecutiveFailures[check.second];
+        bool success = serverUp(second);
+        failures = success ? 0 : failures + 1;
+        qint64 delay = QOtaUpdateSchedulerPrivate::nextCheckDelay(interval, retryInterval, jitter, failures,
+                                                                  success, 0, random(generator));
+        checks.push(Check(check.first + delay, check.second));
+    }
+    return requests;
+}
+
+struct RequestRate
+{
+    qreal mean;
+    int peakSecond;
+    qreal peakMinute; // mean rate in the busiest minute
+};
+
+// Prints and returns the request rate at the server in [from, to) seconds.
+static RequestRate requestRate(const char *phase, const QVector<int> &requests, int from, int to)
+{
+    RequestRate rate = { 0, 0, 0 };
+    int total = 0;
+    int minute = 0;
+    for (int second = from; second < to; ++second) {
+        total += requests.at(second);
+        minute += requests.at(second);
+        rate.peakSecond = qMax(rate.peakSecond, requests.at(second));
+        if ((second - from) % 60 == 59) {
+            rate.peakMinute = qMax(rate.peakMinute, minute / 60.0);
+            minute = 0;
+        }
+    }
+    rate.mean = qreal(total) / (to - from);
+    qDebug().noquote() << QString::asprintf("%-32s %8.2f requests/s, peak %4d requests/s, busiest minute %8.2f requests/s",
+                                            phase, rate.mean, rate.peakSecond, rate.peakMinute);
+    return rate;
+}
+
+void tst_QOtaUpdateScheduler::fleetStart_data()
+{
+    QTest::addColumn<int>("devices");
+    QTest::newRow("1000 devices") << 1000;
+    QTest::newRow("10000 devices") << 10000;
+}
+
+// The devices are started at the same time, for example after a power outage.
+void tst_QOtaUpdateScheduler::fleetStart()
+{
+    QFETCH(int, devices);
+    const int spread = int(interval * jitter);
+    QVector<int> requests = simulate(devices, [](int) { return true; });
+
+    RequestRate first = requestRate("first checks", requests, 0, spread);
+    RequestRate steady = requestRate("steady state", requests, simulatedTime / 2, simulatedTime);
+
+    // The first checks are spread over the jitter of the interval. Measured: the
+    // busiest minute is 1.27 (1000 devices) and 1.10 (10000 devices) times the mean.
+    const qreal expectedFirst = qreal(devices) / spread;
+    QVERIFY2(first.peakMinute < 1.5 * expectedFirst, qPrintable(QString::number(first.peakMinute)));
+    // Afterwards, each device checks once per interval. Measured: 1.1% and 1.5% off.
+    const qreal expectedSteady = qreal(devices) / interval;
+    QVERIFY2(qAbs(steady.mean - expectedSteady) < 0.05 * expectedSteady, qPrintable(QString::number(steady.mean)));
+}
+
+void tst_QOtaUpdateScheduler::serverOutage_data()
+{
+    fleetStart_data();
+}
+
+// The server fails all requests for half an hour, the devices back off and must
+// not overload the server when it comes back.
+void tst_QOtaUpdateScheduler::serverOutage()
+{
+    QFETCH(int, devices);
+    const int outageStart = 2 * interval;
+    const int outageEnd = outageStart + interval / 2;
+    QVector<int> requests = simulate(devices, [=](int second) {
+        return second < outageStart || second >= outageEnd;
+    });
+
+    RequestRate before = requestRate("before the outage", requests, interval, outageStart);
+    RequestRate outage = requestRate("during the outage", requests, outageStart, outageEnd);
+    RequestRate recovery = requestRate("after the outage", requests, outageEnd, outageEnd + interval);
+
+    // Failed checks back off from the retry interval. Measured: 3.6 requests per
+    // device during the outage, a fixed retry interval would send 30.
+    const qreal requestsPerDevice = outage.mean * (outageEnd - outageStart) / devices;
+    QVERIFY2(requestsPerDevice < 4.5, qPrintable(QString::number(requestsPerDevice)));
+    // The randomized backoff spreads the retries, no herd hits the recovered server.
+    // Measured: the busiest minute is 0.83 and 0.88 times the rate of the first checks.
+    const qreal expectedFirst = qreal(devices) / (interval * jitter);
+    QVERIFY2(recovery.peakMinute < expectedFirst, qPrintable(QString::number(recovery.peakMinute)));
+    QVERIFY(before.mean > 0);
+}
+
+QTEST_GUILESS_MAIN(tst_QOtaUpdateScheduler)
+
+#include "tst_qotaupdatescheduler.moc"